@@ -42,6 +42,18 @@
  *                                                          Longitude : 0.000001 ° Signed MSB
  *                                                          Altitude  : 0.01 meter Signed MSB
  *  VOC index           3338    138     8A      1           VOC index
+ *  GPS Track           -       140     8C      variable    Number of points, first point and delta encoded points
+ *                                                          Latitude  : 0.000001 ° Signed MSB
+ *                                                          Longitude : 0.000001 ° Signed MSB
+ *                                                          Time      : Unix time MSB
+ *                                                          Next points as varint deltas to the previous point,
+ *                                                          latitude and longitude zigzag encoded
+ *  Fragment            -       141     8D      2           Packet ID, fragment index (high nibble) and fragment count (low nibble)
+ *  Sequence            -       143     8F      4           Sequence number of the reading, unsigned MSB
+ *  Diagnostics         -       144     90      8           Reset cause, boots (unsigned MSB), abnormal resets (unsigned MSB),
+ *                                                          uptime before the reset in minutes (unsigned MSB), heap usage in %
+ *  Stage timing        -       145     91      12          Average ms of event handler, BME680, location, cellular send, LoRaWAN TX
+ *                                                          and charge of the last cycle in uAh, each unsigned MSB
  *  Wind Speed          3390    190     BE      2           Wind speed 0.01 m/s
  *  Wind Direction      3391    191     BF      2           Wind direction 1º Unsigned MSB
  *  Light Level         3403    203     CB      1           0 0-5 lux, 1 6-50 lux, 2 51-100 lux, 3 101-500 lux, 4 501-2000 lux, 6 >2000 lux
@@ -62,17 +74,12 @@ function lppDecode(bytes) {
 	var sensor_types = {
 		0: { 'size': 1, 'name': 'digital_in', 'signed': false, 'divisor': 1 },
 		1: { 'size': 1, 'name': 'digital_out', 'signed': false, 'divisor': 1 },
-		2: { 'size': 2, 'name': 'analog_in', 'signed': true, 'divisor': 100 },
 		3: { 'size': 2, 'name': 'analog_out', 'signed': true, 'divisor': 100 },
 		100: { 'size': 4, 'name': 'generic', 'signed': false, 'divisor': 1 },
 		101: { 'size': 2, 'name': 'illuminance', 'signed': false, 'divisor': 1 },
 		102: { 'size': 1, 'name': 'presence', 'signed': false, 'divisor': 1 },
-		103: { 'size': 2, 'name': 'temperature', 'signed': true, 'divisor': 10 },
-		104: { 'size': 1, 'name': 'humidity', 'signed': false, 'divisor': 2 },
 		112: { 'size': 2, 'name': 'humidity_prec', 'signed': true, 'divisor': 10 },
 		113: { 'size': 6, 'name': 'accelerometer', 'signed': true, 'divisor': 1000 },
-		115: { 'size': 2, 'name': 'barometer', 'signed': false, 'divisor': 10 },
-		116: { 'size': 2, 'name': 'voltage', 'signed': false, 'divisor': 100 },
 		117: { 'size': 2, 'name': 'current', 'signed': false, 'divisor': 1000 },
 		118: { 'size': 4, 'name': 'frequency', 'signed': false, 'divisor': 1 },
 		120: { 'size': 1, 'name': 'percentage', 'signed': false, 'divisor': 1 },
@@ -86,7 +93,6 @@ function lppDecode(bytes) {
 		134: { 'size': 6, 'name': 'gyrometer', 'signed': true, 'divisor': 100 },
 		135: { 'size': 3, 'name': 'colour', 'signed': false, 'divisor': 1 },
 		136: { 'size': 9, 'name': 'gps', 'signed': true, 'divisor': [10000, 10000, 100] },
-		137: { 'size': 11, 'name': 'gps', 'signed': true, 'divisor': [1000000, 1000000, 100] },
 		138: { 'size': 2, 'name': 'voc', 'signed': false, 'divisor': 1 },
 		142: { 'size': 1, 'name': 'switch', 'signed': false, 'divisor': 1 },
 		188: { 'size': 2, 'name': 'soil_moist', 'signed': false, 'divisor': 10 },
@@ -97,21 +103,35 @@ function lppDecode(bytes) {
 		194: { 'size': 2, 'name': 'soil_ph_l', 'signed': false, 'divisor': 10 },
 		195: { 'size': 2, 'name': 'pyranometer', 'signed': false, 'divisor': 1 },
 		203: { 'size': 1, 'name': 'light', 'signed': false, 'divisor': 1 },
-		255: { 'size': 4, 'name': 'dev_id', 'unsigned': false, 'divisor': 1 },
+		// Generated from src/payload_schema.h by gen_decoder.py, do not edit
+		2: { 'size': 2, 'name': 'analog_in', 'signed': true, 'divisor': 100 },
+		103: { 'size': 2, 'name': 'temperature', 'signed': true, 'divisor': 10 },
+		104: { 'size': 1, 'name': 'humidity', 'signed': false, 'divisor': 2 },
+		115: { 'size': 2, 'name': 'barometer', 'signed': false, 'divisor': 10 },
+		116: { 'size': 2, 'name': 'voltage', 'signed': false, 'divisor': 100 },
+		137: { 'size': 11, 'name': 'gps', 'signed': true, 'divisor': [1000000, 1000000, 100] },
+		140: { 'size': 0, 'name': 'track', 'signed': true, 'divisor': 1000000 },
+		141: { 'size': 2, 'name': 'fragment', 'signed': false, 'divisor': 1 },
+		143: { 'size': 4, 'name': 'sequence', 'signed': false, 'divisor': 1 },
+		144: { 'size': 8, 'name': 'diag', 'signed': false, 'divisor': 1 },
+		145: { 'size': 12, 'name': 'timing', 'signed': false, 'divisor': 1 },
+		255: { 'size': 4, 'name': 'dev_id', 'signed': false, 'divisor': 1 },
+		// End of generated types
 	};
 
 	function arrayToDecimal(stream, is_signed, divisor) {
 
+		// No bit operators, they are limited to 32 bit signed values
 		var value = 0;
 		for (var i = 0; i < stream.length; i++) {
 			if (stream[i] > 0xFF)
 				throw 'Byte value overflow!';
-			value = (value << 8) | stream[i];
+			value = value * 256 + stream[i];
 		}
 
 		if (is_signed) {
-			var edge = 1 << (stream.length) * 8;  // 0x1000..
-			var max = (edge - 1) >> 1;             // 0x0FFF.. >> 1
+			var edge = Math.pow(2, stream.length * 8);  // 0x1000..
+			var max = edge / 2 - 1;                     // 0x0FFF..
 			value = (value > max) ? value - edge : value;
 		}
 
@@ -121,6 +141,27 @@ function lppDecode(bytes) {
 
 	}
 
+	// Read a varint, 7 bits per byte, lowest bits first
+	function readVarint(stream, pos) {
+		var value = 0;
+		var factor = 1;
+		var len = 0;
+		while (pos + len < stream.length) {
+			var byte = stream[pos + len++];
+			value += (byte & 0x7F) * factor;
+			factor *= 128;
+			if ((byte & 0x80) == 0) {
+				break;
+			}
+		}
+		return { 'value': value, 'len': len };
+	}
+
+	// Convert a zigzag encoded value back to a signed value
+	function unZigzag(value) {
+		return (value % 2) ? -(value + 1) / 2 : value / 2;
+	}
+
 	var sensors = [];
 	var i = 0;
 	while (i < bytes.length) {
@@ -169,6 +210,58 @@ function lppDecode(bytes) {
 					'value': s_value.altitude
 				});
 				break;
+			case 140:   // GPS Track
+				var points = bytes[i++];
+				var lat = (bytes[i] << 24) | (bytes[i + 1] << 16) | (bytes[i + 2] << 8) | bytes[i + 3];
+				var lon = (bytes[i + 4] << 24) | (bytes[i + 5] << 16) | (bytes[i + 6] << 8) | bytes[i + 7];
+				var time = ((bytes[i + 8] << 24) | (bytes[i + 9] << 16) | (bytes[i + 10] << 8) | bytes[i + 11]) >>> 0;
+				i += 12;
+				s_value = [];
+				for (var p = 0; p < points; p++) {
+					if (p != 0) {
+						var delta = readVarint(bytes, i);
+						i += delta.len;
+						lat += unZigzag(delta.value);
+						delta = readVarint(bytes, i);
+						i += delta.len;
+						lon += unZigzag(delta.value);
+						delta = readVarint(bytes, i);
+						i += delta.len;
+						time += delta.value;
+					}
+					s_value.push({
+						'latitude': lat / type.divisor,
+						'longitude': lon / type.divisor,
+						'time': time
+					});
+				}
+				break;
+			case 144:   // Reset diagnostics
+				s_value = {
+					'cause': bytes[i],
+					'boots': (bytes[i + 1] << 8) | bytes[i + 2],
+					'abnormal': (bytes[i + 3] << 8) | bytes[i + 4],
+					'uptime': (bytes[i + 5] << 8) | bytes[i + 6],
+					'heap': bytes[i + 7]
+				};
+				break;
+			case 145:   // Stage timing
+				s_value = {
+					'event': (bytes[i] << 8) | bytes[i + 1],
+					'bme': (bytes[i + 2] << 8) | bytes[i + 3],
+					'location': (bytes[i + 4] << 8) | bytes[i + 5],
+					'cell_send': (bytes[i + 6] << 8) | bytes[i + 7],
+					'lora_tx': (bytes[i + 8] << 8) | bytes[i + 9],
+					'cycle_uah': (bytes[i + 10] << 8) | bytes[i + 11]
+				};
+				break;
+			case 141:   // Fragment of a split packet
+				s_value = {
+					'packet': bytes[i],
+					'index': bytes[i + 1] >> 4,
+					'count': bytes[i + 1] & 0x0F
+				};
+				break;
 			case 135:   // Colour
 				s_value = {
 					'r': arrayToDecimal(bytes.slice(i + 0, i + 1), type.signed, type.divisor),
@@ -197,6 +290,32 @@ function lppDecode(bytes) {
 
 }
 
+// DuplicateFilter finds the second copy of a reading that arrived over LoRaWAN and over cellular.
+// The decoder itself keeps no state between uplinks, the filter belongs to the ingestion side,
+// which keeps one filter for all devices. Readings are keyed on the DevEUI and the sequence number,
+// so readings of different devices with the same sequence number are all kept.
+function DuplicateFilter(maxPerDevice) {
+	this.maxPerDevice = maxPerDevice || 32;
+	this.seen = {};
+}
+
+// isDuplicate checks if a reading of this device with this sequence number was already forwarded
+DuplicateFilter.prototype.isDuplicate = function (devEui, sequence) {
+	var key = String(devEui).toLowerCase();
+	var sequences = this.seen[key];
+	if (typeof sequences == 'undefined') {
+		sequences = this.seen[key] = [];
+	}
+	if (sequences.indexOf(sequence) >= 0) {
+		return true;
+	}
+	sequences.push(sequence);
+	if (sequences.length > this.maxPerDevice) {
+		sequences.shift();
+	}
+	return false;
+};
+
 function Decoder(request, fPort) {
 
 	var decoded = {};
@@ -222,6 +341,45 @@ function Decoder(request, fPort) {
 		}
 	});
 
+	// A reading sent over both paths has the same sequence number on both, the ingestion side
+	// drops the second copy with a DuplicateFilter keyed on DevEUI and sequence number.
+	// Fragments must not be dropped, the other path might carry the fragments that were lost.
+	if (typeof decoded.sequence_13 != 'undefined') {
+		decoded.sequence = decoded.sequence_13;
+		decoded.sequence_unique = typeof decoded.fragment_12 == 'undefined';
+		delete decoded.sequence_13;
+	}
+
+	// Fragments of a split packet carry the same packet ID, the server merges their fields
+	if (typeof decoded.fragment_12 != 'undefined') {
+		decoded.fragment_packet = decoded.fragment_12.packet;
+		decoded.fragment_index = decoded.fragment_12.index;
+		decoded.fragment_count = decoded.fragment_12.count;
+		delete decoded.fragment_12;
+	}
+
+	// Reset diagnostics are sent once after a restart
+	if (typeof decoded.diag_14 != 'undefined') {
+		var causes = ['power_on', 'reset_pin', 'watchdog', 'software', 'lockup', 'wakeup', 'notecard_memory'];
+		decoded.reset_cause = causes[decoded.diag_14.cause] || ('unknown_' + decoded.diag_14.cause);
+		decoded.boot_count = decoded.diag_14.boots;
+		decoded.abnormal_resets = decoded.diag_14.abnormal;
+		decoded.uptime_before_reset = decoded.diag_14.uptime;
+		decoded.heap_usage = decoded.diag_14.heap;
+		delete decoded.diag_14;
+	}
+
+	// Stage timing is only sent if enabled with AT+BSTAGE=1
+	if (typeof decoded.timing_15 != 'undefined') {
+		decoded.time_event_ms = decoded.timing_15.event;
+		decoded.time_bme_ms = decoded.timing_15.bme;
+		decoded.time_location_ms = decoded.timing_15.location;
+		decoded.time_cell_send_ms = decoded.timing_15.cell_send;
+		decoded.time_lora_tx_ms = decoded.timing_15.lora_tx;
+		decoded.cycle_charge_uah = decoded.timing_15.cycle_uah;
+		delete decoded.timing_15;
+	}
+
 	// Array where we store the fields that are being sent to Datacake
 	var datacakeFields = []
 
@@ -235,4 +393,8 @@ function Decoder(request, fPort) {
 	// forward data to Datacake
 	return datacakeFields;
 
-}
\ No newline at end of file
+}
+
+if (typeof module != 'undefined') {
+	module.exports = { lppDecode: lppDecode, Decoder: Decoder, DuplicateFilter: DuplicateFilter };
+}
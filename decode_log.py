@@ -0,0 +1,157 @@
+"""Decode the binary debug log of the tracker
+
+The firmware prints each log line as '@' followed by the hex of a binary
+record. The tag and format strings are only referenced by their address,
+they are read from the ELF file of the same build.
+
+Usage:
+	python decode_log.py <firmware.elf> [log file]
+
+Without a log file the log is read from stdin, e.g.
+	pio device monitor | python decode_log.py Debug-Build/RAK-Blues-Tracker_V1.0.0_dbg.elf
+Lines that do not start with '@' (AT command responses) are printed unchanged.
+"""
+import re
+import struct
+import sys
+
+# Section header type of sections without data in the file
+SHT_NOBITS = 8
+# Section flag of sections that are loaded into memory
+SHF_ALLOC = 0x2
+
+# printf conversion, length modifiers are not used by Python
+FORMAT_SPEC = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z)?([diouxXeEfgGcs%])')
+
+
+class Elf:
+	"""Read strings from the loaded sections of an ELF32 little endian file"""
+
+	def __init__(self, path):
+		with open(path, 'rb') as elf_file:
+			self.data = elf_file.read()
+		if self.data[:4] != b'\x7fELF' or self.data[4] != 1 or self.data[5] != 1:
+			raise ValueError('%s is not an ELF32 little endian file' % path)
+		sh_off = struct.unpack_from('<I', self.data, 0x20)[0]
+		sh_entsize, sh_num = struct.unpack_from('<HH', self.data, 0x2E)
+		self.sections = []
+		for idx in range(sh_num):
+			(_, sh_type, sh_flags, sh_addr, sh_offset, sh_size) = struct.unpack_from('<IIIIII', self.data, sh_off + idx * sh_entsize)
+			if (sh_flags & SHF_ALLOC) and sh_type != SHT_NOBITS and sh_size != 0:
+				self.sections.append((sh_addr, sh_offset, sh_size))
+
+	def string(self, address):
+		"""Get the zero terminated string at address, None if it is not in the file"""
+		for (sh_addr, sh_offset, sh_size) in self.sections:
+			if sh_addr <= address < sh_addr + sh_size:
+				start = sh_offset + address - sh_addr
+				end = self.data.find(b'\0', start, sh_offset + sh_size)
+				if end < 0:
+					return None
+				return self.data[start:end].decode('utf-8', 'replace')
+		return None
+
+
+def read_args(elf, args):
+	"""Decode the typed arguments of a record"""
+	values = []
+	pos = 0
+	while pos < len(args):
+		arg_type = chr(args[pos])
+		pos += 1
+		if arg_type == 'i':
+			values.append(struct.unpack_from('<I', args, pos)[0])
+			pos += 4
+		elif arg_type == 'f':
+			values.append(struct.unpack_from('<f', args, pos)[0])
+			pos += 4
+		elif arg_type == 'p':
+			address = struct.unpack_from('<I', args, pos)[0]
+			text = elf.string(address) if address != 0 else '(null)'
+			values.append(text if text is not None else '<0x%08X>' % address)
+			pos += 4
+		elif arg_type == 's':
+			end = args.find(b'\0', pos)
+			if end < 0:
+				end = len(args)
+			values.append(args[pos:end].decode('utf-8', 'replace'))
+			pos = end + 1
+		else:
+			break
+	return values
+
+
+def format_line(format_string, values):
+	"""Format a C printf string with the values of the record"""
+	values = list(values)
+	result = []
+	pos = 0
+	for match in FORMAT_SPEC.finditer(format_string):
+		result.append(format_string[pos:match.start()])
+		pos = match.end()
+		flags, conversion = match.groups()
+		if conversion == '%':
+			result.append('%')
+			continue
+		if not values:
+			result.append('<missing>')
+			continue
+		value = values.pop(0)
+		if conversion in 'di' and isinstance(value, int) and value >= 0x80000000:
+			value -= 0x100000000
+		if conversion == 'u':
+			conversion = 'd'
+		if conversion == 's':
+			value = str(value)
+		try:
+			result.append(('%' + flags + conversion) % value)
+		except (TypeError, ValueError):
+			result.append(str(value))
+	result.append(format_string[pos:])
+	return ''.join(result)
+
+
+def decode(elf, line, last_number):
+	"""Decode one log line, returns the text and the record number"""
+	raw = bytes.fromhex(line[1:].strip())
+	number, time_ms, tag_address, format_address, length = struct.unpack_from('<IIIIB', raw, 0)
+	args = raw[17:17 + length]
+
+	text = ''
+	if last_number is not None and number > last_number + 1:
+		text += '[LOG] %d records lost\n' % (number - last_number - 1)
+	if format_address == 0:
+		return text + '%10d [LOG] Record %d not finished before reset' % (time_ms, number), number
+
+	tag = elf.string(tag_address) if tag_address != 0 else None
+	format_string = elf.string(format_address)
+	if format_string is None:
+		return text + '%10d [LOG] Unknown format 0x%08X, wrong ELF file?' % (time_ms, format_address), number
+	message = format_line(format_string, read_args(elf, args))
+	if tag is not None:
+		message = '[%s] %s' % (tag, message)
+	return text + '%10d %s' % (time_ms, message), number
+
+
+def main():
+	if len(sys.argv) < 2:
+		print(__doc__)
+		sys.exit(1)
+	elf = Elf(sys.argv[1])
+	source = open(sys.argv[2], 'r', errors='replace') if len(sys.argv) > 2 else sys.stdin
+
+	last_number = None
+	for line in source:
+		if line.startswith('@'):
+			try:
+				text, last_number = decode(elf, line, last_number)
+				print(text)
+			except (ValueError, struct.error):
+				print(line.rstrip())
+		else:
+			print(line.rstrip())
+		sys.stdout.flush()
+
+
+if __name__ == '__main__':
+	main()
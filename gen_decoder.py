@@ -0,0 +1,95 @@
+"""Generate the payload type table of Decoder.js from src/payload_schema.h
+
+The firmware and the decoder use the same schema, a field is only changed
+in payload_schema.h. Runs before each build as PlatformIO pre script, or
+standalone:
+	python gen_decoder.py
+Decoder.js is only written if the table changed.
+The fields with a layout other than SCALAR have a hand written decoder in
+Decoder.js, the script fails if one is missing, or if a SCALAR field has one
+and would not be decoded with the scale of the schema.
+"""
+import os
+import re
+import sys
+
+# FIELD(id, channel, type, size, scale, signed, layout, "name")
+FIELD_ROW = re.compile(r'FIELD\(\s*(\w+)\s*,\s*(\d+)\s*,\s*(\d+)\s*,\s*(\d+)\s*,\s*(\d+)\s*,\s*(true|false)\s*,\s*(\w+)\s*,\s*"(\w+)"\s*\)')
+
+# Scale of the altitude of a GPS_6 field
+ALTITUDE_SCALE = re.compile(r'#define\s+PAYLOAD_ALTITUDE_SCALE\s+(\d+)')
+
+# Hand written decoder of a type in the switch of lppDecode
+DECODER_CASE = re.compile(r'^\s*case\s+(\d+)\s*:', re.MULTILINE)
+
+BEGIN_MARK = '// Generated from src/payload_schema.h by gen_decoder.py, do not edit'
+END_MARK = '// End of generated types'
+
+
+def read_schema(header_path):
+	"""Get the fields of the schema, sorted by type"""
+	with open(header_path, 'r') as header:
+		text = header.read()
+	altitude_scale = int(ALTITUDE_SCALE.search(text).group(1))
+	fields = {}
+	for (_, _, lpp_type, size, scale, signed, layout, name) in FIELD_ROW.findall(text):
+		divisor = scale
+		if layout == 'GPS_6':
+			divisor = '[%s, %s, %d]' % (scale, scale, altitude_scale)
+		fields[int(lpp_type)] = (int(size), name, signed, divisor, layout)
+	return [(lpp_type,) + fields[lpp_type] for lpp_type in sorted(fields)]
+
+
+def check_decoders(schema, text):
+	"""Check that exactly the fields that are not SCALAR have a hand written decoder"""
+	cases = set(int(lpp_type) for lpp_type in DECODER_CASE.findall(text))
+	errors = []
+	for (lpp_type, _, name, _, _, layout) in schema:
+		if layout != 'SCALAR' and lpp_type not in cases:
+			errors.append('no decoder for %d %s with layout %s' % (lpp_type, name, layout))
+		if layout == 'SCALAR' and lpp_type in cases:
+			errors.append('%d %s is SCALAR, but has its own decoder' % (lpp_type, name))
+	return errors
+
+
+def generate(project_dir):
+	"""Replace the generated types in Decoder.js, returns False on an error"""
+	header_path = os.path.join(project_dir, 'src', 'payload_schema.h')
+	decoder_path = os.path.join(project_dir, 'Decoder.js')
+
+	schema = read_schema(header_path)
+	lines = ['\t\t' + BEGIN_MARK]
+	for (lpp_type, size, name, signed, divisor, _) in schema:
+		lines.append("\t\t%d: { 'size': %d, 'name': '%s', 'signed': %s, 'divisor': %s }," % (lpp_type, size, name, signed, divisor))
+	lines.append('\t\t' + END_MARK)
+
+	with open(decoder_path, 'r', newline='') as decoder:
+		text = decoder.read()
+	newline = '\r\n' if '\r\n' in text else '\n'
+	start = text.find(BEGIN_MARK)
+	end = text.find(END_MARK)
+	if start < 0 or end < start:
+		print('gen_decoder.py: markers not found in Decoder.js')
+		return False
+	errors = check_decoders(schema, text)
+	for error in errors:
+		print('gen_decoder.py: Decoder.js ' + error)
+	if errors:
+		return False
+	start = text.rfind(newline, 0, start) + len(newline)
+	end += len(END_MARK)
+	new_text = text[:start] + newline.join(lines) + text[end:]
+	if new_text != text:
+		with open(decoder_path, 'w', newline='') as decoder:
+			decoder.write(new_text)
+		print('gen_decoder.py: Decoder.js updated')
+	return True
+
+
+try:
+	Import("env")
+	if not generate(env.subst("$PROJECT_DIR")):
+		env.Exit(1)
+except NameError:
+	if not generate(os.path.dirname(os.path.abspath(__file__))):
+		sys.exit(1)
@@ -0,0 +1,523 @@
+/**
+ * @file lpp_decoder.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Header only Cayenne LPP decoder for the payload of the tracker, same results as Decoder.js
+ *        For servers that decode many frames. The types of the tracker are taken from
+ *        src/payload_schema.h, the fields point into the frame, nothing is copied or allocated.
+ * @version 0.1
+ * @date 2023-09-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LPP_DECODER_H
+#define LPP_DECODER_H
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "src/payload_schema.h"
+
+namespace lpp
+{
+	/** How the data of a type is decoded */
+	enum layout
+	{
+		LAYOUT_UNKNOWN = 0, // Type is not supported
+		LAYOUT_SCALAR,		// One value, MSB first
+		LAYOUT_XYZ,			// Three 2 byte values, accelerometer and gyrometer
+		LAYOUT_COLOUR,		// Three 1 byte values
+		LAYOUT_GPS_4,		// Latitude, longitude and altitude, 3 bytes each
+		LAYOUT_GPS_6,		// Latitude and longitude 4 bytes, altitude 3 bytes
+		LAYOUT_TRACK,		// Point count, anchor point and delta encoded points
+		LAYOUT_FRAGMENT,	// Packet ID, fragment index and count
+		LAYOUT_DIAG,		// Reset diagnostics
+		LAYOUT_TIMING,		// Stage timing
+	};
+
+	/** Description of one LPP type */
+	struct TypeInfo
+	{
+		const char *name; // Name used by Decoder.js
+		uint8_t layout;	  // LAYOUT_xxx
+		uint8_t size;	  // Data size, 0 = variable
+		bool is_signed;
+		double divisor; // Divisor of the value, of latitude and longitude for GNSS types
+	};
+
+	/**
+	 * @brief Read a value MSB first
+	 *
+	 * @param data start of the value
+	 * @param bytes size of the value, 1 to 4
+	 * @return uint32_t value
+	 */
+	inline uint32_t read_be(const uint8_t *data, uint8_t bytes)
+	{
+		switch (bytes)
+		{
+		case 1:
+			return data[0];
+		case 2:
+			return ((uint32_t)data[0] << 8) | data[1];
+		case 3:
+			return ((uint32_t)data[0] << 16) | ((uint32_t)data[1] << 8) | data[2];
+		default:
+			return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+		}
+	}
+
+	/**
+	 * @brief Read a value MSB first and scale it
+	 *
+	 * @param data start of the value
+	 * @param bytes size of the value, 1 to 4
+	 * @param is_signed value is two's complement
+	 * @param divisor divisor of the value
+	 * @return double value
+	 */
+	inline double read_scaled(const uint8_t *data, uint8_t bytes, bool is_signed, double divisor)
+	{
+		uint32_t value = read_be(data, bytes);
+		if (is_signed && (bytes < 4))
+		{
+			uint32_t sign = 1UL << (bytes * 8 - 1);
+			return (double)((int32_t)((value ^ sign) - sign)) / divisor;
+		}
+		return (is_signed ? (double)(int32_t)value : (double)value) / divisor;
+	}
+
+	/** Type table, indexed by the LPP type */
+	class TypeTable
+	{
+	public:
+		TypeTable(void)
+		{
+			memset(types, 0, sizeof(types));
+			// Standard types as in Decoder.js
+			add(0, 1, false, 1, "digital_in");
+			add(1, 1, false, 1, "digital_out");
+			add(3, 2, true, 100, "analog_out");
+			add(100, 4, false, 1, "generic");
+			add(101, 2, false, 1, "illuminance");
+			add(102, 1, false, 1, "presence");
+			add(112, 2, true, 10, "humidity_prec");
+			add(113, 6, true, 1000, "accelerometer");
+			add(117, 2, false, 1000, "current");
+			add(118, 4, false, 1, "frequency");
+			add(120, 1, false, 1, "percentage");
+			add(121, 2, true, 1, "altitude");
+			add(125, 2, false, 1, "concentration");
+			add(128, 2, false, 1, "power");
+			add(130, 4, false, 1000, "distance");
+			add(131, 4, false, 1000, "energy");
+			add(132, 2, false, 1, "direction");
+			add(133, 4, false, 1, "time");
+			add(134, 6, true, 100, "gyrometer");
+			add(135, 3, false, 1, "colour");
+			add(136, 9, true, 10000, "gps");
+			add(138, 2, false, 1, "voc");
+			add(142, 1, false, 1, "switch");
+			add(188, 2, false, 10, "soil_moist");
+			add(190, 2, false, 100, "wind_speed");
+			add(191, 2, false, 1, "wind_direction");
+			add(192, 2, false, 1000, "soil_ec");
+			add(193, 2, false, 100, "soil_ph_h");
+			add(194, 2, false, 10, "soil_ph_l");
+			add(195, 2, false, 1, "pyranometer");
+			add(203, 1, false, 1, "light");
+			// Types of the tracker, overwrite the standard types with the same number
+#define LPP_DECODER_ADD(id, channel, type, size, scale, is_signed, layout, name) add(type, size, is_signed, scale, name, LAYOUT_##layout);
+			PAYLOAD_SCHEMA(LPP_DECODER_ADD)
+#undef LPP_DECODER_ADD
+		}
+
+		/**
+		 * @brief Get the description of a type
+		 *
+		 * @param type LPP type
+		 * @return const TypeInfo* description, layout is LAYOUT_UNKNOWN if the type is not supported
+		 */
+		const TypeInfo *get(uint8_t type) const
+		{
+			return &types[type];
+		}
+
+	private:
+		TypeInfo types[256];
+
+		/**
+		 * @brief Get the layout of the standard types that are not a single value
+		 *        The layout of the tracker types is in the payload schema
+		 *
+		 * @param type LPP type
+		 * @return uint8_t LAYOUT_xxx
+		 */
+		static uint8_t layout_of(uint8_t type)
+		{
+			switch (type)
+			{
+			case 113:
+			case 134:
+				return LAYOUT_XYZ;
+			case 135:
+				return LAYOUT_COLOUR;
+			case 136:
+				return LAYOUT_GPS_4;
+			default:
+				return LAYOUT_SCALAR;
+			}
+		}
+
+		void add(uint8_t type, uint8_t size, bool is_signed, double divisor, const char *name, uint8_t layout = LAYOUT_UNKNOWN)
+		{
+			types[type].name = name;
+			types[type].layout = layout == LAYOUT_UNKNOWN ? layout_of(type) : layout;
+			types[type].size = size;
+			types[type].is_signed = is_signed;
+			types[type].divisor = divisor;
+		}
+	};
+
+	/**
+	 * @brief Get the shared type table, built on first use
+	 *
+	 * @return const TypeTable& type table
+	 */
+	inline const TypeTable &type_table(void)
+	{
+		static const TypeTable table;
+		return table;
+	}
+
+	/** One point of a GNSS track */
+	struct TrackPoint
+	{
+		double latitude;
+		double longitude;
+		uint32_t time; // Epoch time of the fix
+	};
+
+	/**
+	 * @brief Read the points of a track field one by one
+	 *        Format: point count, first point with latitude, longitude (signed MSB)
+	 *        and epoch time (unsigned MSB), then per point the zigzag varint deltas
+	 *        of latitude and longitude and the varint time delta.
+	 *
+	 */
+	class TrackReader
+	{
+	public:
+		TrackReader(const uint8_t *data, uint16_t size, double divisor)
+			: _pos(data + 13), _end(data + size), _divisor(divisor), _left(0), _index(0)
+		{
+			if (size >= 13)
+			{
+				_left = data[0];
+				_lat = (int32_t)read_be(&data[1], 4);
+				_lon = (int32_t)read_be(&data[5], 4);
+				_time = read_be(&data[9], 4);
+			}
+		}
+
+		/**
+		 * @brief Get the number of points
+		 *
+		 * @return uint8_t points left to read
+		 */
+		uint8_t left(void) const
+		{
+			return _left;
+		}
+
+		/**
+		 * @brief Get the next point
+		 *
+		 * @param point decoded point
+		 * @return true if a point was read
+		 * @return false if there are no more points
+		 */
+		bool next(TrackPoint &point)
+		{
+			if (_left == 0)
+			{
+				return false;
+			}
+			if (_index != 0)
+			{
+				uint64_t delta;
+				if (!varint(delta))
+				{
+					_left = 0;
+					return false;
+				}
+				_lat += unzigzag(delta);
+				if (!varint(delta))
+				{
+					_left = 0;
+					return false;
+				}
+				_lon += unzigzag(delta);
+				if (!varint(delta))
+				{
+					_left = 0;
+					return false;
+				}
+				_time += (uint32_t)delta;
+			}
+			point.latitude = (double)_lat / _divisor;
+			point.longitude = (double)_lon / _divisor;
+			point.time = _time;
+			_index++;
+			_left--;
+			return true;
+		}
+
+	private:
+		const uint8_t *_pos;
+		const uint8_t *_end;
+		double _divisor;
+		uint8_t _left;
+		uint8_t _index;
+		int64_t _lat = 0;
+		int64_t _lon = 0;
+		uint32_t _time = 0;
+
+		/** Read a varint, 7 bits per byte, lowest bits first */
+		bool varint(uint64_t &value)
+		{
+			value = 0;
+			for (uint8_t shift = 0; (_pos < _end) && (shift < 64); shift += 7)
+			{
+				uint8_t byte = *_pos++;
+				value |= (uint64_t)(byte & 0x7F) << shift;
+				if ((byte & 0x80) == 0)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		static int64_t unzigzag(uint64_t value)
+		{
+			return (value & 1) ? -(int64_t)((value + 1) >> 1) : (int64_t)(value >> 1);
+		}
+	};
+
+	/** One decoded field, the data points into the frame */
+	struct Field
+	{
+		uint8_t channel;
+		uint8_t type;
+		const TypeInfo *info;
+		const uint8_t *data; // Start of the data, after channel and type
+		uint16_t size;		 // Data size, a track can be longer than 255 bytes
+
+		/** Name used by Decoder.js */
+		const char *name(void) const
+		{
+			return info->name;
+		}
+
+		/** Value of a LAYOUT_SCALAR field */
+		double value(void) const
+		{
+			return read_scaled(data, size, info->is_signed, info->divisor);
+		}
+
+		/**
+		 * @brief Get one value of a field with three values
+		 *        x, y, z / r, g, b / latitude, longitude, altitude
+		 *
+		 * @param index 0 to 2
+		 * @return double value
+		 */
+		double component(uint8_t index) const
+		{
+			switch (info->layout)
+			{
+			case LAYOUT_XYZ:
+				return read_scaled(&data[index * 2], 2, info->is_signed, info->divisor);
+			case LAYOUT_COLOUR:
+				return read_scaled(&data[index], 1, info->is_signed, info->divisor);
+			case LAYOUT_GPS_4:
+				return read_scaled(&data[index * 3], 3, info->is_signed, index == 2 ? 100 : info->divisor);
+			case LAYOUT_GPS_6:
+				return index == 2 ? read_scaled(&data[8], 3, info->is_signed, PAYLOAD_ALTITUDE_SCALE)
+								  : read_scaled(&data[index * 4], 4, info->is_signed, info->divisor);
+			default:
+				return 0;
+			}
+		}
+
+		/**
+		 * @brief Get an unsigned part of the data, for fragment, diagnostics and timing fields
+		 *
+		 * @param offset offset in the data
+		 * @param bytes size, 1 to 4
+		 * @return uint32_t value
+		 */
+		uint32_t raw(uint8_t offset, uint8_t bytes) const
+		{
+			return read_be(&data[offset], bytes);
+		}
+
+		/** Points of a LAYOUT_TRACK field */
+		TrackReader track(void) const
+		{
+			return TrackReader(data, size, info->divisor);
+		}
+	};
+
+	/** Result of decoding a frame */
+	enum result
+	{
+		DECODE_OK = 0,
+		DECODE_UNKNOWN_TYPE, // Type is not in the table, Decoder.js throws an exception
+		DECODE_TRUNCATED,	 // Frame ends inside a field
+	};
+
+	/**
+	 * @brief Get the data size of a track field
+	 *
+	 * @param data start of the data
+	 * @param len bytes left in the frame
+	 * @return int32_t data size, -1 if the track is incomplete
+	 */
+	inline int32_t track_size(const uint8_t *data, size_t len)
+	{
+		if ((len < 13) || (data[0] == 0))
+		{
+			return -1;
+		}
+		size_t size = 13;
+		uint16_t varints = 3 * (data[0] - 1);
+		while (varints != 0)
+		{
+			if ((size >= len) || (size >= 0xFFFF))
+			{
+				return -1;
+			}
+			if ((data[size] & 0x80) == 0)
+			{
+				varints--;
+			}
+			size++;
+		}
+		return (int32_t)size;
+	}
+
+	/**
+	 * @brief Decode one frame and call the callback for each field
+	 *        Decoding stops at the first unknown type or incomplete field, the fields
+	 *        before are already reported.
+	 *
+	 * @tparam Callback void(const Field &)
+	 * @param frame payload
+	 * @param len payload size
+	 * @param callback called per field
+	 * @return int DECODE_xxx
+	 */
+	template <typename Callback>
+	inline int decode(const uint8_t *frame, size_t len, Callback &&callback)
+	{
+		const TypeTable &table = type_table();
+		size_t pos = 0;
+		while (pos < len)
+		{
+			if ((pos + 2) > len)
+			{
+				return DECODE_TRUNCATED;
+			}
+			Field field;
+			field.channel = frame[pos];
+			field.type = frame[pos + 1];
+			field.info = table.get(field.type);
+			field.data = &frame[pos + 2];
+			if (field.info->layout == LAYOUT_UNKNOWN)
+			{
+				return DECODE_UNKNOWN_TYPE;
+			}
+			size_t left = len - pos - 2;
+			if (field.info->layout == LAYOUT_TRACK)
+			{
+				int32_t size = track_size(field.data, left);
+				if (size < 0)
+				{
+					return DECODE_TRUNCATED;
+				}
+				field.size = (uint16_t)size;
+			}
+			else
+			{
+				field.size = field.info->size;
+				if (field.size > left)
+				{
+					return DECODE_TRUNCATED;
+				}
+			}
+			callback(field);
+			pos += 2 + field.size;
+		}
+		return DECODE_OK;
+	}
+
+	/**
+	 * @brief Decode one frame into an array of fields
+	 *
+	 * @param frame payload
+	 * @param len payload size
+	 * @param fields array for the fields
+	 * @param max_fields size of the array, further fields are skipped
+	 * @param count number of fields written to the array
+	 * @return int DECODE_xxx
+	 */
+	inline int decode(const uint8_t *frame, size_t len, Field *fields, size_t max_fields, size_t &count)
+	{
+		count = 0;
+		return decode(frame, len, [&](const Field &field)
+		{
+			if (count < max_fields)
+			{
+				fields[count++] = field;
+			}
+		});
+	}
+
+	/** One frame of a batch */
+	struct FrameRef
+	{
+		const uint8_t *data;
+		size_t len;
+	};
+
+	/**
+	 * @brief Decode many frames
+	 *
+	 * @tparam Callback void(size_t frame index, const Field &)
+	 * @param frames frames to decode
+	 * @param count number of frames
+	 * @param callback called per field
+	 * @return size_t number of frames that were decoded without error
+	 */
+	template <typename Callback>
+	inline size_t decode_batch(const FrameRef *frames, size_t count, Callback &&callback)
+	{
+		size_t decoded = 0;
+		for (size_t idx = 0; idx < count; idx++)
+		{
+			int result = decode(frames[idx].data, frames[idx].len, [&](const Field &field)
+			{
+				callback(idx, field);
+			});
+			if (result == DECODE_OK)
+			{
+				decoded++;
+			}
+		}
+		return decoded;
+	}
+}
+
+#endif // LPP_DECODER_H
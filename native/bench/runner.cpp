@@ -0,0 +1,190 @@
+/**
+ * @file runner.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Benchmark runner of the native build
+ *        Runs the app with the simulated NoteCard, BME680 and LoRaWAN network
+ *        and reports wall time, NoteCard bus transactions and heap high water
+ *        mark of each STATUS cycle. The time is the virtual time of the device,
+ *        it follows the NoteCard script, not the speed of the host.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "runner.h"
+#include <chrono>
+
+/**
+ * @brief Print the command line options
+ *
+ * @param name program name
+ */
+static void usage(const char *name)
+{
+	printf("Usage: %s [bench|soak|track] [options]\n", name);
+	printf("  bench             STATUS cycle benchmark (default)\n");
+	printf("  soak              Heap soak test, fails if the heap grows\n");
+	printf("  track             Track simplification of GPS traces, compression against error\n");
+	printf("Options:\n");
+	printf("  -n <cycles>       STATUS cycles to run, default 20, soak 100000\n");
+	printf("  -s <script>       NoteCard script, see native/scripts\n");
+	printf("  -l <ms>           Latency of all NoteCard requests\n");
+	printf("  -k <n>            Every n-th LoRaWAN packet is not ACKed, soak default 5\n");
+	printf("  -a <AT command>   Execute an AT command after start, e.g. -a ATC+BTRACK=0\n");
+	printf("  -t <trace>        GPS trace for track, default the traces in native/traces\n");
+}
+
+/**
+ * @brief Start the simulated hardware and the app
+ *        Returns after init_app, the first STATUS event is pending
+ *
+ * @param options settings of the run
+ */
+void run_start(s_run_options *options)
+{
+	native_kernel_init();
+	if ((options->script != NULL) && !native_card_load_script(options->script))
+	{
+		native_fatal("Cannot load NoteCard script %s", options->script);
+	}
+	if (options->latency_ms >= 0)
+	{
+		native_card_latency_all(options->latency_ms);
+	}
+	g_native_lora.nak_every = options->nak_every;
+
+	native_api_setup();
+
+	for (uint8_t idx = 0; idx < options->at_num; idx++)
+	{
+		native_at_command(options->at_cmds[idx]);
+	}
+}
+
+/**
+ * @brief Run STATUS cycles and print the measurements of each cycle
+ *
+ * @param options settings of the run
+ * @return int exit code
+ */
+int bench_run(s_run_options *options)
+{
+	run_start(options);
+
+	printf("cycle  time_ms  nc_trans  heap_hwm  arena_hwm  host_us\n");
+	uint32_t heap_hwm = 0;
+	uint32_t cycles = 0;
+	std::chrono::steady_clock::time_point host_start = std::chrono::steady_clock::now();
+	while (cycles < options->cycles)
+	{
+		native_api_loop();
+
+		s_cycle_stats *stats = &g_cycle_stats[CYCLE_STATUS];
+		if (stats->cycles == cycles)
+		{
+			continue;
+		}
+		cycles = stats->cycles;
+		std::chrono::steady_clock::time_point host_now = std::chrono::steady_clock::now();
+		long host_us = (long)std::chrono::duration_cast<std::chrono::microseconds>(host_now - host_start).count();
+		host_start = host_now;
+
+		printf("%5u  %7u  %8u  %8u  %9u  %7ld\n", cycles, stats->last_time_ms, stats->last_nc_trans,
+			   stats->heap_hwm, g_arena_stats.high_water_mark, host_us);
+		if (stats->heap_hwm > heap_hwm)
+		{
+			heap_hwm = stats->heap_hwm;
+		}
+		// Next cycle starts its own high water mark
+		stats->heap_hwm = 0;
+	}
+
+	printf("\n");
+	for (uint8_t type = 0; type < CYCLE_NUM; type++)
+	{
+		s_cycle_stats *stats = &g_cycle_stats[type];
+		printf("%-8s cycles %u, time avg %u max %u ms, NoteCard transactions avg %.1f max %u\n",
+			   type == CYCLE_STATUS ? "STATUS" : "CELLULAR", stats->cycles,
+			   stats->cycles == 0 ? 0 : stats->sum_time_ms / stats->cycles, stats->max_time_ms,
+			   stats->cycles == 0 ? 0.0 : (double)stats->sum_nc_trans / stats->cycles, stats->max_nc_trans);
+	}
+	printf("Heap HWM %u bytes in STATUS, %u bytes in CELLULAR cycles\n", heap_hwm, g_cycle_stats[CYCLE_CELLULAR].heap_hwm);
+	printf("Arena HWM %u bytes, %u heap fallbacks, %u resets, %u leaked blocks\n",
+		   g_arena_stats.high_water_mark, g_arena_stats.heap_fallbacks, g_arena_stats.resets, g_arena_stats.leaked_blocks);
+	printf("NoteCard %u transactions, %u notes, %u syncs, %u errors\n",
+		   g_native_card.transactions, g_native_card.notes, g_native_card.syncs, g_native_card.errors);
+	printf("LoRaWAN %u packets, %u bytes, %u NAK\n", g_native_lora.packets, g_native_lora.bytes, g_native_lora.naks);
+	printf("Queue %u packets, %u drained, %u dropped\n", g_queue_stats.depth, g_queue_stats.drained, g_queue_stats.drops);
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	s_run_options options;
+	options.cycles = 0;
+	options.script = NULL;
+	options.latency_ms = -1;
+	options.nak_every = 0xFFFF;
+	options.at_num = 0;
+	options.trace_num = 0;
+
+	int arg = 1;
+	const char *mode = "bench";
+	if ((argc > 1) && (argv[1][0] != '-'))
+	{
+		mode = argv[arg++];
+	}
+	for (; arg < argc; arg++)
+	{
+		if ((strcmp(argv[arg], "-n") == 0) && ((arg + 1) < argc))
+		{
+			options.cycles = strtoul(argv[++arg], NULL, 0);
+		}
+		else if ((strcmp(argv[arg], "-s") == 0) && ((arg + 1) < argc))
+		{
+			options.script = argv[++arg];
+		}
+		else if ((strcmp(argv[arg], "-l") == 0) && ((arg + 1) < argc))
+		{
+			options.latency_ms = strtol(argv[++arg], NULL, 0);
+		}
+		else if ((strcmp(argv[arg], "-k") == 0) && ((arg + 1) < argc))
+		{
+			options.nak_every = strtoul(argv[++arg], NULL, 0);
+		}
+		else if ((strcmp(argv[arg], "-a") == 0) && ((arg + 1) < argc) && (options.at_num < 8))
+		{
+			options.at_cmds[options.at_num++] = argv[++arg];
+		}
+		else if ((strcmp(argv[arg], "-t") == 0) && ((arg + 1) < argc) && (options.trace_num < 8))
+		{
+			options.traces[options.trace_num++] = argv[++arg];
+		}
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (strcmp(mode, "bench") == 0)
+	{
+		options.cycles = options.cycles == 0 ? 20 : options.cycles;
+		options.nak_every = options.nak_every == 0xFFFF ? 0 : options.nak_every;
+		return bench_run(&options);
+	}
+	if (strcmp(mode, "soak") == 0)
+	{
+		options.cycles = options.cycles == 0 ? 100000 : options.cycles;
+		options.nak_every = options.nak_every == 0xFFFF ? 5 : options.nak_every;
+		return soak_run(&options);
+	}
+	if (strcmp(mode, "track") == 0)
+	{
+		return track_run(&options);
+	}
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,35 @@
+/**
+ * @file runner.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Modes of the native benchmark runner
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _RUNNER_H_
+#define _RUNNER_H_
+
+#include "main.h"
+#include "native.h"
+
+/** Settings of a run, taken from the command line */
+struct s_run_options
+{
+	uint32_t cycles;		// STATUS cycles to run, 0 = default of the mode
+	const char *script;		// NoteCard script, NULL for the built-in responses
+	int32_t latency_ms;		// Latency of all NoteCard requests, -1 = from the script
+	uint16_t nak_every;		// Every n-th LoRaWAN packet is not ACKed, 0 = all are ACKed
+	const char *at_cmds[8]; // AT commands executed after init_app
+	uint8_t at_num;			// Number of AT commands
+	const char *traces[8];	// GPS traces of the track benchmark
+	uint8_t trace_num;		// Number of traces
+};
+
+void run_start(s_run_options *options);
+int bench_run(s_run_options *options);
+int soak_run(s_run_options *options);
+int track_run(s_run_options *options);
+
+#endif
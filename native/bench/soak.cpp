@@ -0,0 +1,106 @@
+/**
+ * @file soak.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Heap soak test of the native build
+ *        Runs many STATUS cycles, with every n-th LoRaWAN packet not ACKed to
+ *        use the cellular fallback and the store-and-forward queue as well.
+ *        The heap in use at the end of a cycle must not grow between the
+ *        first and the last cycles, the NoteCard arena must not leak blocks
+ *        or fall back to the heap.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "runner.h"
+
+/** Cycles at the start and at the end that are compared */
+#define SOAK_WINDOW 1000
+
+/** Cycles between two progress lines */
+#define SOAK_PROGRESS 10000
+
+/**
+ * @brief Run STATUS cycles and check the heap at the end of each cycle
+ *
+ * @param options settings of the run
+ * @return int exit code, 0 if the heap did not grow and the arena did not leak
+ */
+int soak_run(s_run_options *options)
+{
+	run_start(options);
+
+	uint32_t window = options->cycles / 4;
+	if (window > SOAK_WINDOW)
+	{
+		window = SOAK_WINDOW;
+	}
+	if (window == 0)
+	{
+		window = 1;
+	}
+
+	// Highest heap usage at the end of a cycle in the first and in the last window
+	int first_max = 0;
+	int last_max = 0;
+	uint32_t cycles = 0;
+	printf("Soak test with %u STATUS cycles\n", options->cycles);
+	while (cycles < options->cycles)
+	{
+		native_api_loop();
+
+		if (g_cycle_stats[CYCLE_STATUS].cycles == cycles)
+		{
+			continue;
+		}
+		cycles = g_cycle_stats[CYCLE_STATUS].cycles;
+
+		int heap_used = dbgHeapUsed();
+		if ((cycles <= window) && (heap_used > first_max))
+		{
+			first_max = heap_used;
+		}
+		if ((cycles > (options->cycles - window)) && (heap_used > last_max))
+		{
+			last_max = heap_used;
+		}
+		if ((cycles % SOAK_PROGRESS) == 0)
+		{
+			printf("%7u cycles, heap %d bytes, arena HWM %u bytes, %u CELLULAR cycles, %u NAK\n",
+				   cycles, heap_used, g_arena_stats.high_water_mark, g_cycle_stats[CYCLE_CELLULAR].cycles, g_native_lora.naks);
+			fflush(stdout);
+		}
+	}
+
+	printf("\nHeap at the end of a cycle, max of the first %u cycles %d bytes, of the last %u cycles %d bytes\n",
+		   window, first_max, window, last_max);
+	printf("Arena HWM %u bytes, %u heap fallbacks, %u resets, %u leaked blocks\n",
+		   g_arena_stats.high_water_mark, g_arena_stats.heap_fallbacks, g_arena_stats.resets, g_arena_stats.leaked_blocks);
+	printf("NoteCard %u transactions, %u notes, %u syncs, %u errors\n",
+		   g_native_card.transactions, g_native_card.notes, g_native_card.syncs, g_native_card.errors);
+	printf("LoRaWAN %u packets, %u NAK\n", g_native_lora.packets, g_native_lora.naks);
+
+	int result = 0;
+	if (last_max > first_max)
+	{
+		printf("FAIL heap grew by %d bytes\n", last_max - first_max);
+		result = 1;
+	}
+	if (g_arena_stats.leaked_blocks != 0)
+	{
+		printf("FAIL %u blocks leaked from the arena\n", g_arena_stats.leaked_blocks);
+		result = 1;
+	}
+	if (g_arena_stats.heap_fallbacks != 0)
+	{
+		printf("FAIL %u allocations did not fit into the arena\n", g_arena_stats.heap_fallbacks);
+		result = 1;
+	}
+	if (result == 0)
+	{
+		printf("PASS\n");
+	}
+	fflush(stdout);
+	return result;
+}
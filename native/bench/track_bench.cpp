@@ -0,0 +1,238 @@
+/**
+ * @file track_bench.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Track simplification benchmark of the native build
+ *        Feeds GPS traces into the track simplifier with different tolerances
+ *        and reports the compression against the error of the sent track.
+ *        The error of a fix is its distance from the line between the two sent
+ *        points around it, after the points are rounded like in the payload.
+ *        The run fails if the error of a fix is larger than the tolerance.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "runner.h"
+#include <vector>
+
+/** Mean earth radius in m */
+#define EARTH_RADIUS 6371000.0
+
+/** Points waiting in the track before a packet is encoded */
+#define TRACK_BENCH_PACKET (TRACK_MAX_POINTS / 2)
+
+/** Traces used if none is given on the command line, synthetic paths with simulated GNSS noise */
+static const char *track_default_traces[] = {"native/traces/walk.csv", "native/traces/city.csv", "native/traces/highway.csv"};
+
+/** Tolerances in m that are compared, 0 sends every fix */
+static const uint16_t track_tolerances[] = {0, 5, 10, 20, 50, 100};
+
+/** Point of a trace or of the sent track */
+struct s_trace_point
+{
+	double latitude;
+	double longitude;
+	uint32_t fix_time;
+};
+
+/** Result of one trace with one tolerance */
+struct s_track_result
+{
+	uint32_t points;  // Points that were sent
+	uint32_t bytes;	  // Encoded track size, all packets
+	uint32_t packets; // Packets needed for the track
+	double max_error; // Largest error of a fix in m
+	double sum_error; // Sum of the errors of all fixes in m
+};
+
+/**
+ * @brief Read a trace, one fix per line as epoch time,latitude,longitude
+ *        Lines starting with # are comments
+ *
+ * @param path trace file
+ * @param trace read fixes
+ * @return true if the file could be read
+ */
+static bool track_read_trace(const char *path, std::vector<s_trace_point> &trace)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		return false;
+	}
+	char line[128];
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		s_trace_point fix;
+		if ((line[0] != '#') && (sscanf(line, "%u,%lf,%lf", &fix.fix_time, &fix.latitude, &fix.longitude) == 3))
+		{
+			trace.push_back(fix);
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+/**
+ * @brief Distance of a fix from the line between two sent points
+ *        The locations are projected on a plane around the start point
+ *
+ * @param start start of the line
+ * @param end end of the line
+ * @param fix fix to check
+ * @return double distance in m
+ */
+static double track_error(const s_trace_point &start, const s_trace_point &end, const s_trace_point &fix)
+{
+	double scale_x = cos(start.latitude * DEG_TO_RAD) * DEG_TO_RAD * EARTH_RADIUS;
+	double scale_y = DEG_TO_RAD * EARTH_RADIUS;
+
+	double end_x = (end.longitude - start.longitude) * scale_x;
+	double end_y = (end.latitude - start.latitude) * scale_y;
+	double fix_x = (fix.longitude - start.longitude) * scale_x;
+	double fix_y = (fix.latitude - start.latitude) * scale_y;
+
+	double len_sq = end_x * end_x + end_y * end_y;
+	double t = len_sq == 0.0 ? 0.0 : (fix_x * end_x + fix_y * end_y) / len_sq;
+	t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+	double dx = fix_x - t * end_x;
+	double dy = fix_y - t * end_y;
+	return sqrt(dx * dx + dy * dy);
+}
+
+/**
+ * @brief Copy the new significant points before they are encoded
+ *        The points are in 0.000001 deg like in the payload
+ *
+ * @param sent sent points
+ * @param seen number of waiting points that were already copied
+ */
+static void track_collect(std::vector<s_trace_point> &sent, uint8_t &seen)
+{
+	for (; seen < track_available(); seen++)
+	{
+		s_track_point *point = track_peek(seen);
+		s_trace_point copy = {point->latitude / 1000000.0, point->longitude / 1000000.0, point->fix_time};
+		sent.push_back(copy);
+	}
+}
+
+/**
+ * @brief Encode the waiting points into packets like in the STATUS cycle
+ *
+ * @param result size of the packets is added
+ * @param seen number of copied points, reduced by the encoded points
+ * @param all true to encode all points, false to encode one packet
+ */
+static void track_encode(s_track_result &result, uint8_t &seen, bool all)
+{
+	do
+	{
+		WisCayenneTracker packet(QUEUE_PAYLOAD_SIZE);
+		uint8_t count = packet.addTrack(PAYLOAD_CH_TRACK, track_max_payload());
+		if (count == 0)
+		{
+			break;
+		}
+		seen -= count;
+		result.bytes += packet.getSize();
+		result.packets++;
+	} while (all && (track_available() != 0));
+}
+
+/**
+ * @brief Simplify a trace with one tolerance
+ *
+ * @param trace fixes of the trace
+ * @param tolerance allowed error in m
+ * @param result points, size and error of the sent track
+ */
+static void track_simplify(std::vector<s_trace_point> &trace, uint16_t tolerance, s_track_result &result)
+{
+	memset((void *)&result, 0, sizeof(s_track_result));
+	g_blues_settings.track_tolerance = tolerance;
+	track_reset();
+
+	std::vector<s_trace_point> sent;
+	uint8_t seen = 0;
+	for (size_t idx = 0; idx < trace.size(); idx++)
+	{
+		track_add_fix(trace[idx].latitude, trace[idx].longitude, trace[idx].fix_time);
+		track_collect(sent, seen);
+		if (track_available() >= TRACK_BENCH_PACKET)
+		{
+			track_encode(result, seen, false);
+		}
+	}
+	track_flush();
+	track_collect(sent, seen);
+	track_encode(result, seen, true);
+	result.points = sent.size();
+
+	// Error of each fix against the sent line around it
+	size_t segment = 0;
+	for (size_t idx = 0; idx < trace.size(); idx++)
+	{
+		while (((segment + 2) < sent.size()) && (sent[segment + 1].fix_time <= trace[idx].fix_time))
+		{
+			segment++;
+		}
+		double error = sent.size() < 2 ? 0.0 : track_error(sent[segment], sent[segment + 1], trace[idx]);
+		result.sum_error += error;
+		if (error > result.max_error)
+		{
+			result.max_error = error;
+		}
+	}
+}
+
+/**
+ * @brief Run all traces with all tolerances and print the results
+ *
+ * @param options settings of the run, the traces
+ * @return int exit code, 0 if all fixes are within the tolerance
+ */
+int track_run(s_run_options *options)
+{
+	const char **traces = options->traces;
+	uint8_t trace_num = options->trace_num;
+	if (trace_num == 0)
+	{
+		traces = track_default_traces;
+		trace_num = sizeof(track_default_traces) / sizeof(track_default_traces[0]);
+		printf("Synthetic traces, generated paths with simulated GNSS noise\n");
+	}
+
+	int exit_code = 0;
+	printf("trace                       tol_m  fixes  points  ratio  bytes  packets  bytes/fix  max_err_m  avg_err_m\n");
+	for (uint8_t trace_idx = 0; trace_idx < trace_num; trace_idx++)
+	{
+		std::vector<s_trace_point> trace;
+		if (!track_read_trace(traces[trace_idx], trace) || trace.empty())
+		{
+			printf("Cannot read trace %s\n", traces[trace_idx]);
+			return 1;
+		}
+		for (uint8_t tol_idx = 0; tol_idx < sizeof(track_tolerances) / sizeof(track_tolerances[0]); tol_idx++)
+		{
+			s_track_result result;
+			track_simplify(trace, track_tolerances[tol_idx], result);
+			printf("%-26s  %5u  %5u  %6u  %5.1f  %5u  %7u  %9.2f  %9.1f  %9.1f\n",
+				   traces[trace_idx], track_tolerances[tol_idx], (uint32_t)trace.size(), result.points,
+				   (double)trace.size() / result.points, result.bytes, result.packets,
+				   (double)result.bytes / trace.size(), result.max_error, result.sum_error / trace.size());
+			if ((track_tolerances[tol_idx] != 0) && (result.max_error > track_tolerances[tol_idx]))
+			{
+				printf("FAIL largest error %.2f m is above the tolerance\n", result.max_error);
+				exit_code = 1;
+			}
+		}
+	}
+	if (exit_code == 0)
+	{
+		printf("PASS\n");
+	}
+	fflush(stdout);
+	return exit_code;
+}
@@ -0,0 +1,61 @@
+/**
+ * @file Adafruit_BME680.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host version of the Adafruit BME680 driver for the native build
+ *        The sensor is simulated, the conversion time follows the oversampling
+ *        settings like on the real sensor.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _NATIVE_ADAFRUIT_BME680_H_
+#define _NATIVE_ADAFRUIT_BME680_H_
+
+#include <Arduino.h>
+
+#define BME680_OS_NONE 0
+#define BME680_OS_1X 1
+#define BME680_OS_2X 2
+#define BME680_OS_4X 3
+#define BME680_OS_8X 4
+#define BME680_OS_16X 5
+
+#define BME680_FILTER_SIZE_0 0
+#define BME680_FILTER_SIZE_1 1
+#define BME680_FILTER_SIZE_3 2
+#define BME680_FILTER_SIZE_7 3
+#define BME680_FILTER_SIZE_15 4
+
+/** Simulated BME680 */
+class Adafruit_BME680
+{
+public:
+	Adafruit_BME680(TwoWire *the_wire = &Wire);
+	bool begin(uint8_t addr = 0x77, bool init_settings = true);
+	bool setTemperatureOversampling(uint8_t os);
+	bool setHumidityOversampling(uint8_t os);
+	bool setPressureOversampling(uint8_t os);
+	bool setIIRFilterSize(uint8_t fs);
+	bool setGasHeater(uint16_t heater_temp, uint16_t heater_time);
+	uint32_t beginReading(void);
+	bool endReading(void);
+	int remainingReadingMillis(void);
+	bool performReading(void);
+
+	float temperature;
+	uint32_t pressure;
+	float humidity;
+	uint32_t gas_resistance;
+
+private:
+	uint8_t _temp_os;
+	uint8_t _hum_os;
+	uint8_t _pres_os;
+	uint16_t _heater_time;
+	uint32_t _meas_end;
+	uint32_t _readings;
+};
+
+#endif
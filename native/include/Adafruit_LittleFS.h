@@ -0,0 +1,64 @@
+/**
+ * @file Adafruit_LittleFS.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host version of the Adafruit LittleFS for the native build
+ *        Files are kept in memory, a run starts with an empty file system
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _NATIVE_ADAFRUIT_LITTLEFS_H_
+#define _NATIVE_ADAFRUIT_LITTLEFS_H_
+
+#include <Arduino.h>
+
+#define FILE_O_READ 0
+#define FILE_O_WRITE 1
+
+namespace Adafruit_LittleFS_Namespace
+{
+	class Adafruit_LittleFS;
+
+	/** File of the in-memory file system */
+	class File
+	{
+	public:
+		File(void);
+		File(Adafruit_LittleFS &fs);
+		bool open(const char *filepath, uint8_t mode);
+		size_t read(void *buf, uint16_t nbyte);
+		int read(void);
+		size_t write(const uint8_t *buf, size_t size);
+		size_t write(uint8_t ch);
+		bool seek(uint32_t pos);
+		uint32_t position(void);
+		uint32_t size(void);
+		bool truncate(uint32_t pos);
+		bool truncate(void);
+		int available(void);
+		void flush(void);
+		void close(void);
+		operator bool(void);
+
+	private:
+		char _path[64];
+		uint32_t _pos;
+		bool _is_open;
+	};
+
+	/** In-memory file system */
+	class Adafruit_LittleFS
+	{
+	public:
+		bool begin(void);
+		File open(const char *filepath, uint8_t mode = FILE_O_READ);
+		bool exists(const char *filepath);
+		bool remove(const char *filepath);
+		bool rename(const char *source, const char *dest);
+		bool format(void);
+	};
+}
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * @file Adafruit_Sensor.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host version of the Adafruit unified sensor header for the native build
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _NATIVE_ADAFRUIT_SENSOR_H_
+#define _NATIVE_ADAFRUIT_SENSOR_H_
+
+#include <Arduino.h>
+
+#endif
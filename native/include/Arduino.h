@@ -0,0 +1,199 @@
+/**
+ * @file Arduino.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host version of the Arduino core and FreeRTOS for the native build
+ *        Tasks are threads, but only one of them runs at a time like on the
+ *        single core nRF52. The clock is virtual, it only moves forward when
+ *        all tasks are blocked, so delays and timers cost no host time.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _NATIVE_ARDUINO_H_
+#define _NATIVE_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+/** Minimal String, the app only returns empty strings */
+class String
+{
+public:
+	String(const char *text = "") : _text(text) {}
+	const char *c_str(void) const { return _text.c_str(); }
+	size_t length(void) const { return _text.length(); }
+
+private:
+	std::string _text;
+};
+
+// Time, based on the virtual clock
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+
+// GPIO, the pins are only stored
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define RISING 3
+#define FALLING 2
+#define CHANGE 4
+
+#define LED_GREEN 35
+#define LED_BLUE 36
+#define WB_IO1 17
+#define WB_IO2 34
+#define WB_IO5 9
+#define WB_A0 5
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+void attachInterrupt(int pin, void (*callback)(void), int mode);
+void detachInterrupt(int pin);
+
+long random(long max_value);
+long random(long min_value, long max_value);
+void randomSeed(unsigned long seed);
+
+/** USB serial, output goes to stdout */
+class SerialPort
+{
+public:
+	void begin(uint32_t baud);
+	operator bool(void) { return true; }
+	void flush(void);
+	int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+	size_t write(const uint8_t *data, size_t len);
+	size_t print(const char *text);
+	int available(void) { return 0; }
+	int read(void) { return -1; }
+	size_t availableForWrite(void) { return 256; }
+};
+extern SerialPort Serial;
+
+/** I2C bus, the NoteCard and the BME680 are simulated */
+class TwoWire
+{
+public:
+	void begin(void) {}
+	void end(void) {}
+};
+extern TwoWire Wire;
+
+// FreeRTOS
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+typedef void *TimerHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffff
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#define TASK_PRIO_LOWEST 0
+#define TASK_PRIO_LOW 1
+#define TASK_PRIO_NORMAL 2
+#define TASK_PRIO_HIGH 3
+
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, TaskHandle_t *handle);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+void taskYIELD(void);
+void taskENTER_CRITICAL(void);
+void taskEXIT_CRITICAL(void);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+bool isInISR(void);
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+/** Software timer, the callbacks run in the timer task */
+class SoftwareTimer
+{
+public:
+	SoftwareTimer(void);
+	void begin(uint32_t ms, void (*callback)(TimerHandle_t), void *timer_id = NULL, bool repeating = true);
+	void start(void);
+	void stop(void);
+	void reset(void);
+	void setPeriod(uint32_t ms);
+	void *getID(void);
+
+private:
+	void *_handle;
+};
+
+// Heap usage of the process
+int dbgHeapTotal(void);
+int dbgHeapUsed(void);
+int dbgHeapFree(void);
+
+// Cycle counter, counts the virtual clock at SystemCoreClock
+#define SystemCoreClock 64000000UL
+
+class NativeCycleCounter
+{
+public:
+	operator uint32_t(void) const;
+	NativeCycleCounter &operator=(uint32_t value);
+};
+
+struct DWT_Type
+{
+	uint32_t CTRL;
+	NativeCycleCounter CYCCNT;
+};
+struct CoreDebug_Type
+{
+	uint32_t DEMCR;
+};
+extern DWT_Type *DWT;
+extern CoreDebug_Type *CoreDebug;
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL)
+
+// Reset reason, the host always starts from power on
+#define POWER_RESETREAS_RESETPIN_Msk (0x1UL)
+#define POWER_RESETREAS_DOG_Msk (0x2UL)
+#define POWER_RESETREAS_SREQ_Msk (0x4UL)
+#define POWER_RESETREAS_LOCKUP_Msk (0x8UL)
+#define POWER_RESETREAS_OFF_Msk (0x10000UL)
+uint32_t readResetReason(void);
+
+#endif
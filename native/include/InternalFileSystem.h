@@ -0,0 +1,18 @@
+/**
+ * @file InternalFileSystem.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host version of the internal flash file system for the native build
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _NATIVE_INTERNAL_FILESYSTEM_H_
+#define _NATIVE_INTERNAL_FILESYSTEM_H_
+
+#include "Adafruit_LittleFS.h"
+
+extern Adafruit_LittleFS_Namespace::Adafruit_LittleFS InternalFS;
+
+#endif
@@ -0,0 +1,17 @@
+/**
+ * @file NoteTime.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host version of the note-c time functions for the native build
+ *        The app does not use them, the header only has to exist
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _NATIVE_NOTETIME_H_
+#define _NATIVE_NOTETIME_H_
+
+#include <Notecard.h>
+
+#endif
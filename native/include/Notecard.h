@@ -0,0 +1,90 @@
+/**
+ * @file Notecard.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host version of the Blues note-c API for the native build
+ *        The J objects are allocated with the functions set by NoteSetFn like
+ *        in note-c, the requests go to a simulated NoteCard.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _NATIVE_NOTECARD_H_
+#define _NATIVE_NOTECARD_H_
+
+#include <Arduino.h>
+
+/** JSON item, same layout as in note-c */
+typedef struct J
+{
+	struct J *next;
+	struct J *prev;
+	struct J *child;
+	int type;
+	char *valuestring;
+	int valueint;
+	double valuenumber;
+	char *string;
+} J;
+
+// JSON item types
+#define JInvalid (0)
+#define JFalse (1 << 0)
+#define JTrue (1 << 1)
+#define JNULL (1 << 2)
+#define JNumber (1 << 3)
+#define JString (1 << 4)
+#define JArray (1 << 5)
+#define JObject (1 << 6)
+
+// Memory and timing hooks
+typedef void *(*mallocFn)(size_t size);
+typedef void (*freeFn)(void *ptr);
+typedef void (*delayMsFn)(uint32_t ms);
+typedef uint32_t (*getMsFn)(void);
+
+void NoteSetFn(mallocFn malloc_hook, freeFn free_hook, delayMsFn delay_hook, getMsFn millis_hook);
+void *NoteMalloc(size_t size);
+void NoteFree(void *ptr);
+
+// JSON objects
+J *JCreateObject(void);
+J *JCreateArray(void);
+J *JCreateNumber(double number);
+J *JCreateString(const char *string);
+J *JParse(const char *text);
+void JDelete(J *item);
+void JFree(void *ptr);
+char *JPrintUnformatted(const J *item);
+bool JPrintPreallocated(J *item, char *buffer, const int length, const bool format);
+
+J *JAddStringToObject(J *object, const char *name, const char *string);
+J *JAddNumberToObject(J *object, const char *name, const double number);
+J *JAddBoolToObject(J *object, const char *name, const bool boolean);
+bool JAddBinaryToObject(J *object, const char *field_name, const void *binary_data, uint32_t binary_data_len);
+void JAddItemToObject(J *object, const char *name, J *item);
+void JAddItemToArray(J *array, J *item);
+
+J *JGetObjectItem(const J *object, const char *name);
+J *JGetObject(J *object, const char *field);
+bool JIsPresent(J *object, const char *field);
+bool JHasObjectItem(J *object, const char *field);
+char *JGetString(J *object, const char *field);
+double JGetNumber(J *object, const char *field);
+long int JGetInt(J *object, const char *field);
+bool JGetBool(J *object, const char *field);
+
+/** NoteCard on the I2C bus, requests go to the simulated card */
+class Notecard
+{
+public:
+	void begin(uint32_t i2c_address = 0x17, uint32_t i2c_max = 30);
+	J *newRequest(const char *request);
+	J *newCommand(const char *request);
+	J *requestAndResponse(J *req);
+	bool sendRequest(J *req);
+	void deleteResponse(J *rsp);
+};
+
+#endif
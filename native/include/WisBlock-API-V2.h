@@ -0,0 +1,231 @@
+/**
+ * @file WisBlock-API-V2.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host version of the WisBlock API for the native build
+ *        Same application interface as the library, the LoRaWAN stack is
+ *        replaced by a simulated network server that ACKs the packets.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _NATIVE_WISBLOCK_API_H_
+#define _NATIVE_WISBLOCK_API_H_
+
+#include <Arduino.h>
+
+// Event flags of the app loop
+#define STATUS 0b0000000000000001
+#define N_STATUS 0b1111111111111110
+#define BLE_CONFIG 0b0000000000000010
+#define N_BLE_CONFIG 0b1111111111111101
+#define BLE_DATA 0b0000000000000100
+#define N_BLE_DATA 0b1111111111111011
+#define LORA_DATA 0b0000000000001000
+#define N_LORA_DATA 0b1111111111110111
+#define LORA_TX_FIN 0b0000000000010000
+#define N_LORA_TX_FIN 0b1111111111101111
+#define AT_CMD 0b0000000000100000
+#define N_AT_CMD 0b1111111111011111
+#define LORA_JOIN_FIN 0b0000000001000000
+#define N_LORA_JOIN_FIN 0b1111111110111111
+
+extern volatile uint16_t g_task_event_type;
+
+// LoRaWAN regions
+typedef enum
+{
+	LORAMAC_REGION_AS923 = 0,
+	LORAMAC_REGION_AU915,
+	LORAMAC_REGION_CN470,
+	LORAMAC_REGION_CN779,
+	LORAMAC_REGION_EU433,
+	LORAMAC_REGION_EU868,
+	LORAMAC_REGION_KR920,
+	LORAMAC_REGION_IN865,
+	LORAMAC_REGION_US915,
+	LORAMAC_REGION_RU864,
+	LORAMAC_REGION_AS923_2,
+	LORAMAC_REGION_AS923_3,
+	LORAMAC_REGION_AS923_4,
+} LoRaMacRegion_t;
+
+/** LoRaWAN settings, same fields as the library */
+struct s_lorawan_settings
+{
+	uint8_t valid_mark_1 = 0xAA;
+	uint8_t valid_mark_2 = 0x55;
+	uint8_t node_device_eui[8] = {0xAC, 0x1F, 0x09, 0xFF, 0xFE, 0x00, 0x00, 0x01};
+	uint8_t node_app_eui[8] = {0};
+	uint8_t node_app_key[16] = {0};
+	uint32_t node_dev_addr = 0x26021FB4;
+	uint8_t node_nws_key[16] = {0};
+	uint8_t node_apps_key[16] = {0};
+	bool otaa_enabled = true;
+	bool adr_enabled = false;
+	bool public_network = true;
+	bool duty_cycle_enabled = false;
+	uint32_t send_repeat_time = 120000;
+	uint8_t join_trials = 5;
+	uint8_t tx_power = 0;
+	uint8_t data_rate = 3;
+	uint8_t lora_class = 0;
+	uint8_t subband_channels = 1;
+	bool auto_join = true;
+	uint8_t app_port = 2;
+	bool confirmed_msg_enabled = true;
+	bool resetRequest = true;
+	uint8_t lora_region = LORAMAC_REGION_EU868;
+	bool lorawan_enable = true;
+	uint32_t p2p_frequency = 916000000;
+	uint8_t p2p_tx_power = 22;
+	uint8_t p2p_bandwidth = 0;
+	uint8_t p2p_sf = 7;
+	uint8_t p2p_cr = 1;
+	uint8_t p2p_preamble_len = 8;
+	uint16_t p2p_symbol_timeout = 0;
+};
+
+extern s_lorawan_settings g_lorawan_settings;
+
+extern bool g_enable_ble;
+extern bool g_lpwan_has_joined;
+extern bool g_join_result;
+extern bool g_rx_fin_result;
+extern uint8_t g_rx_lora_data[256];
+extern uint16_t g_rx_data_len;
+extern int16_t g_last_rssi;
+extern int8_t g_last_snr;
+extern bool g_ble_uart_is_connected;
+
+/** BLE UART, no central is connected on the host */
+class BLEUart
+{
+public:
+	int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+	int available(void) { return 0; }
+	int read(void) { return -1; }
+	size_t write(const uint8_t *data, size_t len);
+};
+extern BLEUart g_ble_uart;
+
+// API functions
+void api_set_version(uint16_t sw_1 = 1, uint16_t sw_2 = 0, uint16_t sw_3 = 0);
+void api_reset(void);
+void api_wake_loop(uint16_t reason);
+void api_timer_init(void);
+void api_timer_start(void);
+void api_timer_stop(void);
+void api_timer_restart(uint32_t new_time);
+float read_batt(void);
+void restart_advertising(uint16_t timeout);
+
+// LoRaWAN
+typedef enum
+{
+	LMH_SUCCESS = 0,
+	LMH_BUSY = -1,
+	LMH_ERROR = -2,
+} lmh_error_status;
+
+int8_t init_lorawan(void);
+int8_t re_init_lorawan(void);
+lmh_error_status lmh_join(void);
+lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport = 0);
+bool send_p2p_packet(uint8_t *data, uint8_t size);
+
+typedef struct
+{
+	uint8_t MaxPossiblePayload;
+	uint8_t CurrentPayloadSize;
+} LoRaMacTxInfo_t;
+
+typedef enum
+{
+	LORAMAC_STATUS_OK = 0,
+	LORAMAC_STATUS_BUSY,
+	LORAMAC_STATUS_SERVICE_UNKNOWN,
+	LORAMAC_STATUS_PARAMETER_INVALID,
+	LORAMAC_STATUS_FREQUENCY_INVALID,
+	LORAMAC_STATUS_DATARATE_INVALID,
+	LORAMAC_STATUS_FREQ_AND_DR_INVALID,
+	LORAMAC_STATUS_NO_NETWORK_JOINED,
+	LORAMAC_STATUS_LENGTH_ERROR,
+	LORAMAC_STATUS_MAC_CMD_LENGTH_ERROR,
+} LoRaMacStatus_t;
+
+LoRaMacStatus_t LoRaMacQueryTxPossible(uint8_t size, LoRaMacTxInfo_t *tx_info);
+
+// AT commands
+#define ATQUERY_SIZE 512
+#define AT_SUCCESS 0
+#define AT_ERRNO_NOSUPP 1
+#define AT_ERRNO_NOALLOW 2
+#define AT_ERROR 3
+#define AT_ERRNO_PARA_VAL 5
+#define AT_ERRNO_PARA_NUM 6
+#define AT_ERRNO_EXEC_FAIL 8
+#define AT_ERRNO_SYS 9
+
+extern char g_at_query_buf[ATQUERY_SIZE];
+
+#define AT_PRINTF(...)              \
+	do                              \
+	{                               \
+		Serial.printf(__VA_ARGS__); \
+		Serial.printf("\r\n");      \
+	} while (0)
+
+#define API_LOG(...)
+
+typedef struct atcmd_s
+{
+	const char *cmd_name;
+	const char *cmd_desc;
+	int (*query_cmd)(void);
+	int (*exec_cmd)(char *str);
+	int (*exec_cmd_no_para)(void);
+	const char *permission;
+} atcmd_t;
+
+extern atcmd_t *g_user_at_cmd_list;
+extern uint8_t g_user_at_cmd_num;
+
+void at_serial_input(uint8_t cmd);
+
+// Cayenne LPP
+#define LPP_CHANNEL_BATT 1
+#define LPP_CHANNEL_DEVID 255
+
+#define LPP_GPS6 137
+#define LPP_GPS6_SIZE 11
+#define LPP_DEVID 255
+#define LPP_DEVID_SIZE 4
+
+/** Cayenne LPP encoder, only the functions the app uses */
+class CayenneLPP
+{
+public:
+	CayenneLPP(uint8_t size);
+	~CayenneLPP();
+	void reset(void);
+	uint8_t getSize(void);
+	uint8_t *getBuffer(void);
+
+protected:
+	uint8_t *_buffer;
+	uint8_t _maxsize;
+	uint8_t _cursor;
+};
+
+/** Cayenne LPP with the WisBlock data types */
+class WisCayenne : public CayenneLPP
+{
+public:
+	WisCayenne(uint8_t size) : CayenneLPP(size) {}
+	uint8_t addGNSS_6(uint8_t channel, int32_t latitude, int32_t longitude, int32_t altitude);
+	uint8_t addDevID(uint8_t channel, uint8_t *dev_id);
+};
+
+#endif
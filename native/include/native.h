@@ -0,0 +1,63 @@
+/**
+ * @file native.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Controls of the simulated hardware for the native build
+ *        Only used by the benchmark runner, the app does not include it.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef _NATIVE_H_
+#define _NATIVE_H_
+
+#include <stdint.h>
+
+// Kernel
+void native_kernel_init(void);
+void native_heap_init(void);
+void native_fatal(const char *format, ...) __attribute__((format(printf, 1, 2), noreturn));
+uint64_t native_clock_us(void);
+
+// WisBlock API
+void native_api_setup(void);
+void native_api_loop(void);
+bool native_at_command(const char *command);
+
+/** Simulated LoRaWAN network and battery */
+struct s_native_lora
+{
+	bool join_accept;	// Network server accepts the join request
+	uint32_t join_ms;	// Time from join request to join accept
+	uint32_t tx_ms;		// Airtime and RX windows of a packet
+	uint16_t nak_every; // Every n-th confirmed packet is not ACKed, 0 = all are ACKed
+	int16_t rssi;		// RSSI of the ACK
+	int8_t snr;			// SNR of the ACK
+	float batt_mv;		// Battery voltage reported by read_batt
+	uint32_t packets;	// Packets sent over LoRaWAN
+	uint32_t bytes;		// Payload bytes sent over LoRaWAN
+	uint32_t naks;		// Packets that were not ACKed
+};
+extern s_native_lora g_native_lora;
+
+// NoteCard
+/** Statistics of the simulated NoteCard */
+struct s_native_card
+{
+	uint32_t transactions; // Requests received
+	uint32_t notes;		   // note.add requests
+	uint32_t syncs;		   // hub.sync requests
+	uint32_t errors;	   // Error responses
+};
+extern s_native_card g_native_card;
+
+bool native_card_script_line(const char *line);
+bool native_card_load_script(const char *path);
+void native_card_latency_all(uint32_t ms);
+
+// BME680
+/** Conversion time of the simulated BME680 in ms, 0 = calculate from the oversampling */
+extern uint32_t g_native_bme_ms;
+
+#endif
@@ -0,0 +1,360 @@
+/**
+ * @file lpp_check.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Conformance check and benchmark of lpp_decoder.h
+ *        corpus: writes random frames with all types of the decoder and the decoded
+ *                fields as JSON lines, lpp_check.js compares them with Decoder.js
+ *        bench:  decodes random frames for one second and reports frames per second
+ *        Build from the project folder:
+ *        g++ -O2 -std=c++11 -I. native/lpp/lpp_check.cpp -o lpp_check
+ * @version 0.1
+ * @date 2023-09-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include "lpp_decoder.h"
+
+/** Type that is not in the table, Decoder.js throws an exception */
+#define LPP_CHECK_UNKNOWN_TYPE 4
+
+/** State of the random generator */
+static uint32_t random_state = 1;
+
+/**
+ * @brief Next value of the random generator, xorshift32
+ *        Same frames on every host
+ *
+ * @return uint32_t random value
+ */
+static uint32_t random_next(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+/**
+ * @brief Random value in a range
+ *
+ * @param min_value lowest value
+ * @param max_value highest value
+ * @return uint32_t random value
+ */
+static uint32_t random_range(uint32_t min_value, uint32_t max_value)
+{
+	return min_value + random_next() % (max_value - min_value + 1);
+}
+
+/**
+ * @brief Write a value as varint, 7 bits per byte, lowest bits first
+ *
+ * @param frame destination
+ * @param value value to write
+ */
+static void put_varint(std::vector<uint8_t> &frame, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		frame.push_back((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	frame.push_back(value);
+}
+
+/**
+ * @brief Write a value as big endian
+ *
+ * @param frame destination
+ * @param value value to write
+ */
+static void put_u32(std::vector<uint8_t> &frame, uint32_t value)
+{
+	frame.push_back(value >> 24);
+	frame.push_back(value >> 16);
+	frame.push_back(value >> 8);
+	frame.push_back(value);
+}
+
+/**
+ * @brief Add the data of a track field like WisCayenneTracker::addTrack
+ *
+ * @param frame destination
+ * @param points number of points, 1 to 255
+ */
+static void put_track(std::vector<uint8_t> &frame, uint8_t points)
+{
+	frame.push_back(points);
+	put_u32(frame, (uint32_t)((int32_t)random_range(0, 180000000) - 90000000));
+	put_u32(frame, (uint32_t)((int32_t)random_range(0, 360000000) - 180000000));
+	put_u32(frame, random_range(1600000000, 1800000000));
+	for (uint8_t idx = 1; idx < points; idx++)
+	{
+		// Deltas from a few cm to many km
+		int32_t delta_lat = (int32_t)(random_next() >> random_range(8, 31)) * ((random_next() & 1) ? -1 : 1);
+		int32_t delta_lon = (int32_t)(random_next() >> random_range(8, 31)) * ((random_next() & 1) ? -1 : 1);
+		put_varint(frame, ((uint32_t)delta_lat << 1) ^ (uint32_t)(delta_lat >> 31));
+		put_varint(frame, ((uint32_t)delta_lon << 1) ^ (uint32_t)(delta_lon >> 31));
+		put_varint(frame, random_range(0, 3600));
+	}
+}
+
+/**
+ * @brief Create a random frame with fields of all types in the table
+ *
+ * @param types types of the table
+ * @param max_points largest number of points of a track
+ * @param unknown end the frame with a type that is not in the table
+ * @return std::vector<uint8_t> frame
+ */
+static std::vector<uint8_t> make_frame(const std::vector<uint8_t> &types, uint8_t max_points, bool unknown)
+{
+	std::vector<uint8_t> frame;
+	uint8_t fields = random_range(1, 6);
+	for (uint8_t idx = 0; idx < fields; idx++)
+	{
+		uint8_t type = types[random_next() % types.size()];
+		frame.push_back(random_next());
+		frame.push_back(type);
+		const lpp::TypeInfo *info = lpp::type_table().get(type);
+		if (info->layout == lpp::LAYOUT_TRACK)
+		{
+			put_track(frame, random_range(1, max_points));
+			continue;
+		}
+		for (uint8_t byte = 0; byte < info->size; byte++)
+		{
+			frame.push_back(random_next());
+		}
+	}
+	if (unknown)
+	{
+		frame.push_back(random_next());
+		frame.push_back(LPP_CHECK_UNKNOWN_TYPE);
+		frame.push_back(random_next());
+	}
+	return frame;
+}
+
+/**
+ * @brief Get all types of the decoder table
+ *
+ * @return std::vector<uint8_t> types
+ */
+static std::vector<uint8_t> table_types(void)
+{
+	std::vector<uint8_t> types;
+	for (uint16_t type = 0; type < 256; type++)
+	{
+		if (lpp::type_table().get(type)->layout != lpp::LAYOUT_UNKNOWN)
+		{
+			types.push_back(type);
+		}
+	}
+	return types;
+}
+
+/**
+ * @brief Print the value of a field in the format of lppDecode in Decoder.js
+ *        Numbers are printed with all digits, so the comparison is exact
+ *
+ * @param field decoded field
+ */
+static void print_value(const lpp::Field &field)
+{
+	static const char *xyz[] = {"x", "y", "z"};
+	static const char *rgb[] = {"r", "g", "b"};
+	static const char *gps[] = {"latitude", "longitude", "altitude"};
+	static const char *timing[] = {"event", "bme", "location", "cell_send", "lora_tx", "cycle_uah"};
+
+	switch (field.info->layout)
+	{
+	case lpp::LAYOUT_SCALAR:
+		printf("%.17g", field.value());
+		break;
+	case lpp::LAYOUT_XYZ:
+	case lpp::LAYOUT_COLOUR:
+	case lpp::LAYOUT_GPS_4:
+	case lpp::LAYOUT_GPS_6:
+	{
+		const char **names = field.info->layout == lpp::LAYOUT_XYZ ? xyz : (field.info->layout == lpp::LAYOUT_COLOUR ? rgb : gps);
+		for (uint8_t idx = 0; idx < 3; idx++)
+		{
+			printf("%s\"%s\":%.17g", idx == 0 ? "{" : ",", names[idx], field.component(idx));
+		}
+		printf("}");
+		break;
+	}
+	case lpp::LAYOUT_TRACK:
+	{
+		lpp::TrackReader reader = field.track();
+		lpp::TrackPoint point;
+		bool first = true;
+		printf("[");
+		while (reader.next(point))
+		{
+			printf("%s{\"latitude\":%.17g,\"longitude\":%.17g,\"time\":%u}", first ? "" : ",", point.latitude, point.longitude, point.time);
+			first = false;
+		}
+		printf("]");
+		break;
+	}
+	case lpp::LAYOUT_FRAGMENT:
+		printf("{\"packet\":%u,\"index\":%u,\"count\":%u}", field.raw(0, 1), field.raw(1, 1) >> 4, field.raw(1, 1) & 0x0F);
+		break;
+	case lpp::LAYOUT_DIAG:
+		printf("{\"cause\":%u,\"boots\":%u,\"abnormal\":%u,\"uptime\":%u,\"heap\":%u}",
+			   field.raw(0, 1), field.raw(1, 2), field.raw(3, 2), field.raw(5, 2), field.raw(7, 1));
+		break;
+	case lpp::LAYOUT_TIMING:
+		for (uint8_t idx = 0; idx < 6; idx++)
+		{
+			printf("%s\"%s\":%u", idx == 0 ? "{" : ",", timing[idx], field.raw(idx * 2, 2));
+		}
+		printf("}");
+		break;
+	}
+}
+
+/**
+ * @brief Write random frames and the decoded fields as JSON lines
+ *        {"frame":[bytes],"result":DECODE_xxx,"fields":[{"channel","type","name","value"}]}
+ *
+ * @param frames number of frames
+ * @return int exit code
+ */
+static int corpus_run(uint32_t frames)
+{
+	std::vector<uint8_t> types = table_types();
+	for (uint32_t idx = 0; idx < frames; idx++)
+	{
+		// Some tracks are longer than 255 bytes, some frames end with an unknown type
+		std::vector<uint8_t> frame = make_frame(types, (idx % 10) == 0 ? 255 : 20, (idx % 20) == 19);
+
+		printf("{\"frame\":[");
+		for (size_t pos = 0; pos < frame.size(); pos++)
+		{
+			printf("%s%u", pos == 0 ? "" : ",", frame[pos]);
+		}
+		printf("],\"fields\":[");
+		bool first = true;
+		int result = lpp::decode(frame.data(), frame.size(), [&](const lpp::Field &field)
+		{
+			printf("%s{\"channel\":%u,\"type\":%u,\"name\":\"%s\",\"value\":", first ? "" : ",", field.channel, field.type, field.name());
+			print_value(field);
+			printf("}");
+			first = false;
+		});
+		printf("],\"result\":%d}\n", result);
+	}
+	return 0;
+}
+
+/**
+ * @brief Use the decoded values, so the compiler cannot drop the decoding
+ *
+ * @param field decoded field
+ * @return double sum of the values
+ */
+static double field_sum(const lpp::Field &field)
+{
+	switch (field.info->layout)
+	{
+	case lpp::LAYOUT_SCALAR:
+		return field.value();
+	case lpp::LAYOUT_XYZ:
+	case lpp::LAYOUT_COLOUR:
+	case lpp::LAYOUT_GPS_4:
+	case lpp::LAYOUT_GPS_6:
+		return field.component(0) + field.component(1) + field.component(2);
+	case lpp::LAYOUT_TRACK:
+	{
+		double sum = 0;
+		lpp::TrackReader reader = field.track();
+		lpp::TrackPoint point;
+		while (reader.next(point))
+		{
+			sum += point.latitude + point.longitude;
+		}
+		return sum;
+	}
+	default:
+		return field.raw(0, 1);
+	}
+}
+
+/**
+ * @brief Decode random frames with decode_batch for one second
+ *        The frames are up to the 242 bytes of a LoRaWAN packet
+ *
+ * @param frames number of different frames
+ * @return int exit code
+ */
+static int bench_run(uint32_t frames)
+{
+	std::vector<uint8_t> types = table_types();
+	std::vector<std::vector<uint8_t> > corpus;
+	std::vector<lpp::FrameRef> refs;
+	size_t bytes = 0;
+	while (corpus.size() < frames)
+	{
+		std::vector<uint8_t> frame = make_frame(types, 16, false);
+		if (frame.size() <= 242)
+		{
+			corpus.push_back(frame);
+			bytes += frame.size();
+		}
+	}
+	for (size_t idx = 0; idx < corpus.size(); idx++)
+	{
+		lpp::FrameRef ref = {corpus[idx].data(), corpus[idx].size()};
+		refs.push_back(ref);
+	}
+
+	double sum = 0;
+	uint64_t fields = 0;
+	uint64_t decoded = 0;
+	uint32_t rounds = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double elapsed = 0;
+	while (elapsed < 1.0)
+	{
+		decoded += lpp::decode_batch(refs.data(), refs.size(), [&](size_t frame, const lpp::Field &field)
+		{
+			(void)frame;
+			sum += field_sum(field);
+			fields++;
+		});
+		rounds++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	printf("%u frames, %.1f bytes per frame, %.1f fields per frame\n", frames, (double)bytes / frames, (double)fields / rounds / frames);
+	printf("%.0f frames/s, %.1f MB/s, %.0f fields/s (checksum %g)\n", decoded / elapsed, bytes * (double)rounds / elapsed / 1000000.0, fields / elapsed, sum);
+	return decoded == (uint64_t)rounds * frames ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *mode = argc > 1 ? argv[1] : "";
+	uint32_t frames = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+	if (strcmp(mode, "corpus") == 0)
+	{
+		return corpus_run(frames == 0 ? 2000 : frames);
+	}
+	if (strcmp(mode, "bench") == 0)
+	{
+		return bench_run(frames == 0 ? 10000 : frames);
+	}
+	printf("Usage: %s corpus|bench [frames]\n", argv[0]);
+	printf("  corpus            Random frames and decoded fields as JSON lines, default 2000 frames\n");
+	printf("                    Compare with Decoder.js: %s corpus | node native/lpp/lpp_check.js\n", argv[0]);
+	printf("  bench             Decode random frames for one second, default 10000 frames\n");
+	return 1;
+}
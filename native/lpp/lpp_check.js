@@ -0,0 +1,123 @@
+/**
+ * Conformance check of lpp_decoder.h against Decoder.js
+ *
+ * Reads the JSON lines of "lpp_check corpus", decodes each frame with lppDecode
+ * and compares the fields. The numbers must be equal, not only close.
+ * Afterwards the frames are decoded for one second to compare the speed.
+ *
+ * Usage from the project folder:
+ *  ./lpp_check corpus | node native/lpp/lpp_check.js
+ */
+var path = require('path');
+var decoder = require(path.join(__dirname, '..', '..', 'Decoder.js'));
+
+// Result of lpp::decode for a frame with a type that is not in the table
+var DECODE_UNKNOWN_TYPE = 1;
+
+// Compare two decoded values, objects and arrays field by field
+function sameValue(a, b) {
+	if ((typeof a != 'object') || (typeof b != 'object')) {
+		return a === b;
+	}
+	var keys = Object.keys(a);
+	if (keys.length != Object.keys(b).length) {
+		return false;
+	}
+	for (var k = 0; k < keys.length; k++) {
+		if (!sameValue(a[keys[k]], b[keys[k]])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// lppDecode adds the location and the altitude of a precise GPS field as two more fields,
+// check them against the GPS field and remove them
+function normalize(fields) {
+	var result = [];
+	var extra = {};
+	for (var f = 0; f < fields.length; f++) {
+		var field = fields[f];
+		if ((field.type == 137) && (field.name != 'gps')) {
+			extra[field.name] = field.value;
+			continue;
+		}
+		if (field.type == 137) {
+			var location = '(' + field.value.latitude + ',' + field.value.longitude + ')';
+			if ((extra.location !== location) || (extra.altitude !== field.value.altitude)) {
+				throw 'location ' + extra.location + ' altitude ' + extra.altitude + ' do not match the GPS field';
+			}
+			extra = {};
+		}
+		result.push(field);
+	}
+	return result;
+}
+
+// Compare one line of the corpus, returns an error text or null
+function check(entry) {
+	var fields;
+	try {
+		fields = decoder.lppDecode(entry.frame);
+	} catch (e) {
+		return entry.result == DECODE_UNKNOWN_TYPE ? null : 'Decoder.js failed: ' + e;
+	}
+	if (entry.result == DECODE_UNKNOWN_TYPE) {
+		return 'Decoder.js did not fail on the unknown type';
+	}
+	if (entry.result != 0) {
+		return 'lpp_decoder.h failed with ' + entry.result;
+	}
+	try {
+		fields = normalize(fields);
+	} catch (e) {
+		return e;
+	}
+	if (fields.length != entry.fields.length) {
+		return fields.length + ' fields from Decoder.js, ' + entry.fields.length + ' from lpp_decoder.h';
+	}
+	for (var f = 0; f < fields.length; f++) {
+		var js = fields[f];
+		var cpp = entry.fields[f];
+		if ((js.channel !== cpp.channel) || (js.type !== cpp.type) || (js.name !== cpp.name) || !sameValue(js.value, cpp.value)) {
+			return 'field ' + f + ' Decoder.js ' + JSON.stringify(js) + ' lpp_decoder.h ' + JSON.stringify(cpp);
+		}
+	}
+	return null;
+}
+
+var input = require('fs').readFileSync(0, 'utf8').split('\n');
+var frames = [];
+var checked = 0;
+var failed = 0;
+for (var l = 0; l < input.length; l++) {
+	if (input[l].trim() == '') {
+		continue;
+	}
+	var entry = JSON.parse(input[l]);
+	checked++;
+	var error = check(entry);
+	if (error != null) {
+		if (failed < 10) {
+			console.log('Frame ' + (checked - 1) + ': ' + error);
+		}
+		failed++;
+	}
+	if (entry.result == 0) {
+		frames.push(entry.frame);
+	}
+}
+console.log(checked + ' frames checked, ' + failed + ' differences');
+
+// Speed of Decoder.js for comparison with "lpp_check bench"
+var decoded = 0;
+var start = Date.now();
+while ((Date.now() - start) < 1000) {
+	for (var f = 0; f < frames.length; f++) {
+		decoder.lppDecode(frames[f]);
+	}
+	decoded += frames.length;
+}
+console.log('Decoder.js ' + Math.round(decoded * 1000 / (Date.now() - start)) + ' frames/s');
+
+process.exit(failed == 0 ? 0 : 1);
@@ -0,0 +1,182 @@
+/**
+ * @file arduino.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Serial, GPIO, random numbers and heap statistics for the native build
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <Arduino.h>
+#include "native.h"
+#include <stdarg.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+SerialPort Serial;
+TwoWire Wire;
+
+/** Number of simulated GPIOs */
+#define NATIVE_PINS 64
+
+/** Output level of the GPIOs */
+static uint8_t pin_level[NATIVE_PINS];
+
+/** Heap usage before the first task started */
+static size_t heap_base = 0;
+
+/** State of the random generator */
+static uint32_t random_state = 1;
+
+void SerialPort::begin(uint32_t baud)
+{
+	(void)baud;
+}
+
+void SerialPort::flush(void)
+{
+	fflush(stdout);
+}
+
+int SerialPort::printf(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int len = vprintf(format, args);
+	va_end(args);
+	return len;
+}
+
+size_t SerialPort::write(const uint8_t *data, size_t len)
+{
+	return fwrite(data, 1, len, stdout);
+}
+
+size_t SerialPort::print(const char *text)
+{
+	return fputs(text, stdout) < 0 ? 0 : strlen(text);
+}
+
+void pinMode(int pin, int mode)
+{
+	(void)pin;
+	(void)mode;
+}
+
+void digitalWrite(int pin, int value)
+{
+	if ((pin >= 0) && (pin < NATIVE_PINS))
+	{
+		pin_level[pin] = value != LOW;
+	}
+}
+
+int digitalRead(int pin)
+{
+	if ((pin >= 0) && (pin < NATIVE_PINS))
+	{
+		return pin_level[pin];
+	}
+	return LOW;
+}
+
+void attachInterrupt(int pin, void (*callback)(void), int mode)
+{
+	// The simulated NoteCard does not raise ATTN
+	(void)pin;
+	(void)callback;
+	(void)mode;
+}
+
+void detachInterrupt(int pin)
+{
+	(void)pin;
+}
+
+/**
+ * @brief Next value of the random generator
+ *        Same sequence on every host, runs are repeatable
+ *
+ * @return uint32_t random value
+ */
+static uint32_t random_next(void)
+{
+	// xorshift32
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+long random(long max_value)
+{
+	if (max_value <= 0)
+	{
+		return 0;
+	}
+	return (long)(random_next() % (uint32_t)max_value);
+}
+
+long random(long min_value, long max_value)
+{
+	if (min_value >= max_value)
+	{
+		return min_value;
+	}
+	return min_value + random(max_value - min_value);
+}
+
+void randomSeed(unsigned long seed)
+{
+	random_state = seed != 0 ? (uint32_t)seed : 1;
+}
+
+/**
+ * @brief Make the heap statistics cover all threads and start counting
+ *        Called by native_kernel_init before any task is started
+ *
+ */
+void native_heap_init(void)
+{
+#if defined(__GLIBC__)
+	// One arena for all threads, otherwise mallinfo2 misses the task allocations
+	mallopt(M_ARENA_MAX, 1);
+	heap_base = mallinfo2().uordblks;
+#endif
+}
+
+int dbgHeapTotal(void)
+{
+#if defined(__GLIBC__)
+	return (int)mallinfo2().arena;
+#else
+	return 0;
+#endif
+}
+
+int dbgHeapUsed(void)
+{
+#if defined(__GLIBC__)
+	// Only the heap used after the start counts, not the host runtime
+	return (int)(mallinfo2().uordblks - heap_base);
+#else
+	return 0;
+#endif
+}
+
+int dbgHeapFree(void)
+{
+#if defined(__GLIBC__)
+	return (int)mallinfo2().fordblks;
+#else
+	return 0;
+#endif
+}
+
+uint32_t readResetReason(void)
+{
+	// Power on reset
+	return 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file bme680.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Simulated BME680 for the native build
+ *        Values drift slowly like in a room, the conversion time is calculated
+ *        like in the Adafruit driver.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <Adafruit_BME680.h>
+#include "native.h"
+
+/** Conversion time in ms, 0 = calculate from the oversampling */
+uint32_t g_native_bme_ms = 0;
+
+Adafruit_BME680::Adafruit_BME680(TwoWire *the_wire)
+{
+	(void)the_wire;
+	temperature = 0;
+	pressure = 0;
+	humidity = 0;
+	gas_resistance = 0;
+	_temp_os = BME680_OS_8X;
+	_hum_os = BME680_OS_2X;
+	_pres_os = BME680_OS_4X;
+	_heater_time = 0;
+	_meas_end = 0;
+	_readings = 0;
+}
+
+bool Adafruit_BME680::begin(uint8_t addr, bool init_settings)
+{
+	(void)addr;
+	(void)init_settings;
+	return true;
+}
+
+bool Adafruit_BME680::setTemperatureOversampling(uint8_t os)
+{
+	_temp_os = os;
+	return true;
+}
+
+bool Adafruit_BME680::setHumidityOversampling(uint8_t os)
+{
+	_hum_os = os;
+	return true;
+}
+
+bool Adafruit_BME680::setPressureOversampling(uint8_t os)
+{
+	_pres_os = os;
+	return true;
+}
+
+bool Adafruit_BME680::setIIRFilterSize(uint8_t fs)
+{
+	(void)fs;
+	return true;
+}
+
+bool Adafruit_BME680::setGasHeater(uint16_t heater_temp, uint16_t heater_time)
+{
+	_heater_time = heater_temp == 0 ? 0 : heater_time;
+	return true;
+}
+
+uint32_t Adafruit_BME680::beginReading(void)
+{
+	uint32_t meas_ms = g_native_bme_ms;
+	if (meas_ms == 0)
+	{
+		// Same calculation as bme68x_get_meas_dur of the Bosch driver
+		static const uint8_t os_cycles[] = {0, 1, 2, 4, 8, 16};
+		uint32_t meas_cycles = os_cycles[_temp_os] + os_cycles[_hum_os] + os_cycles[_pres_os];
+		uint32_t meas_us = meas_cycles * 1963 + 477 * 4 + 477 * 5 + 500;
+		meas_ms = meas_us / 1000 + 1 + _heater_time;
+	}
+	_meas_end = millis() + meas_ms;
+	return _meas_end;
+}
+
+bool Adafruit_BME680::endReading(void)
+{
+	if (_meas_end == 0)
+	{
+		return false;
+	}
+	int32_t remaining = (int32_t)(_meas_end - millis());
+	if (remaining > 0)
+	{
+		delay(remaining);
+	}
+	_meas_end = 0;
+	_readings++;
+
+	temperature = 24.5 + 1.5 * sin(_readings / 40.0);
+	humidity = 55.0 + 8.0 * sin(_readings / 55.0);
+	pressure = (uint32_t)(100850 + 120 * sin(_readings / 90.0));
+	gas_resistance = _heater_time == 0 ? 0 : 85000;
+	return true;
+}
+
+int Adafruit_BME680::remainingReadingMillis(void)
+{
+	if (_meas_end == 0)
+	{
+		return -1;
+	}
+	int32_t remaining = (int32_t)(_meas_end - millis());
+	return remaining > 0 ? remaining : 0;
+}
+
+bool Adafruit_BME680::performReading(void)
+{
+	return (beginReading() != 0) && endReading();
+}
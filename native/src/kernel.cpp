@@ -0,0 +1,777 @@
+/**
+ * @file kernel.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief FreeRTOS tasks, queues, semaphores and timers for the native build
+ *        Each task is a thread, a task only runs while it holds the CPU.
+ *        The CPU goes to the ready task with the highest priority when the
+ *        running task blocks. If no task is ready, the virtual clock jumps to
+ *        the next timeout. A cycle takes the same virtual time on every run.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <Arduino.h>
+#include "native.h"
+#include <stdarg.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+/** Task states */
+#define TASK_READY 0   // Waits for the CPU
+#define TASK_RUNNING 1 // Holds the CPU
+#define TASK_BLOCKED 2 // Waits for an object or a timeout
+
+/** Wake time of tasks that wait without timeout */
+#define NO_TIMEOUT UINT64_MAX
+
+/** Host side of a FreeRTOS task */
+struct s_native_task
+{
+	const char *name;				  // Task name
+	UBaseType_t priority;			  // FreeRTOS priority
+	uint8_t state;					  // TASK_READY, TASK_RUNNING or TASK_BLOCKED
+	bool has_cpu;					  // Task may run
+	bool timed_out;					  // Last block ended with the timeout
+	bool waits_notify;				  // Task is blocked in ulTaskNotifyTake
+	uint64_t wake_us;				  // Timeout of the block, NO_TIMEOUT if none
+	uint32_t ready_order;			  // Tasks of the same priority run in FIFO order
+	uint32_t notify_count;			  // Task notification value
+	std::condition_variable cpu_cond; // Signaled when the task gets the CPU
+};
+
+/** Waiting list of a queue or semaphore */
+typedef std::deque<s_native_task *> task_list_t;
+
+/** Host side of a FreeRTOS queue */
+struct s_native_queue
+{
+	UBaseType_t length;			  // Maximum number of items
+	UBaseType_t item_size;		  // Size of one item in bytes
+	std::deque<uint8_t> items;	  // Item bytes
+	task_list_t receivers;		  // Tasks waiting for an item
+	task_list_t senders;		  // Tasks waiting for space
+};
+
+/** Host side of a FreeRTOS semaphore or mutex */
+struct s_native_semaphore
+{
+	UBaseType_t count;	   // Available count
+	UBaseType_t max_count; // 1 for mutex and binary semaphores
+	task_list_t takers;	   // Tasks waiting for the semaphore
+};
+
+/** Host side of a FreeRTOS software timer */
+struct s_native_timer
+{
+	void (*callback)(TimerHandle_t); // Expiry callback
+	void *timer_id;					 // ID of the timer
+	uint32_t period_ms;				 // Timer period
+	bool repeating;					 // Restart after expiry
+	bool active;					 // Timer is running
+	uint64_t expiry_us;				 // Next expiry
+};
+
+/** Lock of the kernel state, only the task that holds the CPU changes it */
+static std::mutex kernel_lock;
+
+/** All tasks */
+static std::vector<s_native_task *> tasks;
+
+/** Task that holds the CPU */
+static s_native_task *current_task = NULL;
+
+/** Virtual clock in microseconds */
+static uint64_t clock_us = 0;
+
+/** Counter for the FIFO order of ready tasks */
+static uint32_t ready_counter = 0;
+
+/** Nesting depth of taskENTER_CRITICAL */
+static uint32_t critical_nesting = 0;
+
+/** A task was woken inside a critical section and has a higher priority */
+static bool preempt_pending = false;
+
+/** All software timers */
+static std::vector<s_native_timer *> timers;
+
+/** Timer task, runs the timer callbacks */
+static s_native_task *timer_task = NULL;
+
+/** Priority of the timer task, higher than all app tasks */
+#define TIMER_TASK_PRIO 4
+
+/**
+ * @brief Stop the program with an error
+ *        Used for situations that would hang or crash the device
+ *
+ * @param format printf format
+ */
+void native_fatal(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "NATIVE FATAL: ");
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	fflush(stdout);
+	fflush(stderr);
+	_Exit(2);
+}
+
+/**
+ * @brief Put a task into the ready state
+ *
+ * @param task task to wake up
+ */
+static void kernel_make_ready(s_native_task *task)
+{
+	task->state = TASK_READY;
+	task->wake_us = NO_TIMEOUT;
+	task->ready_order = ready_counter++;
+}
+
+/**
+ * @brief Find the ready task that runs next
+ *
+ * @return s_native_task* ready task with the highest priority, NULL if none is ready
+ */
+static s_native_task *kernel_pick(void)
+{
+	s_native_task *next = NULL;
+	for (size_t idx = 0; idx < tasks.size(); idx++)
+	{
+		s_native_task *task = tasks[idx];
+		if (task->state != TASK_READY)
+		{
+			continue;
+		}
+		if ((next == NULL) || (task->priority > next->priority) ||
+			((task->priority == next->priority) && ((int32_t)(task->ready_order - next->ready_order) < 0)))
+		{
+			next = task;
+		}
+	}
+	return next;
+}
+
+/**
+ * @brief Give the CPU to the next task and wait until the current task gets it back
+ *        The current task must be ready or blocked. Advances the clock if no task is ready.
+ *
+ * @param lock kernel lock, held by the caller
+ */
+static void kernel_switch(std::unique_lock<std::mutex> &lock)
+{
+	s_native_task *self = current_task;
+	s_native_task *next = kernel_pick();
+	while (next == NULL)
+	{
+		// All tasks wait, jump to the next timeout
+		uint64_t next_wake = NO_TIMEOUT;
+		for (size_t idx = 0; idx < tasks.size(); idx++)
+		{
+			if ((tasks[idx]->state == TASK_BLOCKED) && (tasks[idx]->wake_us < next_wake))
+			{
+				next_wake = tasks[idx]->wake_us;
+			}
+		}
+		if (next_wake == NO_TIMEOUT)
+		{
+			native_fatal("All tasks wait forever, deadlock");
+		}
+		if (next_wake > clock_us)
+		{
+			clock_us = next_wake;
+		}
+		for (size_t idx = 0; idx < tasks.size(); idx++)
+		{
+			s_native_task *task = tasks[idx];
+			if ((task->state == TASK_BLOCKED) && (task->wake_us <= clock_us))
+			{
+				task->timed_out = true;
+				kernel_make_ready(task);
+			}
+		}
+		next = kernel_pick();
+	}
+
+	self->has_cpu = false;
+	next->state = TASK_RUNNING;
+	next->has_cpu = true;
+	current_task = next;
+	if (next != self)
+	{
+		next->cpu_cond.notify_one();
+		while (!self->has_cpu)
+		{
+			self->cpu_cond.wait(lock);
+		}
+	}
+}
+
+/**
+ * @brief Block the current task until it is woken or the timeout is reached
+ *
+ * @param lock kernel lock, held by the caller
+ * @param wake_us absolute timeout, NO_TIMEOUT to wait forever
+ * @return true if the task was woken
+ * @return false if the timeout was reached
+ */
+static bool kernel_block(std::unique_lock<std::mutex> &lock, uint64_t wake_us)
+{
+	if (critical_nesting != 0)
+	{
+		native_fatal("Task %s blocks inside a critical section", current_task->name);
+	}
+	current_task->state = TASK_BLOCKED;
+	current_task->timed_out = false;
+	current_task->wake_us = wake_us;
+	kernel_switch(lock);
+	return !current_task->timed_out;
+}
+
+/**
+ * @brief Give the CPU to a woken task with a higher priority
+ *
+ * @param lock kernel lock, held by the caller
+ * @param woken task that was made ready
+ */
+static void kernel_preempt(std::unique_lock<std::mutex> &lock, s_native_task *woken)
+{
+	if (woken->priority <= current_task->priority)
+	{
+		return;
+	}
+	if (critical_nesting != 0)
+	{
+		preempt_pending = true;
+		return;
+	}
+	kernel_make_ready(current_task);
+	kernel_switch(lock);
+}
+
+/**
+ * @brief Wake the first task of a waiting list
+ *
+ * @param lock kernel lock, held by the caller
+ * @param list waiting list
+ */
+static void kernel_wake_first(std::unique_lock<std::mutex> &lock, task_list_t &list)
+{
+	if (list.empty())
+	{
+		return;
+	}
+	s_native_task *task = list.front();
+	list.pop_front();
+	kernel_make_ready(task);
+	kernel_preempt(lock, task);
+}
+
+/**
+ * @brief Remove a task from a waiting list, e.g. after a timeout
+ *
+ * @param list waiting list
+ * @param task task to remove
+ */
+static void kernel_unlist(task_list_t &list, s_native_task *task)
+{
+	task_list_t::iterator entry = std::find(list.begin(), list.end(), task);
+	if (entry != list.end())
+	{
+		list.erase(entry);
+	}
+}
+
+/**
+ * @brief Get the absolute timeout for a FreeRTOS tick count
+ *
+ * @param ticks ticks to wait, portMAX_DELAY to wait forever
+ * @return uint64_t absolute timeout in microseconds
+ */
+static uint64_t kernel_timeout(TickType_t ticks)
+{
+	return ticks == portMAX_DELAY ? NO_TIMEOUT : clock_us + (uint64_t)ticks * 1000;
+}
+
+/**
+ * @brief Create the host side of a task
+ *
+ * @param name task name
+ * @param priority FreeRTOS priority
+ * @return s_native_task* new task
+ */
+static s_native_task *kernel_new_task(const char *name, UBaseType_t priority)
+{
+	s_native_task *task = new s_native_task();
+	task->name = name;
+	task->priority = priority;
+	task->has_cpu = false;
+	task->timed_out = false;
+	task->waits_notify = false;
+	task->notify_count = 0;
+	kernel_make_ready(task);
+	tasks.push_back(task);
+	return task;
+}
+
+/**
+ * @brief Thread of a task, waits for the CPU before the task function starts
+ *
+ */
+static void kernel_task_thread(s_native_task *task, void (*function)(void *), void *parameters)
+{
+	{
+		std::unique_lock<std::mutex> lock(kernel_lock);
+		while (!task->has_cpu)
+		{
+			task->cpu_cond.wait(lock);
+		}
+	}
+	function(parameters);
+	native_fatal("Task %s returned", task->name);
+}
+
+static void timer_task_function(void *parameters);
+
+/**
+ * @brief Make the calling thread the Arduino loop task and start the timer task
+ *        Call it once before any other function of the native build
+ *
+ */
+void native_kernel_init(void)
+{
+	native_heap_init();
+
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_task *loop_task = kernel_new_task("loop", TASK_PRIO_LOW);
+	loop_task->state = TASK_RUNNING;
+	loop_task->has_cpu = true;
+	current_task = loop_task;
+
+	timer_task = kernel_new_task("Tmr Svc", TIMER_TASK_PRIO);
+	std::thread(kernel_task_thread, timer_task, timer_task_function, (void *)NULL).detach();
+	kernel_preempt(lock, timer_task);
+}
+
+/**
+ * @brief Get the virtual clock
+ *
+ * @return uint64_t microseconds since start
+ */
+uint64_t native_clock_us(void)
+{
+	return clock_us;
+}
+
+uint32_t millis(void)
+{
+	return (uint32_t)(clock_us / 1000);
+}
+
+uint32_t micros(void)
+{
+	return (uint32_t)clock_us;
+}
+
+void delay(uint32_t ms)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	if (ms == 0)
+	{
+		kernel_make_ready(current_task);
+		kernel_switch(lock);
+		return;
+	}
+	kernel_block(lock, clock_us + (uint64_t)ms * 1000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	delay(ticks);
+}
+
+void taskYIELD(void)
+{
+	delay(0);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return millis();
+}
+
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, TaskHandle_t *handle)
+{
+	(void)stack_depth;
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_task *new_task = kernel_new_task(name, priority);
+	if (handle != NULL)
+	{
+		*handle = new_task;
+	}
+	std::thread(kernel_task_thread, new_task, task, parameters).detach();
+	kernel_preempt(lock, new_task);
+	return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return current_task;
+}
+
+void taskENTER_CRITICAL(void)
+{
+	critical_nesting++;
+}
+
+void taskEXIT_CRITICAL(void)
+{
+	if (critical_nesting == 0)
+	{
+		native_fatal("taskEXIT_CRITICAL without taskENTER_CRITICAL");
+	}
+	critical_nesting--;
+	if ((critical_nesting == 0) && preempt_pending)
+	{
+		std::unique_lock<std::mutex> lock(kernel_lock);
+		preempt_pending = false;
+		kernel_make_ready(current_task);
+		kernel_switch(lock);
+	}
+}
+
+bool isInISR(void)
+{
+	return false;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_task *self = current_task;
+	if ((self->notify_count == 0) && (ticks != 0))
+	{
+		self->waits_notify = true;
+		kernel_block(lock, kernel_timeout(ticks));
+		self->waits_notify = false;
+	}
+	uint32_t count = self->notify_count;
+	if (count != 0)
+	{
+		self->notify_count = clear_on_exit ? 0 : count - 1;
+	}
+	return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task_handle)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_task *task = (s_native_task *)task_handle;
+	task->notify_count++;
+	if ((task->state == TASK_BLOCKED) && task->waits_notify)
+	{
+		task->waits_notify = false;
+		kernel_make_ready(task);
+		kernel_preempt(lock, task);
+	}
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task_handle, BaseType_t *woken)
+{
+	if (woken != NULL)
+	{
+		*woken = pdFALSE;
+	}
+	xTaskNotifyGive(task_handle);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+	s_native_queue *queue = new s_native_queue();
+	queue->length = length;
+	queue->item_size = item_size;
+	return queue;
+}
+
+/**
+ * @brief Put an item into a queue
+ *
+ * @param queue_handle queue
+ * @param item item to copy into the queue
+ * @param ticks time to wait for space
+ * @param to_front put the item in front of the other items
+ * @return BaseType_t pdTRUE if the item was queued
+ */
+static BaseType_t queue_put(QueueHandle_t queue_handle, const void *item, TickType_t ticks, bool to_front)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_queue *queue = (s_native_queue *)queue_handle;
+	uint64_t wake_us = kernel_timeout(ticks);
+	while ((queue->items.size() / queue->item_size) >= queue->length)
+	{
+		if (ticks == 0)
+		{
+			return pdFALSE;
+		}
+		queue->senders.push_back(current_task);
+		bool woken = kernel_block(lock, wake_us);
+		kernel_unlist(queue->senders, current_task);
+		if (!woken && ((queue->items.size() / queue->item_size) >= queue->length))
+		{
+			return pdFALSE;
+		}
+	}
+	const uint8_t *bytes = (const uint8_t *)item;
+	if (to_front)
+	{
+		queue->items.insert(queue->items.begin(), bytes, bytes + queue->item_size);
+	}
+	else
+	{
+		queue->items.insert(queue->items.end(), bytes, bytes + queue->item_size);
+	}
+	kernel_wake_first(lock, queue->receivers);
+	return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	return queue_put(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	return queue_put(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	return queue_put(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue_handle, void *item, TickType_t ticks)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_queue *queue = (s_native_queue *)queue_handle;
+	uint64_t wake_us = kernel_timeout(ticks);
+	while (queue->items.empty())
+	{
+		if (ticks == 0)
+		{
+			return pdFALSE;
+		}
+		queue->receivers.push_back(current_task);
+		bool woken = kernel_block(lock, wake_us);
+		kernel_unlist(queue->receivers, current_task);
+		if (!woken && queue->items.empty())
+		{
+			return pdFALSE;
+		}
+	}
+	std::copy(queue->items.begin(), queue->items.begin() + queue->item_size, (uint8_t *)item);
+	queue->items.erase(queue->items.begin(), queue->items.begin() + queue->item_size);
+	kernel_wake_first(lock, queue->senders);
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue_handle)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_queue *queue = (s_native_queue *)queue_handle;
+	return queue->items.size() / queue->item_size;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	s_native_semaphore *semaphore = new s_native_semaphore();
+	semaphore->count = 1;
+	semaphore->max_count = 1;
+	return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	s_native_semaphore *semaphore = new s_native_semaphore();
+	semaphore->count = 0;
+	semaphore->max_count = 1;
+	return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore_handle, TickType_t ticks)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_semaphore *semaphore = (s_native_semaphore *)semaphore_handle;
+	uint64_t wake_us = kernel_timeout(ticks);
+	while (semaphore->count == 0)
+	{
+		if (ticks == 0)
+		{
+			return pdFALSE;
+		}
+		semaphore->takers.push_back(current_task);
+		bool woken = kernel_block(lock, wake_us);
+		kernel_unlist(semaphore->takers, current_task);
+		if (!woken && (semaphore->count == 0))
+		{
+			return pdFALSE;
+		}
+	}
+	semaphore->count--;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore_handle)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_semaphore *semaphore = (s_native_semaphore *)semaphore_handle;
+	if (semaphore->count >= semaphore->max_count)
+	{
+		return pdFALSE;
+	}
+	semaphore->count++;
+	kernel_wake_first(lock, semaphore->takers);
+	return pdTRUE;
+}
+
+/**
+ * @brief Timer task, waits for the next expiry and calls the timer callbacks
+ *
+ * @param parameters unused
+ */
+static void timer_task_function(void *parameters)
+{
+	(void)parameters;
+	while (true)
+	{
+		s_native_timer *expired = NULL;
+		{
+			std::unique_lock<std::mutex> lock(kernel_lock);
+			uint64_t next_expiry = NO_TIMEOUT;
+			for (size_t idx = 0; idx < timers.size(); idx++)
+			{
+				s_native_timer *timer = timers[idx];
+				if (timer->active && (timer->expiry_us < next_expiry))
+				{
+					next_expiry = timer->expiry_us;
+					expired = timer;
+				}
+			}
+			if ((expired == NULL) || (next_expiry > clock_us))
+			{
+				// Woken by a timer change or the expiry
+				kernel_block(lock, next_expiry);
+				continue;
+			}
+			if (expired->repeating)
+			{
+				expired->expiry_us += (uint64_t)expired->period_ms * 1000;
+			}
+			else
+			{
+				expired->active = false;
+			}
+		}
+		expired->callback(expired);
+	}
+}
+
+/**
+ * @brief Let the timer task find the next expiry after a timer change
+ *
+ * @param lock kernel lock, held by the caller
+ */
+static void timer_changed(std::unique_lock<std::mutex> &lock)
+{
+	if ((timer_task != NULL) && (timer_task->state == TASK_BLOCKED))
+	{
+		kernel_make_ready(timer_task);
+		kernel_preempt(lock, timer_task);
+	}
+}
+
+SoftwareTimer::SoftwareTimer(void)
+{
+	_handle = NULL;
+}
+
+void SoftwareTimer::begin(uint32_t ms, void (*callback)(TimerHandle_t), void *timer_id, bool repeating)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_timer *timer = new s_native_timer();
+	timer->callback = callback;
+	timer->timer_id = timer_id;
+	timer->period_ms = ms;
+	timer->repeating = repeating;
+	timer->active = false;
+	timer->expiry_us = 0;
+	timers.push_back(timer);
+	_handle = timer;
+}
+
+void SoftwareTimer::start(void)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_timer *timer = (s_native_timer *)_handle;
+	timer->active = true;
+	timer->expiry_us = clock_us + (uint64_t)timer->period_ms * 1000;
+	timer_changed(lock);
+}
+
+void SoftwareTimer::stop(void)
+{
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_timer *timer = (s_native_timer *)_handle;
+	timer->active = false;
+	timer_changed(lock);
+}
+
+void SoftwareTimer::reset(void)
+{
+	start();
+}
+
+void SoftwareTimer::setPeriod(uint32_t ms)
+{
+	// Like xTimerChangePeriod, a dormant timer is started
+	std::unique_lock<std::mutex> lock(kernel_lock);
+	s_native_timer *timer = (s_native_timer *)_handle;
+	timer->period_ms = ms;
+	timer->active = true;
+	timer->expiry_us = clock_us + (uint64_t)ms * 1000;
+	timer_changed(lock);
+}
+
+void *SoftwareTimer::getID(void)
+{
+	return ((s_native_timer *)_handle)->timer_id;
+}
+
+/** Value of the virtual clock when CYCCNT was written */
+static uint64_t cyccnt_base_us = 0;
+
+NativeCycleCounter::operator uint32_t(void) const
+{
+	return (uint32_t)((clock_us - cyccnt_base_us) * (SystemCoreClock / 1000000));
+}
+
+NativeCycleCounter &NativeCycleCounter::operator=(uint32_t value)
+{
+	cyccnt_base_us = clock_us - value / (SystemCoreClock / 1000000);
+	return *this;
+}
+
+static DWT_Type dwt_regs;
+static CoreDebug_Type core_debug_regs;
+DWT_Type *DWT = &dwt_regs;
+CoreDebug_Type *CoreDebug = &core_debug_regs;
@@ -0,0 +1,212 @@
+/**
+ * @file littlefs.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief In-memory file system for the native build
+ *        Same semantics as the Adafruit LittleFS: a file opened for writing is
+ *        created if needed and the position is at the end of the file, rename
+ *        replaces the target.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace Adafruit_LittleFS_Namespace;
+
+Adafruit_LittleFS InternalFS;
+
+/** Content of a file */
+typedef std::vector<uint8_t> file_data_t;
+
+/**
+ * @brief Get the files of the file system
+ *        Created on first use, the static File objects of the app are constructed before main
+ *
+ * @return std::map<std::string, file_data_t>& files by path
+ */
+static std::map<std::string, file_data_t> &fs_files(void)
+{
+	static std::map<std::string, file_data_t> files;
+	return files;
+}
+
+File::File(void)
+{
+	_path[0] = 0;
+	_pos = 0;
+	_is_open = false;
+}
+
+File::File(Adafruit_LittleFS &fs)
+{
+	(void)fs;
+	_path[0] = 0;
+	_pos = 0;
+	_is_open = false;
+}
+
+bool File::open(const char *filepath, uint8_t mode)
+{
+	close();
+	std::map<std::string, file_data_t> &files = fs_files();
+	if ((mode == FILE_O_READ) && (files.find(filepath) == files.end()))
+	{
+		return false;
+	}
+	snprintf(_path, sizeof(_path), "%s", filepath);
+	file_data_t &data = files[_path];
+	_pos = mode == FILE_O_WRITE ? data.size() : 0;
+	_is_open = true;
+	return true;
+}
+
+size_t File::read(void *buf, uint16_t nbyte)
+{
+	if (!_is_open)
+	{
+		return 0;
+	}
+	file_data_t &data = fs_files()[_path];
+	if (_pos >= data.size())
+	{
+		return 0;
+	}
+	size_t count = data.size() - _pos < nbyte ? data.size() - _pos : nbyte;
+	memcpy(buf, &data[_pos], count);
+	_pos += count;
+	return count;
+}
+
+int File::read(void)
+{
+	uint8_t ch;
+	return read(&ch, 1) == 1 ? ch : -1;
+}
+
+size_t File::write(const uint8_t *buf, size_t size)
+{
+	if (!_is_open)
+	{
+		return 0;
+	}
+	file_data_t &data = fs_files()[_path];
+	if (data.size() < (_pos + size))
+	{
+		data.resize(_pos + size);
+	}
+	memcpy(&data[_pos], buf, size);
+	_pos += size;
+	return size;
+}
+
+size_t File::write(uint8_t ch)
+{
+	return write(&ch, 1);
+}
+
+bool File::seek(uint32_t pos)
+{
+	if (!_is_open || (pos > size()))
+	{
+		return false;
+	}
+	_pos = pos;
+	return true;
+}
+
+uint32_t File::position(void)
+{
+	return _pos;
+}
+
+uint32_t File::size(void)
+{
+	return _is_open ? fs_files()[_path].size() : 0;
+}
+
+bool File::truncate(uint32_t pos)
+{
+	if (!_is_open)
+	{
+		return false;
+	}
+	fs_files()[_path].resize(pos);
+	if (_pos > pos)
+	{
+		_pos = pos;
+	}
+	return true;
+}
+
+bool File::truncate(void)
+{
+	return truncate(_pos);
+}
+
+int File::available(void)
+{
+	return _is_open ? (int)(size() - _pos) : 0;
+}
+
+void File::flush(void)
+{
+}
+
+void File::close(void)
+{
+	_is_open = false;
+}
+
+File::operator bool(void)
+{
+	return _is_open;
+}
+
+bool Adafruit_LittleFS::begin(void)
+{
+	return true;
+}
+
+File Adafruit_LittleFS::open(const char *filepath, uint8_t mode)
+{
+	File file(*this);
+	file.open(filepath, mode);
+	return file;
+}
+
+bool Adafruit_LittleFS::exists(const char *filepath)
+{
+	return fs_files().count(filepath) != 0;
+}
+
+bool Adafruit_LittleFS::remove(const char *filepath)
+{
+	return fs_files().erase(filepath) != 0;
+}
+
+bool Adafruit_LittleFS::rename(const char *source, const char *dest)
+{
+	std::map<std::string, file_data_t> &files = fs_files();
+	std::map<std::string, file_data_t>::iterator file = files.find(source);
+	if (file == files.end())
+	{
+		return false;
+	}
+	file_data_t data;
+	data.swap(file->second);
+	files.erase(file);
+	files[dest].swap(data);
+	return true;
+}
+
+bool Adafruit_LittleFS::format(void)
+{
+	fs_files().clear();
+	return true;
+}
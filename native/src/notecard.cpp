@@ -0,0 +1,944 @@
+/**
+ * @file notecard.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief JSON objects of note-c and a scripted NoteCard for the native build
+ *        Like note-c, a transaction prints the request into a buffer, frees
+ *        the request and parses the response text into new objects. All of it
+ *        goes through the NoteSetFn allocator, so the request arena of the app
+ *        sees the same allocation pattern as on the device.
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <Notecard.h>
+#include "native.h"
+
+/** Allocator set by NoteSetFn */
+static mallocFn note_malloc = malloc;
+static freeFn note_free = free;
+
+/** Statistics of the simulated NoteCard */
+s_native_card g_native_card;
+
+void NoteSetFn(mallocFn malloc_hook, freeFn free_hook, delayMsFn delay_hook, getMsFn millis_hook)
+{
+	(void)delay_hook;
+	(void)millis_hook;
+	note_malloc = malloc_hook;
+	note_free = free_hook;
+}
+
+void *NoteMalloc(size_t size)
+{
+	return note_malloc(size);
+}
+
+void NoteFree(void *ptr)
+{
+	note_free(ptr);
+}
+
+void JFree(void *ptr)
+{
+	note_free(ptr);
+}
+
+/**
+ * @brief Copy a string into memory of the NoteCard allocator
+ *
+ * @param string string to copy
+ * @return char* copy, NULL if out of memory
+ */
+static char *j_strdup(const char *string)
+{
+	size_t len = strlen(string) + 1;
+	char *copy = (char *)note_malloc(len);
+	if (copy != NULL)
+	{
+		memcpy(copy, string, len);
+	}
+	return copy;
+}
+
+/**
+ * @brief Create an empty item
+ *
+ * @param type item type
+ * @return J* new item, NULL if out of memory
+ */
+static J *j_new(int type)
+{
+	J *item = (J *)note_malloc(sizeof(J));
+	if (item != NULL)
+	{
+		memset(item, 0, sizeof(J));
+		item->type = type;
+	}
+	return item;
+}
+
+J *JCreateObject(void)
+{
+	return j_new(JObject);
+}
+
+J *JCreateArray(void)
+{
+	return j_new(JArray);
+}
+
+J *JCreateNumber(double number)
+{
+	J *item = j_new(JNumber);
+	if (item != NULL)
+	{
+		item->valuenumber = number;
+		item->valueint = (int)number;
+	}
+	return item;
+}
+
+J *JCreateString(const char *string)
+{
+	J *item = j_new(JString);
+	if (item != NULL)
+	{
+		item->valuestring = j_strdup(string);
+		if (item->valuestring == NULL)
+		{
+			JDelete(item);
+			return NULL;
+		}
+	}
+	return item;
+}
+
+void JDelete(J *item)
+{
+	while (item != NULL)
+	{
+		J *next = item->next;
+		JDelete(item->child);
+		if (item->valuestring != NULL)
+		{
+			note_free(item->valuestring);
+		}
+		if (item->string != NULL)
+		{
+			note_free(item->string);
+		}
+		note_free(item);
+		item = next;
+	}
+}
+
+void JAddItemToArray(J *array, J *item)
+{
+	if ((array == NULL) || (item == NULL))
+	{
+		return;
+	}
+	if (array->child == NULL)
+	{
+		array->child = item;
+		return;
+	}
+	J *last = array->child;
+	while (last->next != NULL)
+	{
+		last = last->next;
+	}
+	last->next = item;
+	item->prev = last;
+}
+
+void JAddItemToObject(J *object, const char *name, J *item)
+{
+	if ((object == NULL) || (item == NULL))
+	{
+		return;
+	}
+	char *key = j_strdup(name);
+	if (key == NULL)
+	{
+		JDelete(item);
+		return;
+	}
+	if (item->string != NULL)
+	{
+		note_free(item->string);
+	}
+	item->string = key;
+	JAddItemToArray(object, item);
+}
+
+J *JAddStringToObject(J *object, const char *name, const char *string)
+{
+	J *item = JCreateString(string);
+	JAddItemToObject(object, name, item);
+	return item;
+}
+
+J *JAddNumberToObject(J *object, const char *name, const double number)
+{
+	J *item = JCreateNumber(number);
+	JAddItemToObject(object, name, item);
+	return item;
+}
+
+J *JAddBoolToObject(J *object, const char *name, const bool boolean)
+{
+	J *item = j_new(boolean ? JTrue : JFalse);
+	JAddItemToObject(object, name, item);
+	return item;
+}
+
+bool JAddBinaryToObject(J *object, const char *field_name, const void *binary_data, uint32_t binary_data_len)
+{
+	static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const uint8_t *data = (const uint8_t *)binary_data;
+	char *encoded = (char *)note_malloc(((binary_data_len + 2) / 3) * 4 + 1);
+	if (encoded == NULL)
+	{
+		return false;
+	}
+	uint32_t pos = 0;
+	for (uint32_t idx = 0; idx < binary_data_len; idx += 3)
+	{
+		uint32_t triple = (uint32_t)data[idx] << 16;
+		if ((idx + 1) < binary_data_len)
+		{
+			triple |= (uint32_t)data[idx + 1] << 8;
+		}
+		if ((idx + 2) < binary_data_len)
+		{
+			triple |= data[idx + 2];
+		}
+		encoded[pos++] = base64[(triple >> 18) & 0x3F];
+		encoded[pos++] = base64[(triple >> 12) & 0x3F];
+		encoded[pos++] = (idx + 1) < binary_data_len ? base64[(triple >> 6) & 0x3F] : '=';
+		encoded[pos++] = (idx + 2) < binary_data_len ? base64[triple & 0x3F] : '=';
+	}
+	encoded[pos] = 0;
+	J *item = JAddStringToObject(object, field_name, encoded);
+	note_free(encoded);
+	return item != NULL;
+}
+
+J *JGetObjectItem(const J *object, const char *name)
+{
+	if (object == NULL)
+	{
+		return NULL;
+	}
+	for (J *item = object->child; item != NULL; item = item->next)
+	{
+		if ((item->string != NULL) && (strcmp(item->string, name) == 0))
+		{
+			return item;
+		}
+	}
+	return NULL;
+}
+
+J *JGetObject(J *object, const char *field)
+{
+	J *item = JGetObjectItem(object, field);
+	return ((item != NULL) && (item->type == JObject)) ? item : NULL;
+}
+
+bool JIsPresent(J *object, const char *field)
+{
+	return JGetObjectItem(object, field) != NULL;
+}
+
+bool JHasObjectItem(J *object, const char *field)
+{
+	return JGetObjectItem(object, field) != NULL;
+}
+
+char *JGetString(J *object, const char *field)
+{
+	static char empty[] = "";
+	J *item = JGetObjectItem(object, field);
+	if ((item == NULL) || (item->type != JString) || (item->valuestring == NULL))
+	{
+		return empty;
+	}
+	return item->valuestring;
+}
+
+double JGetNumber(J *object, const char *field)
+{
+	J *item = JGetObjectItem(object, field);
+	return ((item != NULL) && (item->type == JNumber)) ? item->valuenumber : 0.0;
+}
+
+long int JGetInt(J *object, const char *field)
+{
+	return (long int)JGetNumber(object, field);
+}
+
+bool JGetBool(J *object, const char *field)
+{
+	J *item = JGetObjectItem(object, field);
+	return (item != NULL) && (item->type == JTrue);
+}
+
+/** Output of the JSON printer, counts the length if the buffer is too small */
+struct s_j_out
+{
+	char *buffer; // Output buffer, NULL to only count
+	size_t size;  // Size of the buffer
+	size_t len;	  // Length of the text
+};
+
+static void j_put(s_j_out *out, const char *text, size_t len)
+{
+	if ((out->buffer != NULL) && ((out->len + len) < out->size))
+	{
+		memcpy(&out->buffer[out->len], text, len);
+	}
+	out->len += len;
+}
+
+static void j_put_string(s_j_out *out, const char *string)
+{
+	j_put(out, "\"", 1);
+	for (const char *chr = string; *chr != 0; chr++)
+	{
+		if ((*chr == '"') || (*chr == '\\'))
+		{
+			j_put(out, "\\", 1);
+		}
+		j_put(out, chr, 1);
+	}
+	j_put(out, "\"", 1);
+}
+
+static void j_print(s_j_out *out, const J *item)
+{
+	char number[32];
+	switch (item->type)
+	{
+	case JFalse:
+		j_put(out, "false", 5);
+		break;
+	case JTrue:
+		j_put(out, "true", 4);
+		break;
+	case JNULL:
+		j_put(out, "null", 4);
+		break;
+	case JNumber:
+		if ((item->valuenumber == floor(item->valuenumber)) && (fabs(item->valuenumber) < 1.0e15))
+		{
+			snprintf(number, sizeof(number), "%.0f", item->valuenumber);
+		}
+		else
+		{
+			snprintf(number, sizeof(number), "%.15g", item->valuenumber);
+		}
+		j_put(out, number, strlen(number));
+		break;
+	case JString:
+		j_put_string(out, item->valuestring);
+		break;
+	case JArray:
+	case JObject:
+		j_put(out, item->type == JArray ? "[" : "{", 1);
+		for (const J *child = item->child; child != NULL; child = child->next)
+		{
+			if (child != item->child)
+			{
+				j_put(out, ",", 1);
+			}
+			if (item->type == JObject)
+			{
+				j_put_string(out, child->string);
+				j_put(out, ":", 1);
+			}
+			j_print(out, child);
+		}
+		j_put(out, item->type == JArray ? "]" : "}", 1);
+		break;
+	}
+}
+
+char *JPrintUnformatted(const J *item)
+{
+	if (item == NULL)
+	{
+		return NULL;
+	}
+	s_j_out counter = {NULL, 0, 0};
+	j_print(&counter, item);
+	s_j_out out = {(char *)note_malloc(counter.len + 1), counter.len + 1, 0};
+	if (out.buffer == NULL)
+	{
+		return NULL;
+	}
+	j_print(&out, item);
+	out.buffer[out.len] = 0;
+	return out.buffer;
+}
+
+bool JPrintPreallocated(J *item, char *buffer, const int length, const bool format)
+{
+	(void)format;
+	if ((item == NULL) || (length <= 0))
+	{
+		return false;
+	}
+	s_j_out out = {buffer, (size_t)length, 0};
+	j_print(&out, item);
+	if (out.len >= (size_t)length)
+	{
+		return false;
+	}
+	buffer[out.len] = 0;
+	return true;
+}
+
+/** Position of the JSON parser */
+struct s_j_in
+{
+	const char *text; // Remaining text
+	bool failed;	  // Syntax error or out of memory
+};
+
+static void j_skip(s_j_in *in)
+{
+	while ((*in->text == ' ') || (*in->text == '\t') || (*in->text == '\r') || (*in->text == '\n'))
+	{
+		in->text++;
+	}
+}
+
+/**
+ * @brief Parse a JSON string, escapes are taken over without the backslash
+ *
+ * @param in parser position at the opening quote
+ * @return char* string in memory of the NoteCard allocator
+ */
+static char *j_parse_string(s_j_in *in)
+{
+	in->text++;
+	const char *start = in->text;
+	size_t len = 0;
+	while ((*in->text != '"') && (*in->text != 0))
+	{
+		if ((*in->text == '\\') && (in->text[1] != 0))
+		{
+			in->text++;
+		}
+		in->text++;
+		len++;
+	}
+	if (*in->text != '"')
+	{
+		in->failed = true;
+		return NULL;
+	}
+	in->text++;
+	char *string = (char *)note_malloc(len + 1);
+	if (string == NULL)
+	{
+		in->failed = true;
+		return NULL;
+	}
+	size_t pos = 0;
+	for (const char *chr = start; pos < len; chr++)
+	{
+		if (*chr == '\\')
+		{
+			chr++;
+		}
+		string[pos++] = *chr;
+	}
+	string[len] = 0;
+	return string;
+}
+
+static J *j_parse_value(s_j_in *in)
+{
+	j_skip(in);
+	J *item = NULL;
+	char chr = *in->text;
+	if ((chr == '{') || (chr == '['))
+	{
+		bool is_object = chr == '{';
+		item = j_new(is_object ? JObject : JArray);
+		if (item == NULL)
+		{
+			in->failed = true;
+			return NULL;
+		}
+		in->text++;
+		j_skip(in);
+		char end = is_object ? '}' : ']';
+		while (!in->failed && (*in->text != end))
+		{
+			char *key = NULL;
+			if (is_object)
+			{
+				if (*in->text != '"')
+				{
+					in->failed = true;
+					break;
+				}
+				key = j_parse_string(in);
+				j_skip(in);
+				if (in->failed || (*in->text != ':'))
+				{
+					note_free(key);
+					in->failed = true;
+					break;
+				}
+				in->text++;
+			}
+			J *child = j_parse_value(in);
+			if (child == NULL)
+			{
+				note_free(key);
+				break;
+			}
+			child->string = key;
+			JAddItemToArray(item, child);
+			j_skip(in);
+			if (*in->text == ',')
+			{
+				in->text++;
+				j_skip(in);
+			}
+			else if (*in->text != end)
+			{
+				in->failed = true;
+			}
+		}
+		if (!in->failed)
+		{
+			in->text++;
+		}
+	}
+	else if (chr == '"')
+	{
+		char *string = j_parse_string(in);
+		if (string != NULL)
+		{
+			item = j_new(JString);
+			if (item == NULL)
+			{
+				note_free(string);
+				in->failed = true;
+				return NULL;
+			}
+			item->valuestring = string;
+		}
+	}
+	else if (strncmp(in->text, "true", 4) == 0)
+	{
+		in->text += 4;
+		item = j_new(JTrue);
+	}
+	else if (strncmp(in->text, "false", 5) == 0)
+	{
+		in->text += 5;
+		item = j_new(JFalse);
+	}
+	else if (strncmp(in->text, "null", 4) == 0)
+	{
+		in->text += 4;
+		item = j_new(JNULL);
+	}
+	else
+	{
+		char *end = NULL;
+		double number = strtod(in->text, &end);
+		if (end == in->text)
+		{
+			in->failed = true;
+			return NULL;
+		}
+		in->text = end;
+		item = JCreateNumber(number);
+	}
+	if ((item == NULL) || in->failed)
+	{
+		in->failed = true;
+		JDelete(item);
+		return NULL;
+	}
+	return item;
+}
+
+J *JParse(const char *text)
+{
+	s_j_in in = {text, false};
+	J *item = j_parse_value(&in);
+	return in.failed ? NULL : item;
+}
+
+/** Number of lines a NoteCard script can have */
+#define CARD_SCRIPT_SIZE 64
+
+/** Length of a scripted response */
+#define CARD_RESPONSE_SIZE 480
+
+/** One scripted response */
+struct s_card_step
+{
+	char request[32];				 // Request name, e.g. note.add
+	uint32_t latency_ms;			 // Time from request to response
+	char response[CARD_RESPONSE_SIZE]; // Response JSON, empty for the generated location responses
+	bool used;						 // Response was sent at least once
+};
+
+/** Scripted responses, the responses of one request are used in order, the last one repeats */
+static s_card_step card_script[CARD_SCRIPT_SIZE];
+
+/** Number of lines in the script */
+static uint16_t card_script_len = 0;
+
+/** Built-in responses, latencies are typical for I2C transactions of a NOTE-WBGLW */
+static const char *card_default_script[] = {
+	"hub.set 30 {}",
+	"card.location.mode 30 {\"mode\":\"periodic\",\"seconds\":60}",
+	"card.wireless 40 {\"status\":\"{modem-on}\",\"mode\":\"auto\",\"net\":{\"rat\":\"lte\",\"bars\":3,\"rssi\":-71}}",
+	"card.wifi 30 {}",
+	"card.version 30 {\"version\":\"notecard-6.1.1\",\"device\":\"dev:860322068012345\"}",
+	"note.template 40 {\"bytes\":38}",
+	"note.add 50 {\"template\":true}",
+	"hub.sync 30 {}",
+	"hub.status 30 {\"status\":\"connected (session open) {connected}\",\"connected\":true}",
+	"card.motion 25 {\"count\":0}",
+	"card.attn 25 {}",
+	"card.time 35",
+	"card.location 35",
+};
+
+/** Epoch time of the virtual clock start */
+#define CARD_EPOCH_START 1695024000
+
+/** Number of generated GNSS fixes */
+static uint32_t card_fixes = 0;
+
+/** Epoch time of the last GNSS fix */
+static uint32_t card_fix_time = 0;
+
+/** GNSS period of card.location.mode in seconds, 0 takes a fix on every request */
+static uint32_t card_fix_period = 0;
+
+/**
+ * @brief Add one line to the NoteCard script
+ *        Format: <request> <latency ms> [<response JSON>]
+ *        A request without response JSON gets the built-in response.
+ *        Empty lines and lines starting with # are ignored.
+ *
+ * @param line script line
+ * @return true if the line was added
+ * @return false if the line is invalid or the script is full
+ */
+bool native_card_script_line(const char *line)
+{
+	while ((*line == ' ') || (*line == '\t'))
+	{
+		line++;
+	}
+	if ((*line == 0) || (*line == '#') || (*line == '\r') || (*line == '\n'))
+	{
+		return true;
+	}
+	if (card_script_len >= CARD_SCRIPT_SIZE)
+	{
+		return false;
+	}
+	s_card_step *step = &card_script[card_script_len];
+	memset(step, 0, sizeof(s_card_step));
+	int name_len = 0;
+	unsigned int latency_ms = 0;
+	if (sscanf(line, "%31s %u %n", step->request, &latency_ms, &name_len) < 2)
+	{
+		return false;
+	}
+	step->latency_ms = latency_ms;
+	snprintf(step->response, sizeof(step->response), "%s", &line[name_len]);
+	size_t len = strlen(step->response);
+	while ((len != 0) && ((step->response[len - 1] == '\r') || (step->response[len - 1] == '\n') || (step->response[len - 1] == ' ')))
+	{
+		step->response[--len] = 0;
+	}
+	card_script_len++;
+	return true;
+}
+
+/**
+ * @brief Load the built-in script
+ *
+ */
+static void card_load_default(void)
+{
+	card_script_len = 0;
+	for (size_t idx = 0; idx < sizeof(card_default_script) / sizeof(card_default_script[0]); idx++)
+	{
+		native_card_script_line(card_default_script[idx]);
+	}
+}
+
+/**
+ * @brief Load a NoteCard script from a file
+ *        Requests of the file replace their built-in responses, the other requests keep them
+ *
+ * @param path path of the script
+ * @return true if the script was loaded
+ * @return false if the file could not be read or has an invalid line
+ */
+bool native_card_load_script(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		return false;
+	}
+	if (card_script_len == 0)
+	{
+		card_load_default();
+	}
+	// Keep the defaults of requests that are not in the file
+	s_card_step defaults[CARD_SCRIPT_SIZE];
+	uint16_t defaults_len = card_script_len;
+	memcpy(defaults, card_script, sizeof(defaults));
+	card_script_len = 0;
+
+	char line[CARD_RESPONSE_SIZE + 64];
+	bool result = true;
+	while (result && (fgets(line, sizeof(line), file) != NULL))
+	{
+		result = native_card_script_line(line);
+	}
+	fclose(file);
+
+	uint16_t script_len = card_script_len;
+	for (uint16_t idx = 0; result && (idx < defaults_len); idx++)
+	{
+		bool scripted = false;
+		for (uint16_t step = 0; step < script_len; step++)
+		{
+			scripted |= strcmp(card_script[step].request, defaults[idx].request) == 0;
+		}
+		if (!scripted && (card_script_len < CARD_SCRIPT_SIZE))
+		{
+			card_script[card_script_len++] = defaults[idx];
+		}
+	}
+	return result;
+}
+
+/**
+ * @brief Set the latency of all scripted responses
+ *
+ * @param ms latency in milliseconds
+ */
+void native_card_latency_all(uint32_t ms)
+{
+	if (card_script_len == 0)
+	{
+		card_load_default();
+	}
+	for (uint16_t idx = 0; idx < card_script_len; idx++)
+	{
+		card_script[idx].latency_ms = ms;
+	}
+}
+
+/**
+ * @brief Find the next response for a request
+ *
+ * @param request request name
+ * @return s_card_step* scripted response, NULL if the request is not in the script
+ */
+static s_card_step *card_next_step(const char *request)
+{
+	s_card_step *last = NULL;
+	for (uint16_t idx = 0; idx < card_script_len; idx++)
+	{
+		s_card_step *step = &card_script[idx];
+		if (strcmp(step->request, request) != 0)
+		{
+			continue;
+		}
+		if (!step->used)
+		{
+			step->used = true;
+			return step;
+		}
+		last = step;
+	}
+	return last;
+}
+
+/**
+ * @brief Generate the response of card.location or card.time
+ *        The device drives along a slightly curved road. Like the NoteCard in
+ *        periodic mode, a new GNSS fix is taken once per period
+ *
+ * @param request card.location or card.time
+ * @param response buffer for the response JSON
+ * @param size size of the buffer
+ */
+static void card_location_response(const char *request, char *response, size_t size)
+{
+	uint32_t now = CARD_EPOCH_START + millis() / 1000;
+	if (strcmp(request, "card.time") == 0)
+	{
+		snprintf(response, size, "{\"time\":%u,\"area\":\"Makati\",\"country\":\"PH\",\"zone\":\"PST,Asia/Manila\","
+								 "\"minutes\":480,\"lat\":14.5547,\"lon\":121.0244}",
+				 now);
+		return;
+	}
+	if ((card_fixes == 0) || ((now - card_fix_time) >= card_fix_period))
+	{
+		card_fixes++;
+		card_fix_time = now;
+	}
+	double lat = 14.5547 + card_fixes * 0.00021;
+	double lon = 121.0244 + card_fixes * 0.00013 + 0.0008 * sin(card_fixes / 25.0);
+	snprintf(response, size, "{\"status\":\"GPS updated (%u sec, 41dB SNR, 9 sats) {gps-active} {gps-signal} {gps-sats} {gps}\","
+							 "\"mode\":\"periodic\",\"lat\":%.7f,\"lon\":%.7f,\"time\":%u,\"max\":25}",
+			 (unsigned int)(card_fixes % 60), lat, lon, card_fix_time);
+}
+
+void Notecard::begin(uint32_t i2c_address, uint32_t i2c_max)
+{
+	(void)i2c_address;
+	(void)i2c_max;
+	if (card_script_len == 0)
+	{
+		card_load_default();
+	}
+}
+
+J *Notecard::newRequest(const char *request)
+{
+	J *req = JCreateObject();
+	if (req != NULL)
+	{
+		JAddStringToObject(req, "req", request);
+	}
+	return req;
+}
+
+J *Notecard::newCommand(const char *request)
+{
+	J *req = JCreateObject();
+	if (req != NULL)
+	{
+		JAddStringToObject(req, "cmd", request);
+	}
+	return req;
+}
+
+/**
+ * @brief Send a request to the simulated NoteCard and wait for the response
+ *        The request is freed, the caller frees the response
+ *
+ * @param req request
+ * @return J* response, NULL if the request could not be sent
+ */
+J *Notecard::requestAndResponse(J *req)
+{
+	if (req == NULL)
+	{
+		return NULL;
+	}
+	g_native_card.transactions++;
+
+	// note-c prints the request into a buffer before it goes over the bus
+	char *request_text = JPrintUnformatted(req);
+	if (request_text == NULL)
+	{
+		JDelete(req);
+		return NULL;
+	}
+	JFree(request_text);
+
+	char request[32];
+	snprintf(request, sizeof(request), "%s", JGetString(req, "req"));
+	int32_t fix_period = -1;
+	if ((strcmp(request, "card.location.mode") == 0) && JHasObjectItem(req, "seconds"))
+	{
+		fix_period = JGetInt(req, "seconds");
+	}
+	JDelete(req);
+
+	static char response[CARD_RESPONSE_SIZE];
+	uint32_t latency_ms = 30;
+	s_card_step *step = card_next_step(request);
+	if (step == NULL)
+	{
+		snprintf(response, sizeof(response), "{\"err\":\"unknown request: %s {bad-req}\"}", request);
+	}
+	else
+	{
+		latency_ms = step->latency_ms;
+		if (step->response[0] != 0)
+		{
+			snprintf(response, sizeof(response), "%s", step->response);
+		}
+		else if ((strcmp(request, "card.location") == 0) || (strcmp(request, "card.time") == 0))
+		{
+			card_location_response(request, response, sizeof(response));
+		}
+		else
+		{
+			snprintf(response, sizeof(response), "{}");
+		}
+	}
+	if (strcmp(request, "note.add") == 0)
+	{
+		g_native_card.notes++;
+	}
+	else if (strcmp(request, "card.location.mode") == 0)
+	{
+		// GNSS period of the request, or of the scripted mode
+		const char *seconds = strstr(response, "\"seconds\":");
+		if (fix_period >= 0)
+		{
+			card_fix_period = fix_period;
+		}
+		else if (seconds != NULL)
+		{
+			card_fix_period = strtoul(seconds + 10, NULL, 10);
+		}
+	}
+	else if (strcmp(request, "hub.sync") == 0)
+	{
+		g_native_card.syncs++;
+	}
+	if (strstr(response, "\"err\"") != NULL)
+	{
+		g_native_card.errors++;
+	}
+
+	// I2C transfer and processing time on the NoteCard
+	if (latency_ms != 0)
+	{
+		delay(latency_ms);
+	}
+	return JParse(response);
+}
+
+bool Notecard::sendRequest(J *req)
+{
+	J *rsp = requestAndResponse(req);
+	bool result = (rsp != NULL) && !JIsPresent(rsp, "err");
+	JDelete(rsp);
+	return result;
+}
+
+void Notecard::deleteResponse(J *rsp)
+{
+	JDelete(rsp);
+}
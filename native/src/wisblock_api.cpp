@@ -0,0 +1,482 @@
+/**
+ * @file wisblock_api.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief App loop, LoRaWAN, AT commands and Cayenne LPP of the WisBlock API for the native build
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <WisBlock-API-V2.h>
+#include "native.h"
+#include <stdarg.h>
+
+// Application functions, same as for the library
+void setup_app(void);
+bool init_app(void);
+void app_event_handler(void);
+void ble_data_handler(void) __attribute__((weak));
+void lora_data_handler(void);
+
+volatile uint16_t g_task_event_type = 0;
+s_lorawan_settings g_lorawan_settings;
+bool g_enable_ble = false;
+bool g_lpwan_has_joined = false;
+bool g_join_result = false;
+bool g_rx_fin_result = false;
+uint8_t g_rx_lora_data[256];
+uint16_t g_rx_data_len = 0;
+int16_t g_last_rssi = 0;
+int8_t g_last_snr = 0;
+bool g_ble_uart_is_connected = false;
+BLEUart g_ble_uart;
+char g_at_query_buf[ATQUERY_SIZE];
+
+/** Simulated network, ACKs every packet after 1.5 seconds */
+s_native_lora g_native_lora = {true, 6000, 1500, 0, -85, 8, 4000.0, 0, 0, 0};
+
+/** Semaphore of the app loop */
+static SemaphoreHandle_t task_sem = NULL;
+
+/** Timer for the STATUS events */
+static SoftwareTimer app_timer;
+
+/** Timer for the end of a TX cycle */
+static SoftwareTimer tx_timer;
+
+/** Timer for the join accept */
+static SoftwareTimer join_timer;
+
+/** TX cycle is running */
+static bool tx_busy = false;
+
+/** Confirmed packets since start, used for the NAK pattern */
+static uint32_t tx_confirmed = 0;
+
+int BLEUart::printf(const char *format, ...)
+{
+	// No BLE central is connected
+	(void)format;
+	return 0;
+}
+
+size_t BLEUart::write(const uint8_t *data, size_t len)
+{
+	(void)data;
+	return len;
+}
+
+void api_set_version(uint16_t sw_1, uint16_t sw_2, uint16_t sw_3)
+{
+	(void)sw_1;
+	(void)sw_2;
+	(void)sw_3;
+}
+
+void api_reset(void)
+{
+	native_fatal("App requested a reset");
+}
+
+void api_wake_loop(uint16_t reason)
+{
+	g_task_event_type |= reason;
+	if (task_sem != NULL)
+	{
+		xSemaphoreGive(task_sem);
+	}
+}
+
+/**
+ * @brief Timer callback for the STATUS event
+ *
+ */
+static void app_timer_cb(TimerHandle_t unused)
+{
+	(void)unused;
+	api_wake_loop(STATUS);
+}
+
+void api_timer_init(void)
+{
+	app_timer.begin(g_lorawan_settings.send_repeat_time, app_timer_cb, NULL, true);
+}
+
+void api_timer_start(void)
+{
+	if (g_lorawan_settings.send_repeat_time != 0)
+	{
+		app_timer.setPeriod(g_lorawan_settings.send_repeat_time);
+		app_timer.start();
+	}
+}
+
+void api_timer_stop(void)
+{
+	app_timer.stop();
+}
+
+void api_timer_restart(uint32_t new_time)
+{
+	app_timer.stop();
+	if (new_time != 0)
+	{
+		app_timer.setPeriod(new_time);
+		app_timer.start();
+	}
+}
+
+float read_batt(void)
+{
+	return g_native_lora.batt_mv;
+}
+
+void restart_advertising(uint16_t timeout)
+{
+	(void)timeout;
+}
+
+/**
+ * @brief Timer callback for the join accept
+ *
+ */
+static void join_timer_cb(TimerHandle_t unused)
+{
+	(void)unused;
+	g_join_result = g_native_lora.join_accept;
+	g_lpwan_has_joined = g_native_lora.join_accept;
+	api_wake_loop(LORA_JOIN_FIN);
+}
+
+/**
+ * @brief Timer callback for the end of a TX cycle
+ *        Confirmed packets are ACKed unless the NAK pattern says otherwise
+ *
+ */
+static void tx_timer_cb(TimerHandle_t unused)
+{
+	(void)unused;
+	tx_busy = false;
+	bool acked = true;
+	if (g_lorawan_settings.confirmed_msg_enabled)
+	{
+		tx_confirmed++;
+		acked = (g_native_lora.nak_every == 0) || ((tx_confirmed % g_native_lora.nak_every) != 0);
+	}
+	if (!acked)
+	{
+		g_native_lora.naks++;
+	}
+	g_rx_fin_result = acked;
+	g_last_rssi = g_native_lora.rssi;
+	g_last_snr = g_native_lora.snr;
+	api_wake_loop(LORA_TX_FIN);
+}
+
+int8_t init_lorawan(void)
+{
+	static bool timers_ready = false;
+	if (!timers_ready)
+	{
+		tx_timer.begin(g_native_lora.tx_ms, tx_timer_cb, NULL, false);
+		join_timer.begin(g_native_lora.join_ms, join_timer_cb, NULL, false);
+		timers_ready = true;
+	}
+	if (g_lorawan_settings.auto_join)
+	{
+		lmh_join();
+	}
+	return 0;
+}
+
+int8_t re_init_lorawan(void)
+{
+	return 0;
+}
+
+lmh_error_status lmh_join(void)
+{
+	g_lpwan_has_joined = false;
+	join_timer.stop();
+	join_timer.setPeriod(g_native_lora.join_ms);
+	join_timer.start();
+	return LMH_SUCCESS;
+}
+
+/**
+ * @brief Maximum payload size of the current data rate
+ *
+ * @return uint8_t payload size in bytes
+ */
+static uint8_t lora_dr_payload(void)
+{
+	static const uint8_t eu868[] = {51, 51, 51, 115, 242, 242, 242, 242};
+	static const uint8_t us915[] = {11, 53, 125, 242, 242};
+	if (g_lorawan_settings.lora_region == LORAMAC_REGION_US915)
+	{
+		return us915[g_lorawan_settings.data_rate < sizeof(us915) ? g_lorawan_settings.data_rate : sizeof(us915) - 1];
+	}
+	return eu868[g_lorawan_settings.data_rate < sizeof(eu868) ? g_lorawan_settings.data_rate : sizeof(eu868) - 1];
+}
+
+LoRaMacStatus_t LoRaMacQueryTxPossible(uint8_t size, LoRaMacTxInfo_t *tx_info)
+{
+	tx_info->MaxPossiblePayload = lora_dr_payload();
+	tx_info->CurrentPayloadSize = lora_dr_payload();
+	return size > tx_info->MaxPossiblePayload ? LORAMAC_STATUS_LENGTH_ERROR : LORAMAC_STATUS_OK;
+}
+
+lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport)
+{
+	(void)data;
+	(void)fport;
+	if (!g_lpwan_has_joined || (size > lora_dr_payload()))
+	{
+		return LMH_ERROR;
+	}
+	if (tx_busy)
+	{
+		return LMH_BUSY;
+	}
+	tx_busy = true;
+	g_native_lora.packets++;
+	g_native_lora.bytes += size;
+	tx_timer.stop();
+	tx_timer.setPeriod(g_native_lora.tx_ms);
+	tx_timer.start();
+	return LMH_SUCCESS;
+}
+
+bool send_p2p_packet(uint8_t *data, uint8_t size)
+{
+	(void)data;
+	(void)size;
+	return true;
+}
+
+/** Length of an AT command line */
+#define AT_LINE_SIZE 256
+
+/** AT command line that is received */
+static char at_line[AT_LINE_SIZE];
+
+/** Length of the received AT command line */
+static uint16_t at_line_len = 0;
+
+/**
+ * @brief Execute one AT command of the user command list
+ *        Only the user commands are available on the host
+ *
+ * @param command AT command, e.g. AT+BTRACK=20
+ * @return true if the command returned AT_SUCCESS
+ * @return false if the command is unknown or failed
+ */
+bool native_at_command(const char *command)
+{
+	char line[AT_LINE_SIZE];
+	snprintf(line, sizeof(line), "%s", command);
+	if (strncasecmp(line, "AT", 2) != 0)
+	{
+		AT_PRINTF("+CME ERROR:%d", AT_ERROR);
+		return false;
+	}
+	// The commands of the app are sent as ATC+<name>
+	char *name = strncasecmp(line, "ATC+", 4) == 0 ? &line[3] : &line[2];
+	char *param = strpbrk(name, "=?");
+	char separator = param == NULL ? 0 : *param;
+	if (param != NULL)
+	{
+		*param++ = 0;
+	}
+
+	for (uint8_t idx = 0; idx < g_user_at_cmd_num; idx++)
+	{
+		atcmd_t *cmd = &g_user_at_cmd_list[idx];
+		if (strcasecmp(name, cmd->cmd_name) != 0)
+		{
+			continue;
+		}
+		int result = AT_ERRNO_NOSUPP;
+		if ((separator == '?') || ((separator == '=') && (strcmp(param, "?") == 0)))
+		{
+			if (separator == '=')
+			{
+				AT_PRINTF("ATC%s: %s", cmd->cmd_name, cmd->cmd_desc);
+				result = AT_SUCCESS;
+			}
+			else if (cmd->query_cmd != NULL)
+			{
+				g_at_query_buf[0] = 0;
+				result = cmd->query_cmd();
+				if (result == AT_SUCCESS)
+				{
+					AT_PRINTF("ATC%s=%s", cmd->cmd_name, g_at_query_buf);
+				}
+			}
+		}
+		else if (separator == '=')
+		{
+			if (cmd->exec_cmd != NULL)
+			{
+				result = cmd->exec_cmd(param);
+			}
+		}
+		else if (cmd->exec_cmd_no_para != NULL)
+		{
+			result = cmd->exec_cmd_no_para();
+		}
+		if (result == AT_SUCCESS)
+		{
+			AT_PRINTF("OK");
+			return true;
+		}
+		AT_PRINTF("+CME ERROR:%d", result);
+		return false;
+	}
+	AT_PRINTF("+CME ERROR:%d", AT_ERRNO_NOSUPP);
+	return false;
+}
+
+void at_serial_input(uint8_t cmd)
+{
+	if ((cmd == '\r') || (cmd == '\n'))
+	{
+		if (at_line_len != 0)
+		{
+			at_line[at_line_len] = 0;
+			native_at_command(at_line);
+		}
+		at_line_len = 0;
+		return;
+	}
+	if (at_line_len < (AT_LINE_SIZE - 1))
+	{
+		at_line[at_line_len++] = (char)cmd;
+	}
+}
+
+/**
+ * @brief Start the app like setup() of the library
+ *        LoRaWAN is started and the join is requested, the first STATUS event comes from init_app
+ *
+ */
+void native_api_setup(void)
+{
+	task_sem = xSemaphoreCreateBinary();
+
+	setup_app();
+
+	api_timer_init();
+
+	if (g_lorawan_settings.lorawan_enable && g_lorawan_settings.auto_join)
+	{
+		init_lorawan();
+	}
+
+	if (!init_app())
+	{
+		native_fatal("init_app failed");
+	}
+}
+
+/**
+ * @brief Wait for events and call the handlers like loop() of the library
+ *        Returns after all events are handled
+ *
+ */
+void native_api_loop(void)
+{
+	xSemaphoreTake(task_sem, portMAX_DELAY);
+
+	while (g_task_event_type != 0)
+	{
+		uint16_t events = g_task_event_type;
+		if (g_lorawan_settings.lorawan_enable)
+		{
+			lora_data_handler();
+		}
+		if (((g_task_event_type & BLE_DATA) == BLE_DATA) && (ble_data_handler != NULL))
+		{
+			ble_data_handler();
+		}
+		app_event_handler();
+
+		if (g_task_event_type == events)
+		{
+			// Nobody handles these events, the device would stay awake forever
+			native_fatal("Unhandled events 0x%04X", events);
+		}
+	}
+}
+
+/**
+ * @brief Create the payload buffer
+ *
+ * @param size size of the buffer
+ */
+CayenneLPP::CayenneLPP(uint8_t size) : _maxsize(size)
+{
+	_buffer = (uint8_t *)malloc(size);
+	_cursor = 0;
+}
+
+CayenneLPP::~CayenneLPP()
+{
+	free(_buffer);
+}
+
+void CayenneLPP::reset(void)
+{
+	_cursor = 0;
+}
+
+uint8_t CayenneLPP::getSize(void)
+{
+	return _cursor;
+}
+
+uint8_t *CayenneLPP::getBuffer(void)
+{
+	return _buffer;
+}
+
+uint8_t WisCayenne::addGNSS_6(uint8_t channel, int32_t latitude, int32_t longitude, int32_t altitude)
+{
+	if ((_cursor + LPP_GPS6_SIZE + 2) > _maxsize)
+	{
+		return 0;
+	}
+	// 0.000001 degree and 0.01 m resolution
+	int32_t lat = latitude / 10;
+	int32_t lon = longitude / 10;
+	int32_t alt = altitude / 10;
+
+	_buffer[_cursor++] = channel;
+	_buffer[_cursor++] = LPP_GPS6;
+	_buffer[_cursor++] = lat >> 24;
+	_buffer[_cursor++] = lat >> 16;
+	_buffer[_cursor++] = lat >> 8;
+	_buffer[_cursor++] = lat;
+	_buffer[_cursor++] = lon >> 24;
+	_buffer[_cursor++] = lon >> 16;
+	_buffer[_cursor++] = lon >> 8;
+	_buffer[_cursor++] = lon;
+	_buffer[_cursor++] = alt >> 16;
+	_buffer[_cursor++] = alt >> 8;
+	_buffer[_cursor++] = alt;
+	return _cursor;
+}
+
+uint8_t WisCayenne::addDevID(uint8_t channel, uint8_t *dev_id)
+{
+	if ((_cursor + LPP_DEVID_SIZE + 2) > _maxsize)
+	{
+		return 0;
+	}
+	_buffer[_cursor++] = channel;
+	_buffer[_cursor++] = LPP_DEVID;
+	memcpy(&_buffer[_cursor], dev_id, LPP_DEVID_SIZE);
+	_cursor += LPP_DEVID_SIZE;
+	return _cursor;
+}
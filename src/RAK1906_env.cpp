@@ -23,6 +23,27 @@ float _last_humid_rak1906 = 0;
 /** Last pressure read */
 float _last_pressure_rak1906 = 0;
 
+/** Timer to collect the result when the conversion is finished */
+SoftwareTimer bme_ready_timer;
+
+/** STATUS cycle of the running conversion */
+static volatile uint32_t bme_start_cycle = 0;
+
+/** STATUS cycle of the conversion that sent the last BME_DONE */
+static volatile uint32_t bme_done_cycle = 0;
+
+/**
+ * @brief Wake up the app handler when the BME680 conversion is finished
+ *
+ * @param unused
+ */
+void bme_ready_cb(TimerHandle_t unused)
+{
+	(void)unused;
+	bme_done_cycle = bme_start_cycle;
+	api_wake_loop(BME_DONE);
+}
+
 /**
  * @brief Initialize the BME680 sensor
  *
@@ -48,14 +69,60 @@ bool init_rak1906(void)
 	// As we do not use the BSEC library here, the gas value is useless and just consumes battery. Better to switch it off
 	bme.setGasHeater(0, 0); // switch off
 
+	bme_ready_timer.begin(100, bme_ready_cb, NULL, false);
+
 	return true;
 }
 
 /**
- * @brief Read environment data from BME680
+ * @brief Start a BME680 conversion
+ *     The conversion time depends on the oversampling settings,
+ *     the BME_DONE event is sent when the values are ready
+ *
+ * @param cycle STATUS cycle that gets the values
+ * @return true if the conversion was started
+ * @return false if the sensor did not respond
+ */
+bool start_rak1906(uint32_t cycle)
+{
+	MYLOG("BME", "Start BME reading");
+	uint32_t ready_time = bme.beginReading();
+	if (ready_time == 0)
+	{
+		MYLOG("BME", "BME start failed");
+		return false;
+	}
+	// Only conversions that were started are measured
+	timing_start(TIMING_BME);
+
+	int32_t wait_time = (int32_t)(ready_time - millis());
+	if (wait_time < 1)
+	{
+		wait_time = 1;
+	}
+	// Changing the period starts the timer as well
+	bme_ready_timer.stop();
+	bme_start_cycle = cycle;
+	bme_ready_timer.setPeriod(wait_time);
+	return true;
+}
+
+/**
+ * @brief Get the STATUS cycle of the conversion that sent the last BME_DONE
+ *     A BME_DONE of a cycle that was already sent must not add values to the next packet
+ *
+ * @return uint32_t STATUS cycle given to start_rak1906()
+ */
+uint32_t rak1906_done_cycle(void)
+{
+	return bme_done_cycle;
+}
+
+/**
+ * @brief Read environment data from BME680 after the conversion finished
  *     Data is added to Cayenne LPP payload as channels
- *     LPP_CHANNEL_HUMID_2, LPP_CHANNEL_TEMP_2,
- *     LPP_CHANNEL_PRESS_2 and LPP_CHANNEL_GAS_2
+ *     PAYLOAD_CH_HUMID_2, PAYLOAD_CH_TEMP_2 and
+ *     PAYLOAD_CH_PRESS_2
  *
  *
  * @return true if reading was successful
@@ -63,22 +130,12 @@ bool init_rak1906(void)
  */
 bool read_rak1906()
 {
-	MYLOG("BME", "Start BME reading");
-	bme.beginReading();
-	time_t wait_start = millis();
-	bool read_success = false;
-	while ((millis() - wait_start) < 5000)
+	// Conversion was started with start_rak1906(), this only waits if the timer fired early
+	bool result = bme.endReading();
+	timing_end(TIMING_BME);
+	if (!result)
 	{
-		if (bme.endReading())
-		{
-			read_success = true;
-			break;
-		}
-	}
-
-	if (!read_success)
-	{
-		MYLOG("BME", "BME timeout");
+		MYLOG("BME", "BME read failed");
 		return false;
 	}
 
@@ -86,15 +143,15 @@ bool read_rak1906()
 	_last_humid_rak1906 = bme.humidity;
 	_last_pressure_rak1906 = (float)(bme.pressure) / 100.0;
 
-	g_solution_data.addRelativeHumidity(LPP_CHANNEL_HUMID_2, _last_humid_rak1906);
-	g_solution_data.addTemperature(LPP_CHANNEL_TEMP_2, _last_temp_rak1906);
-	g_solution_data.addBarometricPressure(LPP_CHANNEL_PRESS_2, _last_pressure_rak1906);
+	g_solution_data.addField<PayloadField_HUMID_2>(_last_humid_rak1906);
+	g_solution_data.addField<PayloadField_TEMP_2>(_last_temp_rak1906);
+	g_solution_data.addField<PayloadField_PRESS_2>(_last_pressure_rak1906);
 
 #if MY_DEBUG > 0
 	MYLOG("BME", "RH= %.2f T= %.2f P= %.3f", bme.humidity, bme.temperature, (float)(bme.pressure) / 100.0);
 #endif
 
-		return true;
+	return true;
 }
 
 /**
@@ -14,7 +14,9 @@
 
 // Function declarations
 bool init_rak1906(void);
+bool start_rak1906(uint32_t cycle);
 bool read_rak1906(void);
+uint32_t rak1906_done_cycle(void);
 void get_rak1906_values(float *values);
 
 #endif // RAK1906_H
\ No newline at end of file
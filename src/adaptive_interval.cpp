@@ -0,0 +1,190 @@
+/**
+ * @file adaptive_interval.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Shorten the send interval while the device moves, back off while it is parked
+ * @version 0.1
+ * @date 2023-09-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Speed in m/s above which the device counts as moving */
+#define INTERVAL_SPEED_MOVING 1.0
+
+/** Distance in m between two fixes that is treated as GNSS noise */
+#define INTERVAL_GNSS_NOISE 25.0
+
+/** Mean earth radius in m */
+#define EARTH_RADIUS 6371000.0
+
+/** State of the adaptive send interval */
+s_interval_state g_interval_state;
+
+/** Motion events reported by the NoteCard in the last cycle, -1 if unknown */
+static volatile int32_t interval_motion = -1;
+
+/**
+ * @brief Distance between two locations
+ *        Equirectangular approximation, good enough for the distances between two fixes
+ *
+ * @param lat_1 latitude of the first location in degrees
+ * @param lon_1 longitude of the first location in degrees
+ * @param lat_2 latitude of the second location in degrees
+ * @param lon_2 longitude of the second location in degrees
+ * @return float distance in m
+ */
+float interval_distance(float lat_1, float lon_1, float lat_2, float lon_2)
+{
+	float x = (lon_2 - lon_1) * DEG_TO_RAD * cosf((lat_1 + lat_2) * 0.5 * DEG_TO_RAD);
+	float y = (lat_2 - lat_1) * DEG_TO_RAD;
+	return sqrtf(x * x + y * y) * EARTH_RADIUS;
+}
+
+/**
+ * @brief Check if the adaptive interval is enabled
+ *
+ * @return true if the interval is adapted to the motion
+ * @return false if the fixed interval of AT+SENDINT is used
+ */
+bool interval_is_adaptive(void)
+{
+	return (g_blues_settings.min_interval != 0) && (g_lorawan_settings.send_repeat_time != 0);
+}
+
+/**
+ * @brief Get the send interval that is used right now
+ *
+ * @return uint32_t send interval in milliseconds
+ */
+uint32_t interval_current(void)
+{
+	if (!interval_is_adaptive() || (g_interval_state.interval_ms == 0))
+	{
+		return g_lorawan_settings.send_repeat_time;
+	}
+	return g_interval_state.interval_ms;
+}
+
+/**
+ * @brief Remember the motion count of the NoteCard
+ *        Called from the NoteCard task
+ *
+ * @param count motion events since the last request, -1 if unknown
+ */
+void interval_set_motion(int32_t count)
+{
+	interval_motion = count;
+}
+
+/**
+ * @brief Restart the application timer if the interval changed
+ *
+ * @param interval_ms new send interval in milliseconds
+ */
+static void interval_apply(uint32_t interval_ms)
+{
+	if (interval_ms == g_interval_state.interval_ms)
+	{
+		return;
+	}
+	MYLOG("INTV", "Send interval %ld s", interval_ms / 1000);
+	g_interval_state.interval_ms = interval_ms;
+	api_timer_restart(interval_ms);
+}
+
+/**
+ * @brief Adapt the send interval after a STATUS cycle
+ *        The device is moving if the NoteCard counted motion events or if the
+ *        speed between the last two GNSS fixes is above INTERVAL_SPEED_MOVING.
+ *        While moving the shortest interval is used, while stationary the
+ *        interval is doubled every cycle up to the longest interval.
+ *
+ */
+void interval_update(void)
+{
+	if (!interval_is_adaptive())
+	{
+		return;
+	}
+
+	bool moving = interval_motion > 0;
+	interval_motion = -1;
+
+	// Speed from successive GNSS fixes
+	s_location location;
+	blues_get_location(&location);
+	if ((location.source == LOC_SRC_GNSS) && (location.fix_time != g_interval_state.last_fix_time))
+	{
+		if (g_interval_state.last_fix_time != 0)
+		{
+			float distance = interval_distance(g_interval_state.last_latitude, g_interval_state.last_longitude,
+											   location.latitude, location.longitude);
+			uint32_t fix_delta = location.fix_time - g_interval_state.last_fix_time;
+			g_interval_state.speed = fix_delta == 0 ? 0.0 : distance / fix_delta;
+			if ((distance > INTERVAL_GNSS_NOISE) && (g_interval_state.speed > INTERVAL_SPEED_MOVING))
+			{
+				moving = true;
+			}
+		}
+		g_interval_state.last_latitude = location.latitude;
+		g_interval_state.last_longitude = location.longitude;
+		g_interval_state.last_fix_time = location.fix_time;
+	}
+
+	uint32_t min_ms = g_blues_settings.min_interval * 1000;
+	uint32_t max_ms = g_blues_settings.max_interval * 1000;
+	uint32_t interval_ms;
+	if (moving)
+	{
+		g_interval_state.still_cycles = 0;
+		interval_ms = min_ms;
+	}
+	else
+	{
+		// Exponential back-off while the device is parked
+		if (g_interval_state.still_cycles < 16)
+		{
+			g_interval_state.still_cycles++;
+		}
+		if (min_ms > (max_ms >> g_interval_state.still_cycles))
+		{
+			interval_ms = max_ms;
+		}
+		else
+		{
+			interval_ms = min_ms << g_interval_state.still_cycles;
+		}
+	}
+	g_interval_state.moving = moving;
+	interval_apply(interval_ms);
+}
+
+/**
+ * @brief Switch to the shortest interval after a motion alert of the NoteCard
+ *
+ */
+void interval_motion_event(void)
+{
+	if (!interval_is_adaptive())
+	{
+		return;
+	}
+	g_interval_state.still_cycles = 0;
+	g_interval_state.moving = true;
+	interval_apply(g_blues_settings.min_interval * 1000);
+}
+
+/**
+ * @brief Go back to the fixed interval of AT+SENDINT
+ *
+ */
+void interval_reset(void)
+{
+	memset((void *)&g_interval_state, 0, sizeof(s_interval_state));
+	if (g_lorawan_settings.send_repeat_time != 0)
+	{
+		api_timer_restart(g_lorawan_settings.send_repeat_time);
+	}
+}
@@ -22,48 +22,704 @@ Notecard notecard;
 /** Callback for ATTN signal */
 void blues_attn_cb(void);
 
-/** JSON request to NoteCard */
-J *req;
+static bool blues_set_attn(const char *mode);
 
-/** Buffer for response (if used beside of debug output) */
-char blues_response[8192];
+#if MY_DEBUG > 0
+/** Size of the buffer for debug output of requests and responses */
+#define BLUES_TRACE_SIZE 512
 
-/** Buffer for request */
-uint8_t fixed_req[8192] = {0};
+/** Buffer for debug output, only used while the bus mutex is taken */
+static char blues_trace_buf[BLUES_TRACE_SIZE];
 
-volatile uint8_t *malloc_ptr = fixed_req;
+/**
+ * @brief Log a JSON object without heap allocation
+ *        Objects that do not fit into the trace buffer are not printed
+ */
+#define BLUES_TRACE(label, json)                                                       \
+	do                                                                                 \
+	{                                                                                  \
+		if (JPrintPreallocated(json, blues_trace_buf, sizeof(blues_trace_buf), false)) \
+		{                                                                              \
+			MYLOG("BLUES", "%s = %s", label, blues_trace_buf);                         \
+		}                                                                              \
+		else                                                                           \
+		{                                                                              \
+			MYLOG("BLUES", "%s too large to log", label);                              \
+		}                                                                              \
+	} while (0)
+#else
+#define BLUES_TRACE(...)
+#endif
+
+/**
+ * Size of the arena for the NoteCard JSON objects of one request cycle
+ * The soak test peaks at 1080 bytes, larger requests like AT+BREQ fall back to the heap
+ */
+#define BLUES_ARENA_SIZE 2048
+
+/** Alignment of arena blocks, J objects contain doubles */
+#define BLUES_ARENA_ALIGN 8
+
+/** Flag in the block header size field for blocks that were freed */
+#define BLUES_ARENA_FREED 0x80000000
+
+/** Header in front of each arena block */
+struct s_arena_block
+{
+	uint32_t prev_top; // Arena offset of the block below this one
+	uint32_t size;	   // Size of the block including header, BLUES_ARENA_FREED if freed
+};
+
+/** Arena for NoteCard requests and responses */
+static uint8_t blues_arena[BLUES_ARENA_SIZE] __attribute__((aligned(BLUES_ARENA_ALIGN)));
+
+/** Offset of the first free byte in the arena */
+static uint32_t arena_used = 0;
+
+/** Offset of the top most block in the arena */
+static uint32_t arena_top = 0;
+
+/** Number of blocks in the arena that are not freed */
+static uint16_t arena_live = 0;
+
+/** Arena usage statistics */
+s_arena_stats g_arena_stats;
+
+/**
+ * @brief Allocate memory for the NoteCard library from the arena
+ *        Falls back to the heap if the arena is exhausted
+ *
+ * @param size requested size in bytes
+ * @return void* pointer to the memory, NULL if no memory is available
+ */
+static void *blues_arena_alloc(size_t size)
+{
+	uint32_t block_size = (sizeof(s_arena_block) + size + BLUES_ARENA_ALIGN - 1) & ~(BLUES_ARENA_ALIGN - 1);
+
+	// Requests of different tasks can be built at the same time
+	taskENTER_CRITICAL();
+	if ((size >= BLUES_ARENA_SIZE) || (arena_used + block_size > BLUES_ARENA_SIZE))
+	{
+		g_arena_stats.heap_fallbacks++;
+		taskEXIT_CRITICAL();
+		return malloc(size);
+	}
+
+	s_arena_block *block = (s_arena_block *)&blues_arena[arena_used];
+	block->prev_top = arena_top;
+	block->size = block_size;
+	arena_top = arena_used;
+	arena_used += block_size;
+	arena_live++;
+
+	if (arena_used > g_arena_stats.high_water_mark)
+	{
+		g_arena_stats.high_water_mark = arena_used;
+	}
+	void *ptr = (void *)&blues_arena[arena_top + sizeof(s_arena_block)];
+	taskEXIT_CRITICAL();
+	return ptr;
+}
+
+/**
+ * @brief Check if an arena offset is the header of an allocated block
+ *        Pointers from before an arena reset can point into a newer block,
+ *        only offsets on the block chain are accepted.
+ *        Call it inside the critical section.
+ *
+ * @param offset arena offset of the block header
+ * @return true if a block starts at the offset
+ * @return false if the offset is not on the block chain
+ */
+static bool blues_arena_is_block(uint32_t offset)
+{
+	if (offset >= arena_used)
+	{
+		return false;
+	}
+	uint32_t block_offset = arena_top;
+	while (block_offset > offset)
+	{
+		block_offset = ((s_arena_block *)&blues_arena[block_offset])->prev_top;
+	}
+	return block_offset == offset;
+}
+
+/**
+ * @brief Release memory allocated with blues_arena_alloc
+ *        Blocks are only reclaimed if they are on top of the arena,
+ *        everything else is released in bulk by blues_arena_reset
+ *
+ * @param ptr pointer to the memory
+ */
+static void blues_arena_free(void *ptr)
+{
+	if (ptr == NULL)
+	{
+		return;
+	}
+	if (((uint8_t *)ptr < blues_arena) || ((uint8_t *)ptr >= &blues_arena[BLUES_ARENA_SIZE]))
+	{
+		free(ptr);
+		return;
+	}
+
+	taskENTER_CRITICAL();
+	uint32_t offset = (uint8_t *)ptr - blues_arena - sizeof(s_arena_block);
+	if (!blues_arena_is_block(offset))
+	{
+		// Block is from before the last arena reset
+		taskEXIT_CRITICAL();
+		return;
+	}
+	s_arena_block *block = (s_arena_block *)&blues_arena[offset];
+	if ((block->size & BLUES_ARENA_FREED) == 0)
+	{
+		block->size |= BLUES_ARENA_FREED;
+		arena_live--;
+	}
+
+	// Pop all freed blocks from the top of the arena
+	while (arena_used != 0)
+	{
+		block = (s_arena_block *)&blues_arena[arena_top];
+		if ((block->size & BLUES_ARENA_FREED) == 0)
+		{
+			break;
+		}
+		arena_used = arena_top;
+		arena_top = block->prev_top;
+	}
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Release all arena memory in bulk
+ *        Only call it when no request context is in use
+ *
+ */
+static void blues_arena_reset(void)
+{
+	g_arena_stats.leaked_blocks += arena_live;
+	arena_used = 0;
+	arena_top = 0;
+	arena_live = 0;
+	g_arena_stats.resets++;
+}
 
-volatile uint32_t used_malloc = 0;
+/**
+ * @brief Delay function for the NoteCard library
+ *
+ * @param ms delay time in milliseconds
+ */
+static void blues_delay(uint32_t ms)
+{
+	delay(ms);
+}
+
+/**
+ * @brief Time function for the NoteCard library
+ *
+ * @return uint32_t milliseconds since start
+ */
+static uint32_t blues_millis(void)
+{
+	return millis();
+}
+
+/** Time to wait for the NoteCard if another task is using it */
+#define BLUES_BUS_TIMEOUT 5000
+
+/** Mutex for the NoteCard, the app handler and the NoteCard task share it */
+static SemaphoreHandle_t blues_bus_mutex = NULL;
+
+/** Number of request contexts */
+#define BLUES_REQ_POOL 4
+
+/** States of a request context */
+#define BLUES_CTX_FREE 0	 // Context can be used
+#define BLUES_CTX_BUILDING 1 // Request is created and filled
+#define BLUES_CTX_SENT 2	 // Request was sent, response is available
+
+/** Context of one NoteCard request */
+struct s_blues_req_ctx
+{
+	J *req;			  // Request while it is built
+	J *rsp;			  // Response after the request was sent
+	uint8_t state;	  // BLUES_CTX_FREE, BLUES_CTX_BUILDING or BLUES_CTX_SENT
+	uint8_t priority; // BLUES_PRIO_LOW or BLUES_PRIO_HIGH
+};
+
+/** Pool of request contexts, the last one is reserved for high priority requests */
+static s_blues_req_ctx req_pool[BLUES_REQ_POOL];
+
+/** Number of high priority requests waiting for the NoteCard, changed by several tasks */
+static volatile uint8_t high_prio_waiting = 0;
+
+/** Maximum payload length of the data.qo note template */
+#define BLUES_TEMPLATE_PAYLOAD_LEN 128
+
+/** Flag if the note template for data.qo was accepted by the NoteCard */
+bool blues_template_active = false;
+
+/**
+ * @brief Send a request to the NoteCard and wait for the response
+ *        Counts the bus transaction for the cycle statistics
+ *
+ * @param request JSON request to send, freed by the NoteCard library
+ * @return J* response, NULL if the transaction failed
+ */
+static J *blues_transaction(J *request)
+{
+	J *rsp = notecard.requestAndResponse(request);
+	cycle_stats_bus_transaction();
+	return rsp;
+}
+
+/**
+ * @brief Create a request in a free context of the pool
+ *        Low priority requests cannot use the last context, so the data path
+ *        always finds a free context
+ *
+ * @param request_name name of request, e.g. card.wireless
+ * @param priority BLUES_PRIO_LOW for status and debug requests, BLUES_PRIO_HIGH for the data path
+ */
+BluesRequest::BluesRequest(const char *request_name, uint8_t priority)
+{
+	_ctx = -1;
+	_priority = priority;
+
+	int8_t usable = priority == BLUES_PRIO_HIGH ? BLUES_REQ_POOL : BLUES_REQ_POOL - 1;
+	taskENTER_CRITICAL();
+	for (int8_t idx = 0; idx < usable; idx++)
+	{
+		if (req_pool[idx].state == BLUES_CTX_FREE)
+		{
+			req_pool[idx].state = BLUES_CTX_BUILDING;
+			req_pool[idx].priority = priority;
+			req_pool[idx].req = NULL;
+			req_pool[idx].rsp = NULL;
+			_ctx = idx;
+			break;
+		}
+	}
+	taskEXIT_CRITICAL();
+
+	if (_ctx < 0)
+	{
+		MYLOG("BLUES", "No free request context for %s", request_name);
+		return;
+	}
+
+	req_pool[_ctx].req = notecard.newRequest(request_name);
+	if (req_pool[_ctx].req == NULL)
+	{
+		MYLOG("BLUES", "Create request failed");
+		release();
+	}
+}
+
+/**
+ * @brief Free the request and its response
+ *
+ */
+BluesRequest::~BluesRequest()
+{
+	release();
+}
+
+/**
+ * @brief Get the request to add parameters
+ *
+ * @return J* request, NULL if the request could not be created or was sent already
+ */
+J *BluesRequest::json(void)
+{
+	if ((_ctx < 0) || (req_pool[_ctx].state != BLUES_CTX_BUILDING))
+	{
+		return NULL;
+	}
+	return req_pool[_ctx].req;
+}
+
+/**
+ * @brief Get the response after the request was sent
+ *
+ * @return J* response, NULL if the request was not sent or failed
+ */
+J *BluesRequest::response(void)
+{
+	if ((_ctx < 0) || (req_pool[_ctx].state != BLUES_CTX_SENT))
+	{
+		return NULL;
+	}
+	return req_pool[_ctx].rsp;
+}
+
+/**
+ * @brief Send the request to the NoteCard.
+ *        Low priority requests wait until all waiting high priority requests are sent.
+ *        The response stays available with response() until the request is destroyed.
+ *
+ * @return true if request could be sent and the response does not have "err"
+ * @return false if request could not be sent or the response did have "err"
+ */
+bool BluesRequest::send(void)
+{
+	J *req = json();
+	if (req == NULL)
+	{
+		return false;
+	}
+	if (blues_bus_mutex == NULL)
+	{
+		MYLOG("BLUES", "NoteCard not initialized");
+		return false;
+	}
+
+	uint32_t wait_start = millis();
+	if (_priority == BLUES_PRIO_HIGH)
+	{
+		__atomic_fetch_add(&high_prio_waiting, 1, __ATOMIC_SEQ_CST);
+	}
+	else
+	{
+		// Let the data path go first
+		while ((__atomic_load_n(&high_prio_waiting, __ATOMIC_SEQ_CST) != 0) && ((millis() - wait_start) < BLUES_BUS_TIMEOUT))
+		{
+			delay(10);
+		}
+	}
+
+	// Wait if another task is busy with a request
+	uint32_t waited = millis() - wait_start;
+	bool got_bus = (waited < BLUES_BUS_TIMEOUT) && (xSemaphoreTake(blues_bus_mutex, pdMS_TO_TICKS(BLUES_BUS_TIMEOUT - waited)) == pdTRUE);
+	if (_priority == BLUES_PRIO_HIGH)
+	{
+		__atomic_fetch_sub(&high_prio_waiting, 1, __ATOMIC_SEQ_CST);
+	}
+	if (!got_bus)
+	{
+		MYLOG("BLUES", "NoteCard busy");
+		return false;
+	}
+
+	BLUES_TRACE("Card request", req);
+
+	J *rsp;
+	rsp = blues_transaction(req);
+	// The request is freed by the NoteCard library
+	req_pool[_ctx].req = NULL;
+	req_pool[_ctx].rsp = rsp;
+	req_pool[_ctx].state = BLUES_CTX_SENT;
+
+	if (rsp == NULL)
+	{
+		xSemaphoreGive(blues_bus_mutex);
+		return false;
+	}
+	BLUES_TRACE("Card response", rsp);
+
+	// Only the error field is checked, the response is never printed as a whole
+	if (JIsPresent(rsp, "err"))
+	{
+		char *error_type = JGetString(rsp, "err");
+		MYLOG("BLUES", "Card error response = %s", error_type);
+		diag_note_error(error_type);
+		bool found_memory_fail = strstr(error_type, "insufficient") != NULL;
+		xSemaphoreGive(blues_bus_mutex);
+		if (found_memory_fail)
+		{
+			release();
+			MYLOG("BLUES", "Out of memory, restart WisBlock");
+			diag_reset(DIAG_CAUSE_NOTE_MEMORY);
+		}
+		return false;
+	}
+	xSemaphoreGive(blues_bus_mutex);
+	return true;
+}
+
+/**
+ * @brief Print the response as JSON text, e.g. for an AT command response
+ *
+ * @param buffer buffer for the JSON text
+ * @param size size of the buffer
+ * @return true if the response was printed
+ * @return false if no response is available or it does not fit into the buffer
+ */
+bool BluesRequest::print(char *buffer, int size)
+{
+	J *rsp = response();
+	if (rsp == NULL)
+	{
+		return false;
+	}
+	return JPrintPreallocated(rsp, buffer, size, false);
+}
+
+/**
+ * @brief Free the request or response and return the context to the pool
+ *        If no other context is in use, the arena is released in bulk
+ *
+ */
+void BluesRequest::release(void)
+{
+	if (_ctx < 0)
+	{
+		return;
+	}
+	if (req_pool[_ctx].req != NULL)
+	{
+		JDelete(req_pool[_ctx].req);
+		req_pool[_ctx].req = NULL;
+	}
+	if (req_pool[_ctx].rsp != NULL)
+	{
+		notecard.deleteResponse(req_pool[_ctx].rsp);
+		req_pool[_ctx].rsp = NULL;
+	}
+
+	bool pool_empty = true;
+	taskENTER_CRITICAL();
+	req_pool[_ctx].state = BLUES_CTX_FREE;
+	for (uint8_t idx = 0; idx < BLUES_REQ_POOL; idx++)
+	{
+		if (req_pool[idx].state != BLUES_CTX_FREE)
+		{
+			pool_empty = false;
+			break;
+		}
+	}
+	if (pool_empty)
+	{
+		blues_arena_reset();
+	}
+	taskEXIT_CRITICAL();
+	_ctx = -1;
+}
+
+/**
+ * @brief Send a request without parameters
+ *
+ * @param request_name name of request, e.g. card.version
+ * @param priority BLUES_PRIO_LOW or BLUES_PRIO_HIGH
+ * @return true if request could be sent and the response does not have "err"
+ * @return false if request could not be sent or the response did have "err"
+ */
+bool blues_simple_req(const char *request_name, uint8_t priority)
+{
+	BluesRequest request(request_name, priority);
+	return request.send();
+}
+
+/**
+ * @brief Set the Product UID, connection mode and sync interval
+ *
+ * @return true if the NoteCard accepted the settings
+ * @return false if the request failed
+ */
+static bool blues_set_hub(void)
+{
+	MYLOG("BLUES", "Set Product ID and connection mode");
+	BluesRequest request("hub.set");
+	J *req = request.json();
+	if (req == NULL)
+	{
+		MYLOG("BLUES", "hub.set request failed");
+		return false;
+	}
+	JAddStringToObject(req, "product", g_blues_settings.product_uid);
+	if (g_blues_settings.conn_continous)
+	{
+		JAddStringToObject(req, "mode", "continuous");
+	}
+	else
+	{
+		JAddStringToObject(req, "mode", "minimum");
+	}
+	// Set sync time to 20 times the sensor read time
+	JAddNumberToObject(req, "seconds", (g_lorawan_settings.send_repeat_time * 20 / 1000));
+	JAddBoolToObject(req, "heartbeat", true);
+
+	if (!request.send())
+	{
+		MYLOG("BLUES", "hub.set request failed");
+		return false;
+	}
+	return true;
+}
+
+/** Period of the GNSS fixes set with card.location.mode in ms, 0 if GNSS is off */
+static uint32_t location_period_ms = 0;
+
+/**
+ * @brief Set the GNSS mode
+ *
+ * @return true if the NoteCard accepted the GNSS mode
+ * @return false if the request failed
+ */
+static bool blues_set_location_mode(void)
+{
+	BluesRequest request("card.location.mode");
+	J *req = request.json();
+	if (req == NULL)
+	{
+		MYLOG("BLUES", "card.location.mode request failed");
+		return false;
+	}
+#if USE_GNSS == 1
+	MYLOG("BLUES", "Set location mode");
+	// Continous GNSS mode
+	// JAddStringToObject(req, "mode", "continous");
+
+	// Periodic GNSS mode
+	JAddStringToObject(req, "mode", "periodic");
+
+	// Set location acquisition time to the sensor read time
+	JAddNumberToObject(req, "seconds", (g_lorawan_settings.send_repeat_time / 2000));
+	JAddBoolToObject(req, "heartbeat", true);
+#else
+	MYLOG("BLUES", "Stop location mode");
+	// GNSS mode off
+	JAddStringToObject(req, "mode", "off");
+#endif
+	if (!request.send())
+	{
+		MYLOG("BLUES", "card.location.mode request failed");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Read the GNSS period from the NoteCard
+ *        Without saved settings the NoteCard keeps its own location mode
+ *
+ */
+static void blues_get_location_period(void)
+{
+	location_period_ms = 0;
+	BluesRequest request("card.location.mode");
+	if (!request.send())
+	{
+		MYLOG("BLUES", "card.location.mode request failed");
+		return;
+	}
+	J *rsp = request.response();
+	if (strcmp(JGetString(rsp, "mode"), "periodic") == 0)
+	{
+		location_period_ms = JGetInt(rsp, "seconds") * 1000;
+	}
+	MYLOG("BLUES", "GNSS period %lu ms", (unsigned long)location_period_ms);
+}
 
 /**
- * @brief Replace malloc with a fixed buffer address return
- * 
- * @param size unused
- * @return void* pointer to pre-allocated buffer
+ * @brief Select eSIM or external SIM and the APN
+ *
+ * @return true if the NoteCard accepted the settings
+ * @return false if the request failed
  */
-void *fixed_alloc(size_t size)
+static bool blues_set_wireless(void)
 {
-	if (size >= 8192)
+	MYLOG("BLUES", "Set APN");
+	// {“req”:”card.wireless”}
+	BluesRequest request("card.wireless");
+	J *req = request.json();
+	if (req == NULL)
+	{
+		MYLOG("BLUES", "card.wireless request failed");
+		return false;
+	}
+	JAddStringToObject(req, "mode", "auto");
+
+	if (g_blues_settings.use_ext_sim)
+	{
+		// USING EXTERNAL SIM CARD
+		JAddStringToObject(req, "apn", g_blues_settings.ext_sim_apn);
+		JAddStringToObject(req, "method", "dual-secondary-primary");
+	}
+	else
+	{
+		// USING BLUES eSIM CARD
+		JAddStringToObject(req, "method", "primary");
+	}
+	if (!request.send())
 	{
-		MYLOG("BLUES","Requested %d bytes", size);
-		return (void *)NULL;
+		MYLOG("BLUES", "card.wireless request failed");
+		return false;
 	}
-	return (void *) fixed_req;
+	return true;
 }
 
+#if IS_V2 == 1
 /**
- * @brief Replace free with a clean of the fixed buffer
- * 
- * @param ptr unused
+ * @brief Setup the WiFi network, only for V2 cards
+ *
+ * @return true if the request could be created
+ * @return false if the request could not be created
  */
-void fixed_free(void * ptr)
+static bool blues_set_wifi(void)
 {
-	memset(fixed_req,0,8182);
-	return;
+	MYLOG("BLUES", "Set WiFi");
+	BluesRequest request("card.wifi");
+	J *req = request.json();
+	if (req == NULL)
+	{
+		MYLOG("BLUES", "card.wifi request failed");
+		return false;
+	}
+	JAddStringToObject(req, "ssid", "-");
+	JAddStringToObject(req, "password", "-");
+	JAddStringToObject(req, "name", "RAK-");
+	JAddStringToObject(req, "org", "RAK-PH");
+	JAddBoolToObject(req, "start", false);
+
+	if (!request.send())
+	{
+		MYLOG("BLUES", "card.wifi request failed");
+	}
+	return true;
 }
+#endif
+
+/**
+ * @brief Register a note template for data.qo
+ *        Templated notes are stored in a compact binary format on the NoteCard
+ *        and are much smaller when they are synced to NoteHub
+ *
+ * @return true if the template was accepted
+ * @return false if the template could not be registered, notes are sent freeform
+ */
+static bool blues_set_template(void)
+{
+	MYLOG("BLUES", "Set note template");
+	BluesRequest request("note.template");
+	J *req = request.json();
+	if (req == NULL)
+	{
+		MYLOG("BLUES", "note.template request failed");
+		return false;
+	}
+	JAddStringToObject(req, "file", "data.qo");
+	J *body = JCreateObject();
+	if (body == NULL)
+	{
+		MYLOG("BLUES", "Error creating template body");
+		return false;
+	}
+	// String fields are defined by a string of the maximum length
+	JAddStringToObject(body, "dev_eui", "0123456789abcdef");
+	JAddItemToObject(req, "body", body);
+	JAddNumberToObject(req, "length", BLUES_TEMPLATE_PAYLOAD_LEN);
 
-/** Flag to avoid multiple note requests sent to the NoteCard */
-bool request_active = false;
+	if (!request.send())
+	{
+		MYLOG("BLUES", "note.template request failed, use freeform notes");
+		return false;
+	}
+	return true;
+}
 
 /**
  * @brief Initialize Blues NoteCard
@@ -73,11 +729,17 @@ bool request_active = false;
  */
 bool init_blues(void)
 {
+	if (blues_bus_mutex == NULL)
+	{
+		blues_bus_mutex = xSemaphoreCreateMutex();
+	}
+
 	Wire.begin();
 
 	notecard.begin();
 
-	// NoteSetFn(fixed_alloc, fixed_free, noteDelay, noteMillis);
+	// Use the request arena instead of the heap for all JSON objects
+	NoteSetFn(blues_arena_alloc, blues_arena_free, blues_delay, blues_millis);
 
 	// notecard.setDebugOutputStream(Serial);
 
@@ -93,76 +755,15 @@ bool init_blues(void)
 			memcpy(g_blues_settings.product_uid, PRODUCT_UID, 33);
 		}
 
-		MYLOG("BLUES", "Set Product ID and connection mode");
-		if (blues_start_req("hub.set"))
-		{
-			JAddStringToObject(req, "product", g_blues_settings.product_uid);
-			if (g_blues_settings.conn_continous)
-			{
-				JAddStringToObject(req, "mode", "continuous");
-			}
-			else
-			{
-				JAddStringToObject(req, "mode", "minimum");
-			}
-			// Set sync time to 20 times the sensor read time
-			JAddNumberToObject(req, "seconds", (g_lorawan_settings.send_repeat_time * 20 / 1000));
-			JAddBoolToObject(req, "heartbeat", true);
-
-			if (!blues_send_req())
-			{
-				MYLOG("BLUES", "hub.set request failed");
-				return false;
-			}
-		}
-		else
+		if (!blues_set_hub())
 		{
-			MYLOG("BLUES", "hub.set request failed");
 			return false;
 		}
 
-#if USE_GNSS == 1
-		MYLOG("BLUES", "Set location mode");
-		if (blues_start_req("card.location.mode"))
-		{
-			// Continous GNSS mode
-			// JAddStringToObject(req, "mode", "continous");
-
-			// Periodic GNSS mode
-			JAddStringToObject(req, "mode", "periodic");
-
-			// Set location acquisition time to the sensor read time
-			JAddNumberToObject(req, "seconds", (g_lorawan_settings.send_repeat_time / 2000));
-			JAddBoolToObject(req, "heartbeat", true);
-			if (!blues_send_req())
-			{
-				MYLOG("BLUES", "card.location.mode request failed");
-				return false;
-			}
-		}
-		else
-		{
-			MYLOG("BLUES", "card.location.mode request failed");
-			return false;
-		}
-#else
-		MYLOG("BLUES", "Stop location mode");
-		if (blues_start_req("card.location.mode"))
+		if (!blues_set_location_mode())
 		{
-			// GNSS mode off
-			JAddStringToObject(req, "mode", "off");
-			if (!blues_send_req())
-			{
-				MYLOG("BLUES", "card.location.mode request failed");
-				return false;
-			}
-		}
-		else
-		{
-			MYLOG("BLUES", "card.location.mode request failed");
 			return false;
 		}
-#endif
 
 		/// \todo reset attn signal needs rework
 		// pinMode(WB_IO5, INPUT);
@@ -188,72 +789,37 @@ bool init_blues(void)
 		// 	return false;
 		// }
 
-		MYLOG("BLUES", "Set APN");
-		// {“req”:”card.wireless”}
-		if (blues_start_req("card.wireless"))
-		{
-			JAddStringToObject(req, "mode", "auto");
-
-			if (g_blues_settings.use_ext_sim)
-			{
-				// USING EXTERNAL SIM CARD
-				JAddStringToObject(req, "apn", g_blues_settings.ext_sim_apn);
-				JAddStringToObject(req, "method", "dual-secondary-primary");
-			}
-			else
-			{
-				// USING BLUES eSIM CARD
-				JAddStringToObject(req, "method", "primary");
-			}
-			if (!blues_send_req())
-			{
-				MYLOG("BLUES", "card.wireless request failed");
-				return false;
-			}
-		}
-		else
+		if (!blues_set_wireless())
 		{
-			MYLOG("BLUES", "card.wireless request failed");
 			return false;
 		}
 
 #if IS_V2 == 1
 		// Only for V2 cards, setup the WiFi network
-		MYLOG("BLUES", "Set WiFi");
-		if (blues_start_req("card.wifi"))
+		if (!blues_set_wifi())
 		{
-			JAddStringToObject(req, "ssid", "-");
-			JAddStringToObject(req, "password", "-");
-			JAddStringToObject(req, "name", "RAK-");
-			JAddStringToObject(req, "org", "RAK-PH");
-			JAddBoolToObject(req, "start", false);
-
-			if (!blues_send_req())
-			{
-				MYLOG("BLUES", "card.wifi request failed");
-			}
-		}
-		else
-		{
-			MYLOG("BLUES", "card.wifi request failed");
 			return false;
 		}
 #endif
 	}
 
+	blues_get_location_period();
+
 	// {"req": "card.version"}
-	if (blues_start_req("card.version"))
+	if (!blues_simple_req("card.version"))
 	{
-		if (!blues_send_req())
-		{
-			MYLOG("BLUES", "card.version request failed");
-		}
+		MYLOG("BLUES", "card.version request failed");
 	}
+
+	// Register the note template for the tracker data
+	blues_template_active = blues_set_template();
 	return true;
 }
 
 /**
  * @brief Send a data packet to NoteHub.IO
+ *        The note is only stored on the NoteCard, the sync with NoteHub
+ *        is requested by the sync scheduler
  *
  * @param data Payload as byte array (CayenneLPP formatted)
  * @param data_len Length of payload
@@ -262,270 +828,295 @@ bool init_blues(void)
  */
 bool blues_send_payload(uint8_t *data, uint16_t data_len)
 {
-	if (blues_start_req("note.add"))
+	StageTimer stage_timer(TIMING_CELL_SEND);
+
+	if (blues_template_active && (data_len > BLUES_TEMPLATE_PAYLOAD_LEN))
 	{
-		JAddStringToObject(req, "file", "data.qo");
-		JAddBoolToObject(req, "sync", true);
-		J *body = JCreateObject();
-		if (body != NULL)
-		{
-			char node_id[24];
-			sprintf(node_id, "%02x%02x%02x%02x%02x%02x%02x%02x",
-					g_lorawan_settings.node_device_eui[0], g_lorawan_settings.node_device_eui[1],
-					g_lorawan_settings.node_device_eui[2], g_lorawan_settings.node_device_eui[3],
-					g_lorawan_settings.node_device_eui[4], g_lorawan_settings.node_device_eui[5],
-					g_lorawan_settings.node_device_eui[6], g_lorawan_settings.node_device_eui[7]);
-			JAddStringToObject(body, "dev_eui", node_id);
+		MYLOG("BLUES", "Payload too large for note template");
+		return false;
+	}
+	BluesRequest request("note.add", BLUES_PRIO_HIGH);
+	J *req = request.json();
+	if (req == NULL)
+	{
+		return false;
+	}
+	JAddStringToObject(req, "file", "data.qo");
+	JAddBoolToObject(req, "sync", false);
+	J *body = JCreateObject();
+	if (body == NULL)
+	{
+		MYLOG("BLUES", "Error creating body");
+		return false;
+	}
+	char node_id[24];
+	sprintf(node_id, "%02x%02x%02x%02x%02x%02x%02x%02x",
+			g_lorawan_settings.node_device_eui[0], g_lorawan_settings.node_device_eui[1],
+			g_lorawan_settings.node_device_eui[2], g_lorawan_settings.node_device_eui[3],
+			g_lorawan_settings.node_device_eui[4], g_lorawan_settings.node_device_eui[5],
+			g_lorawan_settings.node_device_eui[6], g_lorawan_settings.node_device_eui[7]);
+	JAddStringToObject(body, "dev_eui", node_id);
 
-			JAddItemToObject(req, "body", body);
+	JAddItemToObject(req, "body", body);
 
-			JAddBinaryToObject(req, "payload", data, data_len);
+	JAddBinaryToObject(req, "payload", data, data_len);
 
-			MYLOG("BLUES", "Finished parsing");
-			if (!blues_send_req())
-			{
-				MYLOG("PABLUESRSE", "Send request failed");
-				return false;
-			}
-			return true;
-		}
-		else
-		{
-			request_active = false;
-			MYLOG("BLUES", "Error creating body");
-		}
+	MYLOG("BLUES", "Finished parsing");
+	if (!request.send())
+	{
+		MYLOG("BLUES", "Send request failed");
+		return false;
 	}
-	return false;
+	return true;
 }
 
 /**
- * @brief Create a request structure to be sent to the NoteCard
+ * @brief Request a sync of the stored notes with NoteHub
  *
- * @param request_name name of request, e.g. card.wireless
- * @return true if request could be created
- * @return false if request could not be created
+ * @return true if the NoteCard accepted the sync request
+ * @return false if the request failed
+ */
+bool blues_hub_sync(void)
+{
+	return blues_simple_req("hub.sync", BLUES_PRIO_HIGH);
+}
+
+/**
+ * @brief Request NoteHub status, mainly for debug purposes
+ *
+ * @param status buffer for the status text of the response
+ * @param status_len size of the buffer
+ * @return true if the status was received
+ * @return false if the request failed
  */
-bool blues_start_req(String request_name)
+bool blues_hub_status(char *status, uint16_t status_len)
 {
-	if (request_active)
+	BluesRequest request("hub.status");
+	if (!request.send())
 	{
-		MYLOG("BLUES", "A request already exists");
+		snprintf(status, status_len, "Req failed");
 		return false;
 	}
+	snprintf(status, status_len, "%s", JGetString(request.response(), "status"));
+	return true;
+}
+
+/** Last location fix */
+s_location g_last_location;
 
-	req = notecard.newRequest(request_name.c_str());
-	if (req != NULL)
+/** Flag if the NoteCard location was already cleared for the last GNSS fix */
+static bool location_cleared = true;
+
+/** Epoch time of the last GNSS fix taken into the cache, 0 if none */
+static uint32_t last_gnss_fix_time = 0;
+
+/**
+ * @brief Get the age of the cached location fix
+ *
+ * @return uint32_t age in milliseconds, UINT32_MAX if no fix is cached
+ */
+uint32_t blues_location_age(void)
+{
+	if (g_last_location.source == LOC_SRC_NONE)
 	{
-		request_active = true;
-		return true;
+		return UINT32_MAX;
 	}
-	MYLOG("BLUES", "Create request failed");
-
-	return false;
+	return millis() - g_last_location.updated_ms;
 }
 
 /**
- * @brief Send a completed request to the NoteCard.
+ * @brief Take over a location from a NoteCard response into the cache
  *
- * @return true if request could be sent and the response does not have "err"
- * @return false if request could not be sent or the response did have "err"
+ * @param rsp response of card.location or card.time
+ * @param source LOC_SRC_GNSS or LOC_SRC_TOWER
+ * @return true if the response had a new valid location
+ * @return false if the response had no location or the same fix as the cache
  */
-bool blues_send_req(void)
+static bool blues_cache_location(J *rsp, uint8_t source)
 {
-	char *json = JPrintUnformatted(req);
-	MYLOG("BLUES", "Card request = %s", json);
-
-	sprintf(blues_response, "Req failed");
-	J *rsp;
-	rsp = notecard.requestAndResponse(req);
-
-	// Mark request as finished
-	request_active = false;
-
-	if (rsp == NULL)
+	if (!JHasObjectItem(rsp, "lat") || !JHasObjectItem(rsp, "lon"))
 	{
-		request_active = false;
 		return false;
 	}
-	// json = JPrintUnformatted(rsp);
-	JPrintPreallocated(rsp, blues_response, 8192, false);
+	double blues_latitude = JGetNumber(rsp, "lat");
+	double blues_longitude = JGetNumber(rsp, "lon");
+	uint32_t fix_time = (uint32_t)JGetNumber(rsp, "time");
 
-	MYLOG("BLUES", "Card response = %s", blues_response);
-
-	if (strlen(blues_response) >= 8192)
+	if ((blues_latitude == 0.0) && (blues_longitude == 0.0))
 	{
-		MYLOG("BLUES", "Returned string of JPrintPreallocated is larger than buffer");
-		request_active = false;
-		notecard.deleteResponse(rsp);
-
-		MYLOG("BLUES", "Restart WisBlock");
-		api_reset();
-
-		// notecard.begin();
-		// NoteSetFnDefault(fixed_alloc, fixed_free, noteDelay, noteMillis);
-
-		// blues_start_req("card.restart");
-		// blues_send_req();
-
-		 return false;
+		MYLOG("BLUES", "No valid GPS data, report no location");
+		return false;
 	}
-
-	if (JIsPresent(rsp, "err"))
+	// Compare with the last GNSS fix, the cache can hold a tower location meanwhile
+	if ((source == LOC_SRC_GNSS) && (last_gnss_fix_time != 0) && (fix_time == last_gnss_fix_time))
 	{
-		MYLOG("BLUES", "Card error response = %s", blues_response);
-		char * error_type = JGetString(rsp, "err");
-		notecard.deleteResponse(rsp);
-		char *found_memory_fail = NULL;
-		found_memory_fail = strstr(error_type,"insufficient");
-		if (found_memory_fail)
-		{
-			MYLOG("BLUES", "Out of memory, restart WisBlock");
-			api_reset();
-			// notecard.begin();
-			// NoteSetFnDefault(fixed_alloc, fixed_free, noteDelay, noteMillis);
-		}
-		request_active = false;
+		MYLOG("BLUES", "No new GNSS fix since %ld", fix_time);
 		return false;
 	}
-	// MYLOG("BLUES", "Card response = %s", blues_response);
-	notecard.deleteResponse(rsp);
-	request_active = false;
+	if (source == LOC_SRC_GNSS)
+	{
+		last_gnss_fix_time = fix_time;
+	}
+
+	s_location location;
+	location.latitude = blues_latitude;
+	location.longitude = blues_longitude;
+	location.altitude = 0;
+	location.fix_time = fix_time;
+	location.updated_ms = millis();
+	location.source = source;
+	// The app task reads the location while the NoteCard task updates it
+	taskENTER_CRITICAL();
+	g_last_location = location;
+	taskEXIT_CRITICAL();
+	MYLOG("BLUES", "Got %s location Lat %.6f Long %0.6f", source == LOC_SRC_GNSS ? "GNSS" : "tower", blues_latitude, blues_longitude);
 	return true;
 }
 
 /**
- * @brief Request NoteHub status, mainly for debug purposes
+ * @brief Send a location request to the NoteCard and cache the result
+ *
+ * @param request_name card.location for GNSS or card.time for the tower location
+ * @param source LOC_SRC_GNSS or LOC_SRC_TOWER
+ * @return true if a new location was cached
+ * @return false if the request failed or no new location is available
+ */
+static bool blues_request_location(const char *request_name, uint8_t source)
+{
+	BluesRequest request(request_name, BLUES_PRIO_HIGH);
+	if (!request.send())
+	{
+		MYLOG("BLUES", "%s failed, report no location", request_name);
+		return false;
+	}
+	return blues_cache_location(request.response(), source);
+}
+
+/**
+ * @brief Clear the last GNSS location on the NoteCard
+ *       Only required if the NoteCard keeps reporting a fix that was already used
  *
  */
-void blues_hub_status(void)
+static void blues_clear_location(void)
 {
-	if (blues_start_req("hub.status"))
+	BluesRequest request("card.location.mode", BLUES_PRIO_HIGH);
+	J *req = request.json();
+	if (req == NULL)
+	{
+		return;
+	}
+	JAddBoolToObject(req, "delete", true);
+	if (request.send())
+	{
+		location_cleared = true;
+	}
+	else
 	{
-		blues_send_req();
+		MYLOG("BLUES", "card.location.mode failed");
 	}
 }
 
 /**
- * @brief Get the location information from the NoteCard
+ * @brief Update the cached location
+ *        The NoteCard takes a GNSS fix once per period of card.location.mode.
+ *        Within one period after a GNSS fix was cached it would report the same
+ *        fix again, the request, the tower location request and the clear of the
+ *        fix are skipped then. This happens if the adaptive interval is shorter
+ *        than the GNSS period, with a fixed interval the cache is never used.
+ *        If the NoteCard has no new GNSS fix, the tower location is used.
+ *        Runs in the NoteCard task, the payload is not touched.
  *
  * @return true if a location could be acquired
  * @return false if request failed or no location is available
  */
-bool blues_get_location(void)
+bool blues_update_location(void)
 {
-	bool result = false;
-	if (blues_start_req("card.location"))
+	StageTimer stage_timer(TIMING_LOCATION);
+
+	bool result = (g_last_location.source == LOC_SRC_GNSS) && (blues_location_age() < location_period_ms);
+
+	if (result)
+	{
+		MYLOG("BLUES", "Use cached location, age %ld ms", blues_location_age());
+	}
+	else
 	{
-		J *rsp;
-		rsp = notecard.requestAndResponse(req);
-		if (rsp == NULL)
+		result = blues_request_location("card.location", LOC_SRC_GNSS);
+		if (result)
 		{
-			MYLOG("BLUES", "card.location failed, report no location");
-			request_active = false;
-			return false;
+			location_cleared = false;
 		}
-		char *json = JPrintUnformatted(rsp);
-		MYLOG("BLUES", "Card response = %s", json);
-
-		if (JIsPresent(rsp, "err"))
+		else
 		{
-			MYLOG("BLUES", "Card error response = %s", blues_response);
-			char *error_type = JGetString(rsp, "err");
-			notecard.deleteResponse(rsp);
-			char *found_memory_fail = NULL;
-			found_memory_fail = strstr(error_type, "insufficient");
-			if (found_memory_fail)
+			// The NoteCard still reports an old fix, clear it once
+			if (!location_cleared && (last_gnss_fix_time != 0))
 			{
-				MYLOG("BLUES", "Out of memory, restart WisBlock");
-				api_reset();
-				// notecard.begin();
-				// NoteSetFnDefault(fixed_alloc, fixed_free, noteDelay, noteMillis);
+				blues_clear_location();
 			}
-			request_active = false;
-			return false;
+			// No new GPS coordinates, get last tower location
+			result = blues_request_location("card.time", LOC_SRC_TOWER);
 		}
-		if (JHasObjectItem(rsp, "lat") && JHasObjectItem(rsp, "lat"))
-		{
-			float blues_latitude = JGetNumber(rsp, "lat");
-			float blues_longitude = JGetNumber(rsp, "lon");
-			float blues_altitude = 0;
+	}
 
-			if ((blues_latitude == 0.0) && (blues_longitude == 0.0))
-			{
-				MYLOG("BLUES", "No valid GPS data, report no location");
-			}
-			else
-			{
-				MYLOG("BLUES", "Got location Lat %.6f Long %0.6f", blues_latitude, blues_longitude);
-				g_solution_data.addGNSS_6(LPP_CHANNEL_GPS, (uint32_t)(blues_latitude * 10000000), (uint32_t)(blues_longitude * 10000000), blues_altitude);
-				result = true;
-			}
-		}
+	return result;
+}
 
-		notecard.deleteResponse(rsp);
-		request_active = false;
-	}
-	else
+/**
+ * @brief Get the number of motion events since the last request
+ *
+ * @return int32_t motion events, -1 if the request failed
+ */
+int32_t blues_motion_count(void)
+{
+	BluesRequest request("card.motion", BLUES_PRIO_HIGH);
+	if (!request.send())
 	{
-		MYLOG("BLUES", "card.location request failed");
+		return -1;
 	}
+	return JGetInt(request.response(), "count");
+}
 
-	if (!result)
+/**
+ * @brief Get the signal strength of the cellular connection
+ *
+ * @return int8_t signal bars 0 to 4, -1 if the request failed
+ */
+int8_t blues_signal_bars(void)
+{
+	BluesRequest request("card.wireless", BLUES_PRIO_HIGH);
+	if (!request.send())
 	{
-		// No GPS coordinates, get last tower location
-		if (blues_start_req("card.time"))
-		{
-			J *rsp;
-			rsp = notecard.requestAndResponse(req);
-			if (rsp == NULL)
-			{
-				MYLOG("BLUES", "card.time failed, report no location");
-				request_active = false;
-				return false;
-			}
-			char *json = JPrintUnformatted(rsp);
-			MYLOG("BLUES", "Card response = %s", json);
-
-			if (JHasObjectItem(rsp, "lat") && JHasObjectItem(rsp, "lat"))
-			{
-				float blues_latitude = JGetNumber(rsp, "lat");
-				float blues_longitude = JGetNumber(rsp, "lon");
-				float blues_altitude = 0;
-
-				if ((blues_latitude == 0.0) && (blues_longitude == 0.0))
-				{
-					MYLOG("BLUES", "No valid GPS data, report no location");
-				}
-				else
-				{
-					MYLOG("BLUES", "Got tower location Lat %.6f Long %0.6f", blues_latitude, blues_longitude);
-					g_solution_data.addGNSS_6(LPP_CHANNEL_GPS, (uint32_t)(blues_latitude * 10000000), (uint32_t)(blues_longitude * 10000000), blues_altitude);
-					result = true;
-				}
-			}
-
-			notecard.deleteResponse(rsp);
-			request_active = false;
-		}
+		return -1;
 	}
-
-	// Clear last GPS location
-	if (blues_start_req("card.location.mode"))
+	J *net = JGetObject(request.response(), "net");
+	if (net == NULL)
 	{
-		JAddBoolToObject(req, "delete", true);
-		J *rsp;
-		rsp = notecard.requestAndResponse(req);
-		if (rsp == NULL)
-		{
-			MYLOG("BLUES", "card.location.mode");
-		}
-		char *json = JPrintUnformatted(rsp);
-		MYLOG("BLUES", "Card response = %s", json);
-		notecard.deleteResponse(rsp);
-
-		request_active = false;
+		return -1;
 	}
-	return result;
+	return JGetInt(net, "bars");
+}
+
+/**
+ * @brief Get a consistent copy of the cached location
+ *        The NoteCard task can update the cache at any time
+ *
+ * @param location buffer for the location
+ */
+void blues_get_location(s_location *location)
+{
+	taskENTER_CRITICAL();
+	*location = g_last_location;
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Add a location to the payload
+ *
+ * @param location copy of the cached location from blues_get_location()
+ */
+void blues_add_location(s_location *location)
+{
+	g_solution_data.addGNSS_6(PAYLOAD_CH_GPS, (int32_t)(location->latitude * 10000000), (int32_t)(location->longitude * 10000000), (int32_t)location->altitude);
 }
 
 /**
@@ -538,34 +1129,16 @@ bool blues_get_location(void)
 bool blues_enable_attn(void)
 {
 	MYLOG("BLUES", "Enable ATTN on motion");
-	if (blues_start_req("card.attn"))
-	{
-		JAddStringToObject(req, "mode", "motion");
-		if (!blues_send_req())
-		{
-			MYLOG("BLUES", "card.attn request failed");
-			return false;
-		}
-	}
-	else
+	if (!blues_set_attn("motion"))
 	{
-		MYLOG("BLUES", "Request creation failed");
+		return false;
 	}
 	attachInterrupt(WB_IO5, blues_attn_cb, RISING);
 
 	MYLOG("BLUES", "Arm ATTN on motion");
-	if (blues_start_req("card.attn"))
-	{
-		JAddStringToObject(req, "mode", "arm");
-		if (!blues_send_req())
-		{
-			MYLOG("BLUES", "card.attn request failed");
-			return false;
-		}
-	}
-	else
+	if (!blues_set_attn("arm"))
 	{
-		MYLOG("BLUES", "Request creation failed");
+		return false;
 	}
 	return true;
 }
@@ -581,31 +1154,34 @@ bool blues_disable_attn(void)
 	MYLOG("BLUES", "Disable ATTN on motion");
 	detachInterrupt(WB_IO5);
 
-	if (blues_start_req("card.attn"))
-	{
-		JAddStringToObject(req, "mode", "disarm");
-		if (!blues_send_req())
-		{
-			MYLOG("BLUES", "card.attn request failed");
-		}
-	}
-	else
+	blues_set_attn("disarm");
+	blues_set_attn("-motion");
+
+	return true;
+}
+
+/**
+ * @brief Send a card.attn request with a mode
+ *
+ * @param mode ATTN mode, e.g. arm or motion
+ * @return true if the NoteCard accepted the mode
+ * @return false if the request failed
+ */
+static bool blues_set_attn(const char *mode)
+{
+	BluesRequest request("card.attn");
+	J *req = request.json();
+	if (req == NULL)
 	{
 		MYLOG("BLUES", "Request creation failed");
+		return false;
 	}
-	if (blues_start_req("card.attn"))
-	{
-		JAddStringToObject(req, "mode", "-motion");
-		if (!blues_send_req())
-		{
-			MYLOG("BLUES", "card.attn request failed");
-		}
-	}
-	else
+	JAddStringToObject(req, "mode", mode);
+	if (!request.send())
 	{
-		MYLOG("BLUES", "Request creation failed");
+		MYLOG("BLUES", "card.attn request failed");
+		return false;
 	}
-
 	return true;
 }
 
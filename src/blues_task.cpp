@@ -0,0 +1,161 @@
+/**
+ * @file blues_task.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Background task for slow NoteCard transactions
+ * @version 0.1
+ * @date 2023-09-11
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Number of jobs that can wait for the task */
+#define BLUES_JOB_QUEUE_LEN 4
+
+/** Stack size of the task in words */
+#define BLUES_TASK_STACK 1024
+
+/** Jobs waiting for the task */
+static QueueHandle_t blues_jobs = NULL;
+
+/** Finished jobs waiting for the app event handler */
+static QueueHandle_t blues_results = NULL;
+
+/** Task handle */
+static TaskHandle_t blues_task_handle = NULL;
+
+/**
+ * @brief Task that executes queued NoteCard jobs one after the other
+ *        Each finished job is handed back to the app event handler with a BLUES_DONE event
+ *
+ * @param pvParameters unused
+ */
+static void blues_task(void *pvParameters)
+{
+	(void)pvParameters;
+	s_blues_job job;
+	while (true)
+	{
+		if (xQueueReceive(blues_jobs, &job, portMAX_DELAY) != pdTRUE)
+		{
+			continue;
+		}
+
+		// NoteCard transactions are counted for the cycle the job belongs to
+		cycle_stats_job(job.type == BLUES_JOB_LOCATION ? CYCLE_STATUS : CYCLE_CELLULAR);
+		switch (job.type)
+		{
+		case BLUES_JOB_PAYLOAD:
+			job.success = blues_send_payload(job.data, job.len);
+			break;
+		case BLUES_JOB_SYNC:
+			job.success = blues_hub_sync();
+			// Signal strength for the path selection
+			path_cell_signal(blues_signal_bars());
+			break;
+		case BLUES_JOB_LOCATION:
+			job.success = blues_update_location();
+			if (interval_is_adaptive())
+			{
+				interval_set_motion(blues_motion_count());
+			}
+			break;
+		default:
+			job.success = false;
+			break;
+		}
+
+		cycle_stats_job(CYCLE_NUM);
+
+		if (xQueueSend(blues_results, &job, 0) != pdTRUE)
+		{
+			MYLOG("BLUES", "Result queue full, job %d result lost", job.type);
+		}
+		api_wake_loop(BLUES_DONE);
+	}
+}
+
+/**
+ * @brief Create the job queues and start the task
+ *
+ * @return true if the task is running
+ * @return false if the task or the queues could not be created
+ */
+bool init_blues_task(void)
+{
+	blues_jobs = xQueueCreate(BLUES_JOB_QUEUE_LEN, sizeof(s_blues_job));
+	blues_results = xQueueCreate(BLUES_JOB_QUEUE_LEN, sizeof(s_blues_job));
+	if ((blues_jobs == NULL) || (blues_results == NULL))
+	{
+		MYLOG("BLUES", "Could not create job queues");
+		return false;
+	}
+	if (xTaskCreate(blues_task, "BLUES", BLUES_TASK_STACK, NULL, TASK_PRIO_LOW, &blues_task_handle) != pdPASS)
+	{
+		MYLOG("BLUES", "Could not start NoteCard task");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Check if the caller runs in the NoteCard task
+ *
+ * @return true if called from the NoteCard task
+ */
+bool blues_in_task(void)
+{
+	return (blues_task_handle != NULL) && (xTaskGetCurrentTaskHandle() == blues_task_handle);
+}
+
+/**
+ * @brief Queue a job for the NoteCard task
+ *
+ * @param type BLUES_JOB_PAYLOAD, BLUES_JOB_SYNC or BLUES_JOB_LOCATION
+ * @param data payload for BLUES_JOB_PAYLOAD, NULL for other jobs
+ * @param data_len length of the payload
+ * @param tag cycle or record the job belongs to, the result has the same tag
+ * @return true if the job was queued, the result comes with a BLUES_DONE event
+ * @return false if the job queue is full or the payload is too large
+ */
+bool blues_queue_job(uint8_t type, uint8_t *data, uint16_t data_len, uint32_t tag)
+{
+	if ((blues_jobs == NULL) || (data_len > BLUES_JOB_PAYLOAD_SIZE))
+	{
+		return false;
+	}
+
+	s_blues_job job;
+	job.type = type;
+	job.success = false;
+	job.tag = tag;
+	job.len = data_len;
+	if (data_len != 0)
+	{
+		memcpy(job.data, data, data_len);
+	}
+
+	if (xQueueSend(blues_jobs, &job, 0) != pdTRUE)
+	{
+		MYLOG("BLUES", "Job queue full");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Get the next finished job
+ *
+ * @param job buffer for the finished job
+ * @return true if a finished job was copied into job
+ * @return false if no finished job is waiting
+ */
+bool blues_get_result(s_blues_job *job)
+{
+	if (blues_results == NULL)
+	{
+		return false;
+	}
+	return xQueueReceive(blues_results, job, 0) == pdTRUE;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file cycle_stats.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Wall time, NoteCard bus transactions and heap usage per wakeup cycle
+ * @version 0.1
+ * @date 2023-09-04
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Statistics per cycle type */
+s_cycle_stats g_cycle_stats[CYCLE_NUM];
+
+/** Measurement of a running cycle */
+struct s_cycle_run
+{
+	bool open;			// Cycle started and not yet finished
+	uint32_t start_ms;	// Start time of the cycle
+	uint16_t nc_trans;	// NoteCard transactions in the cycle
+};
+
+/** Running cycles, one per type, a STATUS and a CELLULAR cycle can overlap */
+static s_cycle_run cycle_runs[CYCLE_NUM];
+
+/** Cycle type that was started last by the app task, CYCLE_NUM if none */
+static uint8_t app_cycle = CYCLE_NUM;
+
+/** Cycle type of the job the NoteCard task is working on, CYCLE_NUM if none */
+static volatile uint8_t job_cycle = CYCLE_NUM;
+
+/**
+ * @brief Start measuring a wakeup cycle
+ *        A cycle of the same type that is still open is restarted
+ *
+ * @param type cycle type, CYCLE_STATUS or CYCLE_CELLULAR
+ */
+void cycle_stats_start(uint8_t type)
+{
+	if (type >= CYCLE_NUM)
+	{
+		return;
+	}
+	taskENTER_CRITICAL();
+	cycle_runs[type].open = true;
+	cycle_runs[type].start_ms = millis();
+	cycle_runs[type].nc_trans = 0;
+	taskEXIT_CRITICAL();
+	app_cycle = type;
+	cycle_stats_heap_check();
+}
+
+/**
+ * @brief Finish measuring a wakeup cycle and update its statistics
+ *
+ * @param type cycle type, CYCLE_STATUS or CYCLE_CELLULAR
+ */
+void cycle_stats_end(uint8_t type)
+{
+	if ((type >= CYCLE_NUM) || !cycle_runs[type].open)
+	{
+		return;
+	}
+	cycle_stats_heap_check();
+
+	taskENTER_CRITICAL();
+	s_cycle_run run = cycle_runs[type];
+	cycle_runs[type].open = false;
+	taskEXIT_CRITICAL();
+	if (app_cycle == type)
+	{
+		app_cycle = cycle_runs[CYCLE_STATUS].open ? CYCLE_STATUS : (cycle_runs[CYCLE_CELLULAR].open ? CYCLE_CELLULAR : CYCLE_NUM);
+	}
+
+	s_cycle_stats *stats = &g_cycle_stats[type];
+	stats->cycles++;
+	stats->last_time_ms = millis() - run.start_ms;
+	stats->sum_time_ms += stats->last_time_ms;
+	if (stats->last_time_ms > stats->max_time_ms)
+	{
+		stats->max_time_ms = stats->last_time_ms;
+	}
+	stats->last_nc_trans = run.nc_trans;
+	stats->sum_nc_trans += run.nc_trans;
+	if (run.nc_trans > stats->max_nc_trans)
+	{
+		stats->max_nc_trans = run.nc_trans;
+	}
+
+	MYLOG("BENCH", "%s cycle %ld ms, %d NoteCard transactions, heap HWM %ld bytes",
+		  type == CYCLE_STATUS ? "STATUS" : "CELLULAR",
+		  stats->last_time_ms, stats->last_nc_trans, stats->heap_hwm);
+
+	// Uptime and heap usage for the diagnostics after a reset
+	diag_update();
+}
+
+/**
+ * @brief Set the cycle type of the job the NoteCard task is working on
+ *        Called by the NoteCard task before and after each job
+ *
+ * @param type cycle type, CYCLE_NUM after the job
+ */
+void cycle_stats_job(uint8_t type)
+{
+	job_cycle = type;
+}
+
+/**
+ * @brief Count one NoteCard request/response transaction
+ *        Called for every request that goes over the I2C bus. Requests of the
+ *        NoteCard task count for the cycle of its job, requests of the app task
+ *        for the cycle it started last.
+ *
+ */
+void cycle_stats_bus_transaction(void)
+{
+	uint8_t type = blues_in_task() ? job_cycle : app_cycle;
+	if (type >= CYCLE_NUM)
+	{
+		return;
+	}
+	taskENTER_CRITICAL();
+	if (cycle_runs[type].open)
+	{
+		cycle_runs[type].nc_trans++;
+	}
+	taskEXIT_CRITICAL();
+	cycle_stats_heap_check();
+}
+
+/**
+ * @brief Update the heap high water mark of the running cycles
+ *
+ */
+void cycle_stats_heap_check(void)
+{
+	uint32_t heap_used = (uint32_t)dbgHeapUsed();
+	for (uint8_t type = 0; type < CYCLE_NUM; type++)
+	{
+		if (cycle_runs[type].open && (heap_used > g_cycle_stats[type].heap_hwm))
+		{
+			g_cycle_stats[type].heap_hwm = heap_used;
+		}
+	}
+}
+
+/**
+ * @brief Clear all cycle statistics
+ *
+ */
+void cycle_stats_reset(void)
+{
+	memset(g_cycle_stats, 0, sizeof(g_cycle_stats));
+	memset(&g_arena_stats, 0, sizeof(s_arena_stats));
+}
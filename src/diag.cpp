@@ -0,0 +1,225 @@
+/**
+ * @file diag.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Reset cause and diagnostics that survive a reset
+ * @version 0.1
+ * @date 2023-09-25
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Filename of the diagnostic record */
+static const char diag_file_name[] = "DIAG";
+
+/** Marker for valid diagnostics in RAM after a reset */
+#define DIAG_MAGIC 0x44494147
+
+/** Diagnostics of the running firmware, kept in RAM that is not cleared on a reset */
+struct s_diag_noinit
+{
+	uint32_t magic;						// DIAG_MAGIC if the values are valid
+	uint8_t cause;						// Reset cause set by the application, DIAG_CAUSE_SOFT if not set
+	uint32_t uptime_ms;					// millis() at the last update
+	uint32_t heap_hwm;					// Heap high water mark in bytes
+	char note_error[DIAG_ERROR_SIZE];	// Last NoteCard error
+};
+
+static s_diag_noinit diag_noinit __attribute__((section(".noinit")));
+
+/** File for the diagnostic record */
+static File diag_file(InternalFS);
+
+/** Diagnostics of the last reset and the reset counters */
+s_diag_record g_diag;
+
+/** Diagnostics were not sent yet */
+static bool diag_is_pending = false;
+
+/**
+ * @brief Get the reset cause from the reset reason register
+ *        The register was saved and cleared by the core before the SoftDevice started
+ *
+ * @param noinit_valid true if the RAM diagnostics survived the reset
+ * @return uint8_t DIAG_CAUSE_xxx
+ */
+static uint8_t diag_reset_cause(bool noinit_valid)
+{
+	uint32_t reason = readResetReason();
+	if (reason & POWER_RESETREAS_DOG_Msk)
+	{
+		return DIAG_CAUSE_WATCHDOG;
+	}
+	if (reason & POWER_RESETREAS_LOCKUP_Msk)
+	{
+		return DIAG_CAUSE_LOCKUP;
+	}
+	if (reason & POWER_RESETREAS_SREQ_Msk)
+	{
+		// The application saves its reason before it resets
+		return noinit_valid ? diag_noinit.cause : DIAG_CAUSE_SOFT;
+	}
+	if (reason & POWER_RESETREAS_RESETPIN_Msk)
+	{
+		return DIAG_CAUSE_PIN;
+	}
+	if (reason & POWER_RESETREAS_OFF_Msk)
+	{
+		return DIAG_CAUSE_WAKEUP;
+	}
+	return DIAG_CAUSE_POWER_ON;
+}
+
+/**
+ * @brief Save the diagnostic record
+ *
+ */
+static void diag_save(void)
+{
+	if (InternalFS.exists(diag_file_name))
+	{
+		InternalFS.remove(diag_file_name);
+	}
+	if (diag_file.open(diag_file_name, FILE_O_WRITE))
+	{
+		diag_file.write((const uint8_t *)&g_diag, sizeof(s_diag_record));
+		diag_file.close();
+	}
+	else
+	{
+		MYLOG("DIAG", "Could not save diagnostics");
+	}
+}
+
+/**
+ * @brief Record the cause of the last reset and the values from before the reset
+ *        Must be called once after start, before diag_update()
+ *
+ */
+void init_diag(void)
+{
+	bool noinit_valid = diag_noinit.magic == DIAG_MAGIC;
+	uint8_t cause = diag_reset_cause(noinit_valid);
+
+	bool valid = false;
+	if (InternalFS.exists(diag_file_name))
+	{
+		if (diag_file.open(diag_file_name, FILE_O_READ))
+		{
+			valid = (diag_file.read((void *)&g_diag, sizeof(s_diag_record)) == sizeof(s_diag_record)) && (g_diag.valid_mark == 0xAA55);
+			diag_file.close();
+		}
+	}
+	if (!valid)
+	{
+		memset((void *)&g_diag, 0, sizeof(s_diag_record));
+		g_diag.valid_mark = 0xAA55;
+	}
+
+	g_diag.boots++;
+	g_diag.cause = cause;
+	if ((cause == DIAG_CAUSE_WATCHDOG) || (cause == DIAG_CAUSE_LOCKUP) || (cause >= DIAG_CAUSE_NOTE_MEMORY))
+	{
+		g_diag.abnormal++;
+	}
+
+	// After power on the RAM content is random
+	if (noinit_valid && (cause != DIAG_CAUSE_POWER_ON))
+	{
+		g_diag.uptime_s = diag_noinit.uptime_ms / 1000;
+		g_diag.heap_hwm = diag_noinit.heap_hwm;
+		memcpy(g_diag.note_error, diag_noinit.note_error, DIAG_ERROR_SIZE);
+		g_diag.note_error[DIAG_ERROR_SIZE - 1] = 0;
+	}
+	else
+	{
+		g_diag.uptime_s = 0;
+		g_diag.heap_hwm = 0;
+		g_diag.note_error[0] = 0;
+	}
+#if MY_DEBUG > 0
+	g_diag.log_count = log_last_records(g_diag.log, DIAG_LOG_RECORDS);
+#else
+	g_diag.log_count = 0;
+#endif
+	diag_save();
+
+	memset((void *)&diag_noinit, 0, sizeof(s_diag_noinit));
+	diag_noinit.cause = DIAG_CAUSE_SOFT;
+	diag_noinit.magic = DIAG_MAGIC;
+
+	diag_is_pending = true;
+	MYLOG("DIAG", "Boot %d, reset cause %d after %ld s, %d abnormal resets", g_diag.boots, g_diag.cause, g_diag.uptime_s, g_diag.abnormal);
+}
+
+/**
+ * @brief Update uptime and heap high water mark in RAM
+ *
+ */
+void diag_update(void)
+{
+	diag_noinit.uptime_ms = millis();
+	uint32_t heap_used = (uint32_t)dbgHeapUsed();
+	if (heap_used > diag_noinit.heap_hwm)
+	{
+		diag_noinit.heap_hwm = heap_used;
+	}
+}
+
+/**
+ * @brief Remember the last NoteCard error
+ *
+ * @param error error string of the NoteCard response
+ */
+void diag_note_error(const char *error)
+{
+	strncpy(diag_noinit.note_error, error, DIAG_ERROR_SIZE - 1);
+	diag_noinit.note_error[DIAG_ERROR_SIZE - 1] = 0;
+}
+
+/**
+ * @brief Reset the device and keep the reason for the next start
+ *
+ * @param cause DIAG_CAUSE_xxx reason of the reset
+ */
+void diag_reset(uint8_t cause)
+{
+	diag_noinit.cause = cause;
+	diag_update();
+	api_reset();
+}
+
+/**
+ * @brief Check if the diagnostics still have to be sent
+ *
+ * @return true if the diagnostic channel should be added to the next packet
+ */
+bool diag_pending(void)
+{
+	return diag_is_pending;
+}
+
+/**
+ * @brief Mark the diagnostics as sent
+ *
+ */
+void diag_sent(void)
+{
+	diag_is_pending = false;
+}
+
+/**
+ * @brief Clear the reset counters
+ *
+ */
+void diag_clear(void)
+{
+	g_diag.boots = 0;
+	g_diag.abnormal = 0;
+	diag_save();
+}
@@ -0,0 +1,227 @@
+/**
+ * @file fragment.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Split packets that are too large for the LoRaWAN data rate into several uplinks
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Size of the fragment header channel, channel, type, packet ID and index/count */
+#define FRAG_HEADER_SIZE PayloadField_FRAG::total
+
+/** Maximum number of fragments of one packet */
+#define FRAG_MAX 15
+
+/** Copy of the packet that is sent in fragments */
+static uint8_t frag_data[256];
+
+/** Start of each fragment in frag_data, the last entry is the packet length */
+static uint8_t frag_start_pos[FRAG_MAX + 1];
+
+/** Number of fragments */
+static uint8_t frag_count = 0;
+
+/** Index of the fragment that is sent right now */
+static uint8_t frag_index = 0;
+
+/** ID of the fragmented packet, lets the server merge the fragments */
+static uint8_t frag_packet_id = 0;
+
+/** Buffer for the fragment that is sent */
+static uint8_t frag_buffer[256];
+
+/**
+ * @brief Get the largest LoRaWAN payload for the current data rate
+ *
+ * @return uint8_t maximum payload size
+ */
+uint8_t lora_max_payload(void)
+{
+	LoRaMacTxInfo_t tx_info;
+	LoRaMacQueryTxPossible(0, &tx_info);
+	return tx_info.MaxPossiblePayload;
+}
+
+/**
+ * @brief Get the size of one Cayenne LPP channel
+ *
+ * @param data start of the channel
+ * @param len bytes left in the packet
+ * @return int16_t size of the channel including channel and type, -1 if the type is unknown
+ */
+#define FRAG_SCHEMA_SIZE(id, channel, type, field_size, scale, is_signed, layout, name) \
+	case type:                                                                          \
+		size = field_size;                                                              \
+		break;
+
+static int16_t frag_channel_size(uint8_t *data, uint8_t len)
+{
+	if (len < 2)
+	{
+		return -1;
+	}
+	int16_t size;
+	switch (data[1])
+	{
+	// Fields of the payload schema, the size of the track is variable
+	PAYLOAD_SCHEMA(FRAG_SCHEMA_SIZE)
+	case 120: // Percentage
+		size = 1;
+		break;
+	case 112: // Precise humidity
+		size = 2;
+		break;
+	case 100: // Generic sensor
+	case 133: // Time
+		size = 4;
+		break;
+	case 136: // GNSS 4 digits
+		size = 9;
+		break;
+	default:
+		return -1;
+	}
+	if (data[1] == PAYLOAD_TYPE_TRACK)
+	{
+		// Point count, anchor point and three varints per following point
+		if ((len < 3) || (data[2] == 0))
+		{
+			return -1;
+		}
+		size = 13;
+		uint16_t varints = 3 * (data[2] - 1);
+		while (varints != 0)
+		{
+			if ((size + 2) >= len)
+			{
+				return -1;
+			}
+			if ((data[size + 2] & 0x80) == 0)
+			{
+				varints--;
+			}
+			size++;
+		}
+	}
+	size += 2;
+	return size <= len ? size : -1;
+}
+
+/**
+ * @brief Split a packet into fragments that fit into max_size
+ *        Packets are only split between LPP channels, so each fragment
+ *        is a valid LPP payload on its own.
+ *
+ * @param data packet
+ * @param len packet length
+ * @param max_size maximum size of one uplink
+ * @return true if the packet was split
+ * @return false if a channel is too large or too many fragments are needed
+ */
+bool frag_start(uint8_t *data, uint8_t len, uint8_t max_size)
+{
+	frag_count = 0;
+	frag_index = 0;
+	if (max_size <= FRAG_HEADER_SIZE)
+	{
+		return false;
+	}
+	uint8_t budget = max_size - FRAG_HEADER_SIZE;
+
+	uint8_t pos = 0;
+	uint8_t count = 0;
+	frag_start_pos[0] = 0;
+	while (pos < len)
+	{
+		int16_t size = frag_channel_size(&data[pos], len - pos);
+		if ((size < 0) || (size > budget))
+		{
+			MYLOG("FRAG", "Cannot split channel at %d", pos);
+			return false;
+		}
+		if ((pos + size - frag_start_pos[count]) > budget)
+		{
+			// Channel starts the next fragment
+			count++;
+			if (count >= FRAG_MAX)
+			{
+				MYLOG("FRAG", "Too many fragments");
+				return false;
+			}
+			frag_start_pos[count] = pos;
+		}
+		pos += size;
+	}
+	count++;
+	frag_start_pos[count] = len;
+
+	memcpy(frag_data, data, len);
+	frag_count = count;
+	frag_packet_id++;
+	MYLOG("FRAG", "Packet %d split into %d fragments", frag_packet_id, frag_count);
+	return true;
+}
+
+/**
+ * @brief Send the current fragment over LoRaWAN
+ *        Each fragment starts with the fragment header channel
+ *
+ * @return true if the fragment was enqueued
+ * @return false if no fragment is left or sending failed
+ */
+bool frag_send(void)
+{
+	if (frag_index >= frag_count)
+	{
+		return false;
+	}
+	uint8_t len = frag_start_pos[frag_index + 1] - frag_start_pos[frag_index];
+	frag_buffer[0] = PAYLOAD_CH_FRAG;
+	frag_buffer[1] = PAYLOAD_TYPE_FRAG;
+	frag_buffer[2] = frag_packet_id;
+	frag_buffer[3] = (frag_index << 4) | frag_count;
+	memcpy(&frag_buffer[FRAG_HEADER_SIZE], &frag_data[frag_start_pos[frag_index]], len);
+
+	MYLOG("FRAG", "Send fragment %d/%d", frag_index + 1, frag_count);
+	if (send_lora_packet(frag_buffer, len + FRAG_HEADER_SIZE) != LMH_SUCCESS)
+	{
+		frag_count = 0;
+		return false;
+	}
+	timing_start(TIMING_LORA_TX);
+	return true;
+}
+
+/**
+ * @brief Handle the end of a LoRaWAN TX cycle
+ *        After an ACK the next fragment is sent. After a NAK the remaining
+ *        fragments are dropped, the caller sends the whole packet over cellular.
+ *
+ * @param ack true if the TX cycle finished with ACK
+ * @return uint8_t FRAG_IDLE if no fragmented packet is in progress or the last fragment was sent,
+ *         FRAG_SENDING if the next fragment was enqueued,
+ *         FRAG_FAILED if a fragment could not be sent
+ */
+uint8_t frag_tx_fin(bool ack)
+{
+	if (frag_count == 0)
+	{
+		return FRAG_IDLE;
+	}
+	if (!ack)
+	{
+		frag_count = 0;
+		return FRAG_FAILED;
+	}
+	frag_index++;
+	if (frag_index >= frag_count)
+	{
+		frag_count = 0;
+		return FRAG_IDLE;
+	}
+	return frag_send() ? FRAG_SENDING : FRAG_FAILED;
+}
@@ -0,0 +1,320 @@
+/**
+ * @file log_ring.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Ring buffer for binary debug log records and the task that prints them
+ * @version 0.1
+ * @date 2023-09-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+#if MY_DEBUG > 0
+
+/** Marker for a valid ring buffer after a reset */
+#define LOG_MAGIC 0x4C4F4752
+
+/** Stack size of the task in words */
+#define LOG_TASK_STACK 512
+
+/** Ring buffer, kept in RAM that is not cleared on a reset */
+struct s_log_ring
+{
+	uint32_t magic;					// LOG_MAGIC if the ring buffer is valid
+	volatile uint32_t head;			// Number of the next record
+	s_log_record slots[LOG_SLOTS];	// Records
+};
+
+static s_log_ring log_ring __attribute__((section(".noinit")));
+
+/** Number of the next record to print */
+static uint32_t log_tail = 0;
+
+/** Number of the first record after the last reset */
+static uint32_t log_boot_head = 0;
+
+/** Task handle */
+static TaskHandle_t log_task_handle = NULL;
+
+/** One record as hex text */
+static char log_line[LOG_HEX_SIZE];
+
+/**
+ * @brief Convert one record into a line of hex
+ *        Format: '@', number, time, tag address, format address, length (all LSB), arguments
+ *
+ * @param record record to convert
+ * @param line buffer for the line, at least LOG_HEX_SIZE bytes
+ * @return uint16_t length of the line including the line end
+ */
+uint16_t log_to_hex(s_log_record *record, char *line)
+{
+	uint8_t raw[17 + LOG_ARGS_SIZE];
+	uint32_t tag = (uint32_t)(uintptr_t)record->tag;
+	uint32_t format = (uint32_t)(uintptr_t)record->format;
+	memcpy(&raw[0], &record->number, 4);
+	memcpy(&raw[4], &record->time_ms, 4);
+	memcpy(&raw[8], &tag, 4);
+	memcpy(&raw[12], &format, 4);
+	raw[16] = record->len;
+	uint8_t len = record->len <= LOG_ARGS_SIZE ? record->len : 0;
+	memcpy(&raw[17], record->args, len);
+
+	static const char hex[] = "0123456789ABCDEF";
+	uint16_t pos = 0;
+	line[pos++] = '@';
+	for (uint8_t idx = 0; idx < 17 + len; idx++)
+	{
+		line[pos++] = hex[raw[idx] >> 4];
+		line[pos++] = hex[raw[idx] & 0x0F];
+	}
+	line[pos++] = '\n';
+	line[pos] = 0;
+	return pos;
+}
+
+/**
+ * @brief Print one record to Serial and BLE UART
+ *
+ * @param record record to print
+ */
+static void log_print(s_log_record *record)
+{
+	uint16_t pos = log_to_hex(record, log_line);
+	Serial.write((const uint8_t *)log_line, pos);
+	if (g_ble_uart_is_connected)
+	{
+		g_ble_uart.write((const uint8_t *)log_line, pos);
+	}
+}
+
+/**
+ * @brief Task that prints the finished records
+ *        Records that were overwritten before they were printed are skipped,
+ *        the gap in the record numbers shows the loss.
+ *
+ * @param pvParameters unused
+ */
+static void log_task(void *pvParameters)
+{
+	(void)pvParameters;
+	s_log_record record;
+	while (true)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		while (log_tail != log_ring.head)
+		{
+			s_log_record *slot = &log_ring.slots[log_tail % LOG_SLOTS];
+			uint32_t commit = slot->commit;
+			if ((int32_t)(commit - (log_tail + 1)) > 0)
+			{
+				// Writers were faster, continue with the oldest record that is still there
+				log_tail = log_ring.head - LOG_SLOTS;
+				continue;
+			}
+			if (commit != (log_tail + 1))
+			{
+				// Record is still written, the writer wakes the task again
+				break;
+			}
+			memcpy((void *)&record, (const void *)slot, sizeof(s_log_record));
+			if (slot->commit == commit)
+			{
+				log_print(&record);
+			}
+			log_tail++;
+		}
+	}
+}
+
+/**
+ * @brief Prepare the ring buffer and start the task
+ *        After a reset the records from before the reset are kept and printed first
+ *
+ */
+void init_log(void)
+{
+	bool retained = log_ring.magic == LOG_MAGIC;
+	if (retained)
+	{
+		// Records that were not finished before the reset are marked as lost
+		uint32_t start = log_ring.head >= LOG_SLOTS ? log_ring.head - LOG_SLOTS : 0;
+		for (uint32_t number = start; number != log_ring.head; number++)
+		{
+			s_log_record *slot = &log_ring.slots[number % LOG_SLOTS];
+			if (slot->commit != (number + 1))
+			{
+				slot->number = number;
+				slot->tag = NULL;
+				slot->format = NULL;
+				slot->len = 0;
+				slot->commit = number + 1;
+			}
+		}
+		log_tail = start;
+	}
+	else
+	{
+		memset((void *)&log_ring, 0, sizeof(s_log_ring));
+		log_ring.magic = LOG_MAGIC;
+		log_tail = 0;
+	}
+
+	log_boot_head = log_ring.head;
+
+	if (xTaskCreate(log_task, "LOG", LOG_TASK_STACK, NULL, TASK_PRIO_LOWEST, &log_task_handle) != pdPASS)
+	{
+		log_task_handle = NULL;
+	}
+
+	if (retained)
+	{
+		MYLOG("LOG", "Reset, %ld records from before the reset", log_ring.head - log_tail);
+	}
+}
+
+/**
+ * @brief Get the last records that were written before the reset
+ *
+ * @param records buffer for the records
+ * @param count maximum number of records
+ * @return uint8_t number of records copied
+ */
+uint8_t log_last_records(s_log_record *records, uint8_t count)
+{
+	uint32_t start = log_boot_head >= count ? log_boot_head - count : 0;
+	uint8_t copied = 0;
+	for (uint32_t number = start; number != log_boot_head; number++)
+	{
+		s_log_record *slot = &log_ring.slots[number % LOG_SLOTS];
+		if (slot->commit == (number + 1))
+		{
+			memcpy((void *)&records[copied], (const void *)slot, sizeof(s_log_record));
+			copied++;
+		}
+	}
+	return copied;
+}
+
+/**
+ * @brief Get the next free record
+ *        Several writers can reserve records at the same time without a lock
+ *
+ * @param tag tag of the log line
+ * @param format printf format string
+ * @return s_log_record* record to write the arguments to, NULL if the ring buffer is not ready
+ */
+s_log_record *log_reserve(const char *tag, const char *format)
+{
+	if (log_ring.magic != LOG_MAGIC)
+	{
+		return NULL;
+	}
+	uint32_t number = __atomic_fetch_add(&log_ring.head, 1, __ATOMIC_RELAXED);
+	s_log_record *record = &log_ring.slots[number % LOG_SLOTS];
+	record->commit = 0;
+	record->number = number;
+	record->time_ms = millis();
+	record->tag = tag;
+	record->format = format;
+	record->len = 0;
+	return record;
+}
+
+/**
+ * @brief Mark the record as complete and wake the task
+ *
+ * @param record record from log_reserve
+ */
+void log_commit(s_log_record *record)
+{
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	record->commit = record->number + 1;
+
+	if (log_task_handle != NULL)
+	{
+		if (isInISR())
+		{
+			BaseType_t woken = pdFALSE;
+			vTaskNotifyGiveFromISR(log_task_handle, &woken);
+			portYIELD_FROM_ISR(woken);
+		}
+		else
+		{
+			xTaskNotifyGive(log_task_handle);
+		}
+	}
+}
+
+/**
+ * @brief Add an integer argument
+ *
+ * @param record record from log_reserve
+ * @param value value
+ */
+void log_put_int(s_log_record *record, uint32_t value)
+{
+	if ((record->len + 5) > LOG_ARGS_SIZE)
+	{
+		return;
+	}
+	record->args[record->len] = LOG_ARG_INT;
+	memcpy(&record->args[record->len + 1], &value, 4);
+	record->len += 5;
+}
+
+/**
+ * @brief Add a float argument, doubles are reduced to float
+ *
+ * @param record record from log_reserve
+ * @param value value
+ */
+void log_put_float(s_log_record *record, float value)
+{
+	if ((record->len + 5) > LOG_ARGS_SIZE)
+	{
+		return;
+	}
+	record->args[record->len] = LOG_ARG_FLOAT;
+	memcpy(&record->args[record->len + 1], &value, 4);
+	record->len += 5;
+}
+
+/**
+ * @brief Add a string argument
+ *        Strings in flash are added as address, strings in RAM are copied
+ *        and cut if they do not fit into the record
+ *
+ * @param record record from log_reserve
+ * @param value string
+ */
+void log_put_str(s_log_record *record, const char *value)
+{
+	uint32_t address = (uint32_t)(uintptr_t)value;
+	if ((value == NULL) || (address < LOG_RAM_START))
+	{
+		if ((record->len + 5) > LOG_ARGS_SIZE)
+		{
+			return;
+		}
+		record->args[record->len] = LOG_ARG_PTR_STR;
+		memcpy(&record->args[record->len + 1], &address, 4);
+		record->len += 5;
+		return;
+	}
+
+	if ((record->len + 2) > LOG_ARGS_SIZE)
+	{
+		return;
+	}
+	record->args[record->len++] = LOG_ARG_STR;
+	while ((*value != 0) && ((record->len + 1) < LOG_ARGS_SIZE))
+	{
+		record->args[record->len++] = *value++;
+	}
+	record->args[record->len++] = 0;
+}
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * @file log_ring.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Binary debug log records, written to a ring buffer and printed by a low priority task
+ * @version 0.1
+ * @date 2023-09-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG_RING_H
+#define LOG_RING_H
+#include <Arduino.h>
+
+// Log ring buffer
+#define LOG_SLOTS 64				// Number of records in the ring buffer
+#define LOG_ARGS_SIZE 43			// Space for the arguments of one record
+#define LOG_RAM_START 0x20000000	// Strings below this address are in flash and do not change
+#define LOG_HEX_SIZE 124			// Size of one record as hex line, '@', 60 bytes as hex, line end and zero
+
+// Argument types in a record
+#define LOG_ARG_INT 'i'		// 32 bit integer
+#define LOG_ARG_FLOAT 'f'	// 32 bit float
+#define LOG_ARG_PTR_STR 'p'	// Address of a string in flash
+#define LOG_ARG_STR 's'		// String copied into the record, zero terminated
+
+struct s_log_record
+{
+	volatile uint32_t commit;		// Record number + 1 when the record is complete, 0 while it is written
+	uint32_t number;				// Record number, continues across a reset
+	uint32_t time_ms;				// millis() when the record was written
+	const char *tag;				// Address of the tag string in flash
+	const char *format;				// Address of the format string in flash
+	uint8_t len;					// Bytes used in args
+	uint8_t args[LOG_ARGS_SIZE];	// Type and value of each argument
+};
+
+void init_log(void);
+s_log_record *log_reserve(const char *tag, const char *format);
+void log_commit(s_log_record *record);
+uint8_t log_last_records(s_log_record *records, uint8_t count);
+uint16_t log_to_hex(s_log_record *record, char *line);
+void log_put_int(s_log_record *record, uint32_t value);
+void log_put_float(s_log_record *record, float value);
+void log_put_str(s_log_record *record, const char *value);
+
+// Argument encoders, one per type that is used with MYLOG
+inline void log_put(s_log_record *record, bool value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, char value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, signed char value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, unsigned char value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, short value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, unsigned short value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, int value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, unsigned int value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, long value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, unsigned long value) { log_put_int(record, value); }
+inline void log_put(s_log_record *record, float value) { log_put_float(record, value); }
+inline void log_put(s_log_record *record, double value) { log_put_float(record, value); }
+inline void log_put(s_log_record *record, const char *value) { log_put_str(record, value); }
+inline void log_put(s_log_record *record, const void *value) { log_put_int(record, (uint32_t)(uintptr_t)value); }
+
+inline void log_put_args(s_log_record *) {}
+
+template <typename T, typename... Args>
+inline void log_put_args(s_log_record *record, T value, Args... args)
+{
+	log_put(record, value);
+	log_put_args(record, args...);
+}
+
+/**
+ * @brief Write one log record, the text is only formatted on the host
+ *        Safe to call from tasks and interrupts, it never blocks
+ *
+ * @param tag tag of the log line
+ * @param format printf format string
+ * @param args values for the format string
+ */
+template <typename... Args>
+inline void log_record(const char *tag, const char *format, Args... args)
+{
+	s_log_record *record = log_reserve(tag, format);
+	if (record != NULL)
+	{
+		log_put_args(record, args...);
+		log_commit(record);
+	}
+}
+
+#endif // LOG_RING_H
@@ -12,7 +12,7 @@
 #include "main.h"
 
 /** LoRaWAN packet */
-WisCayenne g_solution_data(255);
+WisCayenneTracker g_solution_data(PAYLOAD_BUFFER_SIZE);
 
 /** Received package for parsing */
 uint8_t rcvd_data[256];
@@ -33,6 +33,32 @@ bool has_blues = false;
 
 SoftwareTimer delayed_sending;
 void delayed_cellular(TimerHandle_t unused);
+void start_cellular_fallback(void);
+void send_status_packet(void);
+lmh_error_status send_lora_status(void);
+
+/** Stages of the STATUS cycle that can run at the same time */
+#define STAGE_BME 0b00000001	  // BME680 conversion
+#define STAGE_LOCATION 0b00000010 // Location request in the NoteCard task
+
+/** Stages of the STATUS cycle that are not finished yet */
+uint8_t status_stages = 0;
+/** Battery level of the STATUS cycle */
+float status_batt_mv = 0;
+/** Flag if the STATUS cycle got a location */
+bool status_has_location = false;
+/** Number of the STATUS cycle, jobs of the cycle are tagged with it */
+uint32_t status_cycle = 0;
+void status_stage_done(uint8_t stage);
+void finish_status_packet(void);
+
+/** Copy of the STATUS packet for the cellular path, with the device ID added */
+uint8_t cell_packet[PAYLOAD_BUFFER_SIZE + PayloadField_CELL_DEVID::total];
+/** Length of the copy */
+uint16_t cell_packet_len = 0;
+/** Flag if the copy still has to be sent over cellular */
+bool cell_packet_pending = false;
+void save_cell_packet(void);
 
 /**
  * @brief Initial setup of the application (before LoRaWAN and BLE setup)
@@ -57,6 +83,11 @@ void setup_app(void)
 	}
 	digitalWrite(LED_GREEN, LOW);
 
+#if MY_DEBUG > 0
+	// Start the debug log output, records from before a reset are printed first
+	init_log();
+#endif
+
 	// Set firmware version
 	api_set_version(SW_VERSION_1, SW_VERSION_2, SW_VERSION_3);
 	g_enable_ble = true;
@@ -79,6 +110,24 @@ bool init_app(void)
 	// Initialize User AT commands
 	init_user_at();
 
+	// Recover the store-and-forward queue
+	init_packet_queue();
+
+	// Record why the device restarted
+	init_diag();
+
+	// Start the stage timing
+	init_timing();
+
+	// Continue the sequence numbers of the readings
+	init_sequence();
+
+	// Start the link statistics
+	init_path_selector();
+
+	// Restore the rejoin back-off
+	init_rejoin();
+
 	// Check if RAK1906 is available
 	has_rak1906 = init_rak1906();
 	if (has_rak1906)
@@ -93,6 +142,9 @@ bool init_app(void)
 		AT_PRINTF("+EVT:CELLULAR_ERROR");
 	}
 
+	// Start the task for slow NoteCard requests
+	init_blues_task();
+
 	pinMode(WB_IO2, OUTPUT);
 	digitalWrite(WB_IO2, LOW);
 
@@ -127,125 +179,79 @@ bool init_app(void)
  */
 void app_event_handler(void)
 {
+	StageTimer stage_timer(TIMING_EVENT);
+
 	// Timer triggered event
 	if ((g_task_event_type & STATUS) == STATUS)
 	{
 		g_task_event_type &= N_STATUS;
 
 		MYLOG("APP", "Timer wakeup");
+		if (status_stages != 0)
+		{
+			MYLOG("APP", "Last cycle not finished, send what is available");
+			status_stages = 0;
+			finish_status_packet();
+		}
+		cycle_stats_start(CYCLE_STATUS);
+		status_cycle++;
 
-		// Reset the packet
+		// Reset the packet, the sequence number lets the server find duplicates from LoRa and cellular
 		g_solution_data.reset();
-
-		if (!blues_get_location())
+		g_solution_data.addSequence(sequence_next());
+		if (diag_pending())
 		{
-			MYLOG("APP", "Failed to get location");
+			// First packet after a reset tells why the device restarted
+			g_solution_data.addDiag();
+			diag_sent();
 		}
-
-		// Get battery level
-		float batt_level_f = read_batt();
-		g_solution_data.addVoltage(LPP_CHANNEL_BATT, batt_level_f / 1000.0);
-
-		// Read sensors and battery
-		if (has_rak1906)
+		timing_cycle_done();
+		if (g_blues_settings.timing_channel)
 		{
-			read_rak1906();
+			g_solution_data.addTiming();
 		}
+		status_has_location = false;
 
-		bool check_rejoin = false;
-
-		if (g_lpwan_has_joined)
+		// Start the independent stages, the packet is assembled when the last one finished
+		// BME680 conversion
+		if (has_rak1906 && start_rak1906(status_cycle))
 		{
-			/*************************************************************************************/
-			/*                                                                                   */
-			/* If the device is setup for LoRaWAN, try first to send the data as confirmed       */
-			/* packet. If the sending fails, retry over cellular modem                           */
-			/*                                                                                   */
-			/* If the device is setup for LoRa P2P, send always as P2P packet AND over the       */
-			/* cellular modem                                                           */
-			/*                                                                                   */
-			/*************************************************************************************/
-			if (g_lorawan_settings.lorawan_enable)
-			{
-				lmh_error_status result = send_lora_packet(g_solution_data.getBuffer(), g_solution_data.getSize());
-				switch (result)
-				{
-				case LMH_SUCCESS:
-					MYLOG("APP", "Packet enqueued");
-					break;
-				case LMH_BUSY:
-					re_init_lorawan();
-					result = send_lora_packet(g_solution_data.getBuffer(), g_solution_data.getSize());
-					if (result != LMH_SUCCESS)
-					{
-						// Send over cellular connection
-						delayed_sending.start();
-						check_rejoin = true;
-						send_fail++;
-						MYLOG("APP", "LoRa transceiver is busy");
-						AT_PRINTF("+EVT:BUSY\n");
-					}
-					break;
-				case LMH_ERROR:
-					re_init_lorawan();
-					result = send_lora_packet(g_solution_data.getBuffer(), g_solution_data.getSize());
-					if (result != LMH_SUCCESS)
-					{
-						// Send over cellular connection
-						delayed_sending.start();
-						check_rejoin = true;
-						send_fail++;
-						AT_PRINTF("+EVT:SIZE_ERROR\n");
-						MYLOG("APP", "Packet error, too big to send with current DR");
-					}
-					break;
-				}
-			}
-			else
-			{
-				// Add unique identifier in front of the P2P packet, here we use the DevEUI
-				g_solution_data.addDevID(LPP_CHANNEL_DEVID, &g_lorawan_settings.node_device_eui[4]);
-
-				// Send packet over LoRa
-				// if (send_p2p_packet(packet_buffer, g_solution_data.getSize() + 8))
-				if (send_p2p_packet(g_solution_data.getBuffer(), g_solution_data.getSize()))
-				{
-					MYLOG("APP", "Packet enqueued");
-				}
-				else
-				{
-					AT_PRINTF("+EVT:SIZE_ERROR\n");
-					MYLOG("APP", "Packet too big");
-				}
+			status_stages |= STAGE_BME;
+		}
 
-				// Send as well over cellular connection
-				delayed_sending.start();
-			}
+		// Location request runs in the NoteCard task
+		if (blues_queue_job(BLUES_JOB_LOCATION, NULL, 0, status_cycle))
+		{
+			status_stages |= STAGE_LOCATION;
 		}
 		else
 		{
-			// delayed_sending.start();
-			g_task_event_type |= USE_CELLULAR;
-			if (g_lorawan_settings.lorawan_enable)
-			{
-				check_rejoin = true;
-				send_fail++;
-			}
-			MYLOG("APP", "Network not joined, skip sending over LoRaWAN");
+			status_has_location = blues_update_location();
 		}
 
-		if (check_rejoin)
+		// Get battery level while the other stages are running
+		status_batt_mv = read_batt();
+		sync_set_battery(status_batt_mv);
+
+		if (status_stages == 0)
 		{
-			// Check how many times we send over LoRaWAN failed and retry to join LNS after 10 times failing
-			if (send_fail >= 10)
-			{
-				// Too many failed sendings, try to rejoin
-				MYLOG("APP", "Retry to join LNS");
-				send_fail = 0;
-				// int8_t init_result = re_init_lorawan();
-				g_lpwan_has_joined = false;
-				lmh_join();
-			}
+			finish_status_packet();
+		}
+	}
+
+	// BME680 conversion finished
+	if ((g_task_event_type & BME_DONE) == BME_DONE)
+	{
+		g_task_event_type &= N_BME_DONE;
+		if ((rak1906_done_cycle() != status_cycle) || ((status_stages & STAGE_BME) == 0))
+		{
+			// The cycle of the conversion was already sent without BME680 values
+			MYLOG("APP", "BME680 values of cycle %ld dropped", rak1906_done_cycle());
+		}
+		else
+		{
+			read_rak1906();
+			status_stage_done(STAGE_BME);
 		}
 	}
 
@@ -253,16 +259,19 @@ void app_event_handler(void)
 	if ((g_task_event_type & USE_CELLULAR) == USE_CELLULAR)
 	{
 		g_task_event_type &= N_USE_CELLULAR;
-		// Send over cellular connection
-		MYLOG("APP", "Get hub sync status:");
-		blues_hub_status();
-
-		g_solution_data.addDevID(0, &g_lorawan_settings.node_device_eui[4]);
-		blues_send_payload(g_solution_data.getBuffer(), g_solution_data.getSize());
-
-		// Request sync with NoteHub
-		blues_start_req("hub.sync");
-		blues_send_req();
+		if (cell_packet_pending)
+		{
+			cell_packet_pending = false;
+			cycle_stats_start(CYCLE_CELLULAR);
+			// Send the copy of the failed packet, a new STATUS cycle might already fill g_solution_data
+			// The NoteCard task reports the result with BLUES_DONE
+			if (!blues_queue_job(BLUES_JOB_PAYLOAD, cell_packet, cell_packet_len, BLUES_TAG_NONE))
+			{
+				// NoteCard task is busy, keep the packet for later
+				packet_queue_push(cell_packet, cell_packet_len);
+				cycle_stats_end(CYCLE_CELLULAR);
+			}
+		}
 
 		if (!g_lpwan_has_joined)
 		{
@@ -272,12 +281,67 @@ void app_event_handler(void)
 		// Check how many times we send over cellular data and retry to join LNS after 10 times failing
 		if ((send_fail >= 10) && g_lorawan_settings.lorawan_enable)
 		{
-			// Try to rejoin
-			MYLOG("APP", "Retry to join LNS");
-			send_fail = 0;
-			// int8_t init_result = re_init_lorawan();
-			g_lpwan_has_joined = false;
-			lmh_join();
+			// Try to rejoin, the scheduler decides if a join is allowed now
+			send_fail = rejoin_try() ? 0 : 10;
+		}
+	}
+
+	// NoteCard task finished a job
+	if ((g_task_event_type & BLUES_DONE) == BLUES_DONE)
+	{
+		g_task_event_type &= N_BLUES_DONE;
+		s_blues_job job;
+		while (blues_get_result(&job))
+		{
+			switch (job.type)
+			{
+			case BLUES_JOB_PAYLOAD:
+				path_cell_result(job.success);
+				if (packet_queue_cell_result(job.tag, job.success))
+				{
+					// Payload from the queue, it stays queued if it failed
+				}
+				else
+				{
+					if (!job.success)
+					{
+						// Neither LoRaWAN nor cellular worked, keep the packet for later
+						packet_queue_push(job.data, job.len);
+					}
+					// The CELLULAR cycle ends with the result of its payload
+					cycle_stats_end(CYCLE_CELLULAR);
+				}
+				if (job.success)
+				{
+					sync_note_added();
+					// Cellular link works, send stored packets as well
+					packet_queue_drain_cellular();
+				}
+				// Sync with NoteHub only if enough notes are waiting
+				sync_check();
+				break;
+			case BLUES_JOB_SYNC:
+				MYLOG("APP", "NoteHub sync %s", job.success ? "requested" : "failed");
+				sync_done(job.success);
+				break;
+			case BLUES_JOB_LOCATION:
+				if (job.tag != status_cycle)
+				{
+					// The cycle of the request was already sent without location
+					MYLOG("APP", "Location of cycle %ld dropped", job.tag);
+					break;
+				}
+				if (!job.success)
+				{
+					MYLOG("APP", "Failed to get location");
+				}
+				if ((status_stages & STAGE_LOCATION) == STAGE_LOCATION)
+				{
+					status_has_location = job.success;
+				}
+				status_stage_done(STAGE_LOCATION);
+				break;
+			}
 		}
 	}
 
@@ -288,11 +352,12 @@ void app_event_handler(void)
 		// Send over cellular connection
 		MYLOG("APP", "Blues ATTN event");
 
-		blues_start_req("card.attn");
-		blues_send_req();
+		blues_simple_req("card.attn");
+
+		blues_simple_req("card.time");
 
-		blues_start_req("card.time");
-		blues_send_req();
+		// Device is moving, switch to the short send interval
+		interval_motion_event();
 
 		// req = notecard.newRequest("card.attn");
 		// if (!blues_send_req())
@@ -305,6 +370,197 @@ void app_event_handler(void)
 	}
 }
 
+/**
+ * @brief Mark a stage of the STATUS cycle as finished
+ *        The packet is sent when the last stage finished
+ *
+ * @param stage STAGE_BME or STAGE_LOCATION
+ */
+void status_stage_done(uint8_t stage)
+{
+	if ((status_stages & stage) == 0)
+	{
+		// Stage did not run or the cycle was already finished
+		return;
+	}
+	status_stages &= ~stage;
+	if (status_stages == 0)
+	{
+		finish_status_packet();
+	}
+}
+
+/**
+ * @brief Add the results of the STATUS cycle stages to the packet and send it
+ *        The BME680 values are added when the conversion finished
+ *
+ */
+void finish_status_packet(void)
+{
+	s_location location;
+	blues_get_location(&location);
+	if (status_has_location)
+	{
+		blues_add_location(&location);
+		if (location.source == LOC_SRC_GNSS)
+		{
+			track_add_fix(location.latitude, location.longitude, location.fix_time);
+		}
+	}
+	g_solution_data.addField<PayloadField_BATT>(status_batt_mv / 1000.0);
+	// With a new GNSS fix in the packet the window stays open for the next fixes,
+	// otherwise the track has to end at the last fix
+	if (!status_has_location || (location.source != LOC_SRC_GNSS))
+	{
+		track_flush();
+	}
+	// Add as many track points as the current data rate allows
+	g_solution_data.addTrack(PAYLOAD_CH_TRACK, track_max_payload());
+	send_status_packet();
+
+	// Adapt the send interval to the motion of the device
+	interval_update();
+}
+
+/**
+ * @brief Send the sensor packet over LoRaWAN
+ *        Packets that are too large for the current data rate are split into fragments
+ *
+ * @return lmh_error_status LMH_SUCCESS if the packet or its first fragment was enqueued
+ */
+lmh_error_status send_lora_status(void)
+{
+	uint8_t max_size = lora_max_payload();
+	if ((g_solution_data.getSize() > max_size) && frag_start(g_solution_data.getBuffer(), g_solution_data.getSize(), max_size))
+	{
+		return frag_send() ? LMH_SUCCESS : LMH_BUSY;
+	}
+	lmh_error_status result = send_lora_packet(g_solution_data.getBuffer(), g_solution_data.getSize());
+	if (result == LMH_SUCCESS)
+	{
+		// Only TX cycles that were started are measured
+		timing_start(TIMING_LORA_TX);
+	}
+	return result;
+}
+
+/**
+ * @brief Send the sensor packet of a STATUS cycle
+ *        Called when all sensor values are in the packet
+ *
+ */
+void send_status_packet(void)
+{
+	bool check_rejoin = false;
+
+	// The cellular path sends this copy, even if the failure is reported after the next cycle started
+	save_cell_packet();
+
+	if (g_lpwan_has_joined)
+	{
+		/*************************************************************************************/
+		/*                                                                                   */
+		/* If the device is setup for LoRaWAN, try first to send the data as confirmed       */
+		/* packet. If the sending fails, retry over cellular modem                           */
+		/*                                                                                   */
+		/* If the device is setup for LoRa P2P, send always as P2P packet AND over the       */
+		/* cellular modem                                                           */
+		/*                                                                                   */
+		/*************************************************************************************/
+		if (g_lorawan_settings.lorawan_enable && (path_select() == PATH_CELLULAR))
+		{
+			// LoRaWAN failed too often, do not wait for it
+			MYLOG("APP", "LoRaWAN link is poor, send over cellular");
+			cell_packet_pending = true;
+			g_task_event_type |= USE_CELLULAR;
+		}
+		else if (g_lorawan_settings.lorawan_enable)
+		{
+			lmh_error_status result = send_lora_status();
+			switch (result)
+			{
+			case LMH_SUCCESS:
+				MYLOG("APP", "Packet enqueued");
+				break;
+			case LMH_BUSY:
+				re_init_lorawan();
+				result = send_lora_status();
+				if (result != LMH_SUCCESS)
+				{
+					// Send over cellular connection
+					start_cellular_fallback();
+					check_rejoin = true;
+					send_fail++;
+					MYLOG("APP", "LoRa transceiver is busy");
+					AT_PRINTF("+EVT:BUSY\n");
+				}
+				break;
+			case LMH_ERROR:
+				re_init_lorawan();
+				result = send_lora_status();
+				if (result != LMH_SUCCESS)
+				{
+					// Send over cellular connection
+					start_cellular_fallback();
+					check_rejoin = true;
+					send_fail++;
+					AT_PRINTF("+EVT:SIZE_ERROR\n");
+					MYLOG("APP", "Packet error, too big to send with current DR");
+				}
+				break;
+			}
+		}
+		else
+		{
+			// Add unique identifier in front of the P2P packet, here we use the DevEUI
+			g_solution_data.addDevID(LPP_CHANNEL_DEVID, &g_lorawan_settings.node_device_eui[4]);
+
+			// Send packet over LoRa
+			// if (send_p2p_packet(packet_buffer, g_solution_data.getSize() + 8))
+			if (send_p2p_packet(g_solution_data.getBuffer(), g_solution_data.getSize()))
+			{
+				MYLOG("APP", "Packet enqueued");
+			}
+			else
+			{
+				AT_PRINTF("+EVT:SIZE_ERROR\n");
+				MYLOG("APP", "Packet too big");
+			}
+
+			// Send as well over cellular connection
+			start_cellular_fallback();
+		}
+	}
+	else
+	{
+		// delayed_sending.start();
+		cell_packet_pending = true;
+		g_task_event_type |= USE_CELLULAR;
+		if (g_lorawan_settings.lorawan_enable)
+		{
+			check_rejoin = true;
+			send_fail++;
+		}
+		MYLOG("APP", "Network not joined, skip sending over LoRaWAN");
+	}
+
+	if (check_rejoin)
+	{
+		// Check how many times we send over LoRaWAN failed and retry to join LNS after 10 times failing
+		if (send_fail >= 10)
+		{
+			// Too many failed sendings, try to rejoin, the scheduler decides if a join is allowed now
+			send_fail = rejoin_try() ? 0 : 10;
+		}
+	}
+	// Notes waiting on the NoteCard might be due for a sync
+	if ((g_task_event_type & USE_CELLULAR) != USE_CELLULAR)
+	{
+		sync_check();
+	}
+	cycle_stats_end(CYCLE_STATUS);
+}
+
 /**
  * @brief Handle BLE events
  *
@@ -339,6 +595,7 @@ void lora_data_handler(void)
 	if ((g_task_event_type & LORA_JOIN_FIN) == LORA_JOIN_FIN)
 	{
 		g_task_event_type &= N_LORA_JOIN_FIN;
+		rejoin_result(g_join_result);
 		if (g_join_result)
 		{
 			MYLOG("APP", "Successfully joined network");
@@ -369,14 +626,31 @@ void lora_data_handler(void)
 	if ((g_task_event_type & LORA_TX_FIN) == LORA_TX_FIN)
 	{
 		g_task_event_type &= N_LORA_TX_FIN;
+		timing_end(TIMING_LORA_TX);
 
 		MYLOG("APP", "LPWAN TX cycle %s", g_rx_fin_result ? "finished ACK" : "failed NAK");
+		path_lora_result(g_rx_fin_result, g_last_rssi, g_last_snr);
 
-		if (!g_rx_fin_result)
+		uint8_t frag_result = frag_tx_fin(g_rx_fin_result);
+		if (frag_result == FRAG_SENDING)
+		{
+			// Next fragment of a split packet is on the way
+		}
+		else if (packet_queue_lora_tx_fin(g_rx_fin_result))
+		{
+			// TX cycle was for a queued packet, it stays in the queue on NAK
+			if (g_rx_fin_result)
+			{
+				send_fail = 0;
+				packet_queue_drain_lora();
+			}
+		}
+		else if (!g_rx_fin_result || (frag_result == FRAG_FAILED))
 		{
+			// A failed fragment sends the whole packet over cellular
 			if (g_lorawan_settings.lorawan_enable)
 			{
-				delayed_sending.start();
+				start_cellular_fallback();
 			}
 
 			// Increase fail send counter
@@ -386,10 +660,47 @@ void lora_data_handler(void)
 		else
 		{
 			send_fail = 0;
+			// LoRaWAN link works, send stored packets one by one
+			packet_queue_drain_lora();
 		}
 	}
 }
 
+/**
+ * @brief Start the timer for the cellular fallback
+ *        The wait time follows the quality of the LoRaWAN link
+ *
+ */
+void start_cellular_fallback(void)
+{
+	cell_packet_pending = true;
+	delayed_sending.stop();
+	delayed_sending.setPeriod(path_fallback_delay());
+	delayed_sending.start();
+}
+
+/**
+ * @brief Copy the STATUS packet for the cellular path and add the device ID
+ *        If the copy of the last cycle is still waiting for its cellular fallback,
+ *        it is kept in the store-and-forward queue instead of being overwritten.
+ *
+ */
+void save_cell_packet(void)
+{
+	if (cell_packet_pending)
+	{
+		MYLOG("APP", "Cellular fallback of the last cycle did not run, queue its packet");
+		cell_packet_pending = false;
+		packet_queue_push(cell_packet, cell_packet_len);
+	}
+	cell_packet_len = g_solution_data.getSize();
+	memcpy(cell_packet, g_solution_data.getBuffer(), cell_packet_len);
+	cell_packet[cell_packet_len++] = PAYLOAD_CH_CELL_DEVID;
+	cell_packet[cell_packet_len++] = PAYLOAD_TYPE_CELL_DEVID;
+	memcpy(&cell_packet[cell_packet_len], &g_lorawan_settings.node_device_eui[4], PayloadField_CELL_DEVID::size);
+	cell_packet_len += PayloadField_CELL_DEVID::size;
+}
+
 /**
  * @brief Timer callback to decouple the LoRaWAN sending and the cellular sending
  * 
@@ -397,5 +708,6 @@ void lora_data_handler(void)
  */
 void delayed_cellular(TimerHandle_t unused)
 {
+	(void)unused;
 	api_wake_loop(USE_CELLULAR);
 }
\ No newline at end of file
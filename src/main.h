@@ -22,21 +22,11 @@
 #define MY_DEBUG 1
 #endif
 
+#include "log_ring.h"
+
 #if MY_DEBUG > 0
-#define MYLOG(tag, ...)                     \
-	do                                      \
-	{                                       \
-		if (tag)                            \
-			PRINTF("[%s] ", tag);           \
-		PRINTF(__VA_ARGS__);                \
-		PRINTF("\n");                       \
-		Serial.flush();                     \
-		if (g_ble_uart_is_connected)        \
-		{                                   \
-			g_ble_uart.printf(__VA_ARGS__); \
-			g_ble_uart.printf("\n");        \
-		}                                   \
-	} while (0)
+// Log lines are written as binary records and printed by a low priority task, decode them with decode_log.py
+#define MYLOG(tag, ...) log_record(tag, __VA_ARGS__)
 #else
 #define MYLOG(...)
 #endif
@@ -64,17 +54,47 @@ void lora_data_handler(void);
 #define N_USE_CELLULAR 0b0111111111111111
 #define BLUES_ATTN 0b0100000000000000
 #define N_BLUES_ATTN 0b1011111111111111
+#define BLUES_DONE 0b0010000000000000
+#define N_BLUES_DONE 0b1101111111111111
+#define BME_DONE 0b0001000000000000
+#define N_BME_DONE 0b1110111111111111
+
+// Channels, Cayenne LPP types and sizes of the payload fields
+#include "payload_schema.h"
 
-// Cayenne LPP Channel numbers per sensor value
-#define LPP_CHANNEL_BATT 1	  // Base Board
-#define LPP_CHANNEL_HUMID_2 6 // RAK1906
-#define LPP_CHANNEL_TEMP_2 7  // RAK1906
-#define LPP_CHANNEL_PRESS_2 8 // RAK1906
-#define LPP_CHANNEL_GAS_2 9	  // RAK1906
-#define LPP_CHANNEL_GPS 10	  // RAK1910/RAK12500
+/** Cayenne LPP with the tracker specific data types */
+class WisCayenneTracker : public WisCayenne
+{
+public:
+	WisCayenneTracker(uint8_t size) : WisCayenne(size) {}
+	uint8_t addTrack(uint8_t channel, uint8_t max_size);
+	uint8_t addSequence(uint32_t sequence);
+	uint8_t addDiag(void);
+	uint8_t addTiming(void);
+
+	/**
+	 * @brief Add a scalar field of the payload schema
+	 *        Channel, type, size and scale are known at compile time. The schema
+	 *        is checked at compile time to fit into the buffer, so there is no size check.
+	 *
+	 * @tparam Field PayloadField_xxx
+	 * @param value value before scaling
+	 * @return uint8_t payload size
+	 */
+	template <typename Field>
+	uint8_t addField(float value)
+	{
+		static_assert((Field::size != 0) && (Field::size <= 4), "Only fixed size scalar fields");
+		_buffer[_cursor] = Field::channel;
+		_buffer[_cursor + 1] = Field::type;
+		PayloadBytes<Field::size>::put(&_buffer[_cursor + 2], (uint32_t)(int32_t)(value * Field::scale));
+		_cursor += Field::total;
+		return _cursor;
+	}
+};
 
 // Globals
-extern WisCayenne g_solution_data;
+extern WisCayenneTracker g_solution_data;
 
 // Blues.io
 struct s_blues_settings
@@ -85,23 +105,342 @@ struct s_blues_settings
 	bool use_ext_sim = false;									 // Use external SIM
 	char ext_sim_apn[256] = "internet";							 // APN to be used with external SIM
 	bool motion_trigger = true;									 // Send data on motion trigger
+	uint8_t batch_size = 5;										 // Number of notes collected before a sync
+	uint32_t min_interval = 0;									 // Send interval while moving in seconds, 0 = fixed interval
+	uint32_t max_interval = 3600;								 // Longest send interval while stationary in seconds
+	uint16_t track_tolerance = 20;								 // Allowed track error in m, 0 = send every fix
+	bool timing_channel = false;								 // Add the stage timing channel to the packets
 };
 
 bool init_blues(void);
-bool blues_start_req(String request_name);
-bool blues_send_req(void);
-void blues_hub_status(void);
-bool blues_get_location(void);
+bool blues_hub_status(char *status, uint16_t status_len);
+bool blues_hub_sync(void);
+bool blues_update_location(void);
+uint32_t blues_location_age(void);
 bool blues_enable_attn(void);
 bool blues_disable_attn(void);
 bool blues_send_payload(uint8_t *data, uint16_t data_len);
-extern J *req;
+int32_t blues_motion_count(void);
+int8_t blues_signal_bars(void);
+
+// NoteCard requests
+#define BLUES_PRIO_LOW 0	// Status and debug requests
+#define BLUES_PRIO_HIGH 1	// Data path, can use the reserved request context
+
+class BluesRequest
+{
+public:
+	BluesRequest(const char *request_name, uint8_t priority = BLUES_PRIO_LOW);
+	~BluesRequest();
+	J *json(void);
+	J *response(void);
+	bool send(void);
+	bool print(char *buffer, int size);
+	void release(void);
+
+private:
+	int8_t _ctx;
+	uint8_t _priority;
+};
+
+bool blues_simple_req(const char *request_name, uint8_t priority = BLUES_PRIO_LOW);
+
+struct s_arena_stats
+{
+	uint32_t high_water_mark;	// Highest arena usage in bytes
+	uint32_t resets;			// Number of bulk releases
+	uint32_t heap_fallbacks;	// Allocations that did not fit into the arena
+	uint32_t leaked_blocks;		// Blocks that were not freed before a bulk release
+};
+
+// Location sources
+#define LOC_SRC_NONE 0	// No location available
+#define LOC_SRC_GNSS 1	// GNSS fix of the NoteCard
+#define LOC_SRC_TOWER 2	// Cell tower location
+
+struct s_location
+{
+	double latitude;	// A float loses up to 0.4 m at a longitude above 64 deg
+	double longitude;
+	float altitude;
+	uint32_t fix_time;		// Epoch time of the fix as reported by the NoteCard
+	uint32_t updated_ms;	// millis() when the fix was taken into the cache
+	uint8_t source = LOC_SRC_NONE;
+};
+
 extern s_blues_settings g_blues_settings;
-extern char blues_response[];
+extern s_arena_stats g_arena_stats;
+extern s_location g_last_location;
+void blues_get_location(s_location *location);
+void blues_add_location(s_location *location);
 
 // User AT commands
 void init_user_at(void);
 bool read_blues_settings(void);
 void save_blues_settings(void);
+void clear_blues_settings(void);
+
+// NoteCard task
+#define BLUES_JOB_PAYLOAD 0			// Add a note with a payload
+#define BLUES_JOB_SYNC 1			// Sync notes with NoteHub
+#define BLUES_JOB_LOCATION 2		// Update the cached location
+#define BLUES_JOB_PAYLOAD_SIZE 128	// Maximum payload size of a job
+#define BLUES_TAG_NONE 0xFFFFFFFF	// Tag of jobs that belong to no cycle or queued record
+
+struct s_blues_job
+{
+	uint8_t type;							// BLUES_JOB_PAYLOAD, BLUES_JOB_SYNC or BLUES_JOB_LOCATION
+	bool success;							// Result of the job
+	uint32_t tag;							// Cycle or record the job belongs to, returned with the result
+	uint8_t len;							// Payload length
+	uint8_t data[BLUES_JOB_PAYLOAD_SIZE];	// Payload
+};
+
+bool init_blues_task(void);
+bool blues_in_task(void);
+bool blues_queue_job(uint8_t type, uint8_t *data, uint16_t data_len, uint32_t tag);
+bool blues_get_result(s_blues_job *job);
+
+// Store-and-forward queue
+#define QUEUE_PAYLOAD_SIZE 116	// Maximum payload size that can be queued
+static_assert(PAYLOAD_FIXED_MAX <= QUEUE_PAYLOAD_SIZE, "Payload schema does not fit into the store-and-forward queue");
+
+struct s_queue_stats
+{
+	uint32_t depth;					// Number of payloads in the queue
+	uint32_t drops;					// Payloads dropped because the queue was full or corrupted
+	uint32_t drained;				// Payloads sent from the queue
+	uint32_t drain_ms_per_packet;	// Send time per payload of the last drain
+	uint32_t drain_start_ms;		// Start time of the last drain
+};
+
+void init_packet_queue(void);
+bool packet_queue_push(uint8_t *data, uint16_t data_len);
+uint16_t packet_queue_drain_cellular(void);
+bool packet_queue_cell_result(uint32_t seq, bool success);
+bool packet_queue_drain_lora(void);
+bool packet_queue_lora_tx_fin(bool ack);
+void packet_queue_clear(void);
+extern s_queue_stats g_queue_stats;
+
+// NoteHub sync scheduler
+struct s_sync_state
+{
+	uint16_t pending_notes;		// Notes added since the last successful sync
+	uint16_t queued_notes;		// Pending notes when the running sync was queued
+	uint32_t oldest_note_ms;	// millis() when the oldest pending note was added
+	uint16_t batt_mv;			// Last battery level
+	uint8_t failed_syncs;		// Failed syncs in a row
+	uint32_t last_try_ms;		// millis() of the last sync request
+	uint32_t syncs;				// Number of successful syncs
+	bool sync_queued;			// A sync job is waiting for the NoteCard task
+};
+
+void sync_note_added(void);
+void sync_set_battery(float batt_mv);
+bool sync_is_due(void);
+void sync_done(bool success);
+bool sync_check(void);
+extern s_sync_state g_sync_state;
+
+// Cycle statistics
+#define CYCLE_STATUS 0		// Timer triggered sensor and location cycle
+#define CYCLE_CELLULAR 1	// Send over cellular connection
+#define CYCLE_NUM 2			// Number of cycle types
+
+struct s_cycle_stats
+{
+	uint32_t cycles;		// Number of finished cycles
+	uint32_t last_time_ms;	// Wall time of the last cycle
+	uint32_t max_time_ms;	// Longest cycle
+	uint32_t sum_time_ms;	// Sum of all cycle times, used for average
+	uint16_t last_nc_trans;	// NoteCard transactions in the last cycle
+	uint16_t max_nc_trans;	// Maximum NoteCard transactions in one cycle
+	uint32_t sum_nc_trans;	// Sum of all NoteCard transactions
+	uint32_t heap_hwm;		// Heap high water mark in bytes
+};
+
+void cycle_stats_start(uint8_t type);
+void cycle_stats_end(uint8_t type);
+void cycle_stats_job(uint8_t type);
+void cycle_stats_bus_transaction(void);
+void cycle_stats_heap_check(void);
+void cycle_stats_reset(void);
+extern s_cycle_stats g_cycle_stats[];
+
+// Adaptive send interval
+struct s_interval_state
+{
+	uint32_t interval_ms;	// Send interval in use, 0 if not adapted yet
+	uint8_t still_cycles;	// Cycles without motion
+	bool moving;			// Result of the last cycle
+	float speed;			// Speed between the last two GNSS fixes in m/s
+	float last_latitude;	// Last GNSS fix used for the speed
+	float last_longitude;
+	uint32_t last_fix_time;	// Epoch time of the last GNSS fix used for the speed
+};
+
+float interval_distance(float lat_1, float lon_1, float lat_2, float lon_2);
+bool interval_is_adaptive(void);
+uint32_t interval_current(void);
+void interval_set_motion(int32_t count);
+void interval_update(void);
+void interval_motion_event(void);
+void interval_reset(void);
+extern s_interval_state g_interval_state;
+
+// Track simplification
+#define TRACK_MAX_POINTS 32 // Significant points kept until they are sent
+
+struct s_track_point
+{
+	int32_t latitude;  // 0.000001 deg, the resolution of the payload
+	int32_t longitude; // 0.000001 deg
+	uint32_t fix_time; // Epoch time of the fix
+};
+
+struct s_track_stats
+{
+	uint32_t fixes_in;	 // GNSS fixes added to the track
+	uint32_t points_out; // Significant points
+	uint32_t dropped;	 // Points dropped because the buffer was full
+};
+
+void track_add_fix(double latitude, double longitude, uint32_t fix_time);
+void track_flush(void);
+uint8_t track_available(void);
+s_track_point *track_peek(uint8_t idx);
+void track_consume(uint8_t count);
+void track_reset(void);
+uint8_t track_max_payload(void);
+extern s_track_stats g_track_stats;
+
+// LoRaWAN fragmentation
+#define FRAG_IDLE 0	   // No fragmented packet in progress
+#define FRAG_SENDING 1 // Next fragment is enqueued
+#define FRAG_FAILED 2  // Fragment could not be sent
+
+uint8_t lora_max_payload(void);
+bool frag_start(uint8_t *data, uint8_t len, uint8_t max_size);
+bool frag_send(void);
+uint8_t frag_tx_fin(bool ack);
+
+// Sequence number of the readings
+void init_sequence(void);
+uint32_t sequence_next(void);
+
+// Path selection
+#define PATH_LORA 0		// Send over LoRaWAN, cellular is the fallback
+#define PATH_CELLULAR 1 // Send over cellular only
+
+struct s_path_stats
+{
+	float lora_success;		// Rolling LoRaWAN ACK rate 0 to 1
+	int16_t lora_rssi;		// RSSI of the last ACK
+	int8_t lora_snr;		// SNR of the last ACK
+	float cell_success;		// Rolling rate of notes accepted by the NoteCard 0 to 1
+	int8_t cell_bars;		// Signal bars of the NoteCard, -1 if unknown
+	uint8_t cycles_skipped;	// Readings since LoRaWAN was tried the last time
+	uint32_t skipped;		// Readings that skipped LoRaWAN
+};
+
+void init_path_selector(void);
+void path_lora_result(bool ack, int16_t rssi, int8_t snr);
+void path_cell_result(bool success);
+void path_cell_signal(int8_t bars);
+uint8_t path_select(void);
+uint32_t path_fallback_delay(void);
+extern s_path_stats g_path_stats;
+
+// LoRaWAN rejoin scheduler
+struct s_rejoin_state
+{
+	uint16_t valid_mark;	// Validity marker
+	uint32_t attempts;		// Join cycles started by the scheduler
+	uint32_t joined;		// Successful join cycles
+	uint8_t failures;		// Failed join cycles in a row
+	float success_rate;		// Rolling join success rate 0 to 1
+	uint32_t airtime_ms;	// Estimated airtime of all join requests
+	uint32_t wait_ms;		// Wait time before the next join when the state was saved
+};
+
+void init_rejoin(void);
+bool rejoin_try(void);
+void rejoin_result(bool success);
+void rejoin_reset(void);
+uint32_t rejoin_wait(void);
+extern s_rejoin_state g_rejoin_state;
+
+// Reset diagnostics
+#define DIAG_CAUSE_POWER_ON 0	  // Power on or brown out
+#define DIAG_CAUSE_PIN 1		  // Reset pin
+#define DIAG_CAUSE_WATCHDOG 2	  // Watchdog
+#define DIAG_CAUSE_SOFT 3		  // Software reset without reason, e.g. ATZ or firmware update
+#define DIAG_CAUSE_LOCKUP 4		  // CPU lockup after a fault
+#define DIAG_CAUSE_WAKEUP 5		  // Wake up from system off
+#define DIAG_CAUSE_NOTE_MEMORY 6  // NoteCard ran out of memory
+#define DIAG_ERROR_SIZE 32		  // Size of the saved NoteCard error
+#define DIAG_LOG_RECORDS 4		  // Log records saved from before the reset, debug build only
+
+struct s_diag_record
+{
+	uint16_t valid_mark;				 // Validity marker
+	uint16_t boots;						 // Number of starts
+	uint16_t abnormal;					 // Resets by watchdog, lockup or the application
+	uint8_t cause;						 // Cause of the last reset
+	uint32_t uptime_s;					 // Uptime before the last reset
+	uint32_t heap_hwm;					 // Heap high water mark before the last reset
+	char note_error[DIAG_ERROR_SIZE];	 // Last NoteCard error before the last reset
+	uint8_t log_count;					 // Number of saved log records
+	s_log_record log[DIAG_LOG_RECORDS];	 // Last log records before the last reset
+};
+
+void init_diag(void);
+void diag_update(void);
+void diag_note_error(const char *error);
+void diag_reset(uint8_t cause);
+bool diag_pending(void);
+void diag_sent(void);
+void diag_clear(void);
+extern s_diag_record g_diag;
+
+// Stage timing
+#define TIMING_EVENT 0		// App event handler
+#define TIMING_BME 1		// BME680 conversion and read
+#define TIMING_LOCATION 2	// Location request to the NoteCard
+#define TIMING_CELL_SEND 3	// Note with payload to the NoteCard
+#define TIMING_LORA_TX 4	// LoRaWAN TX cycle until TX finished
+#define TIMING_NUM 5		// Number of stages
+#define TIMING_BUCKETS 16	// Histogram buckets, bucket n counts times below 2^n ms
+
+struct s_timing_stats
+{
+	uint32_t count;							// Number of measurements
+	uint32_t sum_ms;						// Sum of the wall times
+	uint32_t max_ms;						// Longest wall time
+	uint32_t sum_active_us;					// Sum of the times the CPU was running
+	float sum_uah;							// Sum of the estimated charge
+	uint16_t histogram[TIMING_BUCKETS];		// Wall time histogram
+};
+
+void init_timing(void);
+void timing_start(uint8_t stage);
+void timing_end(uint8_t stage);
+void timing_cycle_done(void);
+uint32_t timing_avg_ms(uint8_t stage);
+void timing_reset(void);
+extern s_timing_stats g_timing_stats[];
+extern float g_timing_cycle_uah;
+
+/** Measures a stage until the end of the function */
+class StageTimer
+{
+public:
+	StageTimer(uint8_t stage) : _stage(stage) { timing_start(stage); }
+	~StageTimer() { timing_end(_stage); }
+
+private:
+	uint8_t _stage;
+};
 
 #endif // _MAIN_H_
\ No newline at end of file
@@ -0,0 +1,553 @@
+/**
+ * @file packet_queue.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Persistent store-and-forward queue for payloads that could not be sent
+ * @version 0.1
+ * @date 2023-09-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Filename of the queue of older firmware, all slots in one file */
+static const char queue_legacy_name[] = "PQUEUE";
+
+/** Filename of a slot, the slot number is added */
+#define QUEUE_SLOT_PREFIX "PQ"
+
+/** Size of a slot filename */
+#define QUEUE_SLOT_NAME_SIZE 8
+
+/** Filename of the sent position */
+static const char queue_head_file_name[] = "PQHEAD";
+
+/** Marker for a valid record */
+#define QUEUE_MARK 0x5150
+
+/** Record states, records are written as pending. Only files of older firmware have sent records. */
+#define QUEUE_REC_PENDING 0xFF
+#define QUEUE_REC_SENT 0x00
+
+/** Number of records in the ring */
+#define QUEUE_SLOTS 64
+
+/** Records handed to the NoteCard task at the same time, the job queue keeps room for location and sync jobs */
+#define QUEUE_CELL_JOBS 2
+
+/** One queue record, each slot of the ring is its own file */
+struct s_queue_record
+{
+	uint16_t mark;							// Validity marker
+	uint8_t state;							// QUEUE_REC_PENDING, QUEUE_REC_SENT in files of older firmware
+	uint8_t len;							// Payload length
+	uint32_t seq;							// Record sequence number
+	uint32_t crc;							// CRC32 over seq, len and payload
+	uint8_t payload[QUEUE_PAYLOAD_SIZE];	// Payload as it would be sent
+};
+
+/** File for the queue */
+static File queue_file(InternalFS);
+
+/** Sequence number of the oldest pending record */
+static uint32_t queue_head = 0;
+
+/** Sequence number for the next record */
+static uint32_t queue_tail = 0;
+
+/** Sequence number of the record in flight over LoRaWAN, UINT32_MAX if none */
+static uint32_t queue_lora_inflight = UINT32_MAX;
+
+/** Sequence number of the next record for the NoteCard task */
+static uint32_t queue_cell_next = 0;
+
+/** Number of records handed to the NoteCard task without result */
+static uint8_t queue_cell_inflight = 0;
+
+/** Flag if a record of the running cellular drain failed, later results do not remove records */
+static bool queue_cell_failed = false;
+
+/** Time of the last cellular drain result, millis() */
+static uint32_t queue_cell_last_ms = 0;
+
+/** Queue statistics */
+s_queue_stats g_queue_stats;
+
+/** Sent position as saved in its own file */
+struct s_queue_head
+{
+	uint32_t head;	// Sequence number of the oldest record that was not sent
+	uint32_t check; // Inverted head
+};
+
+/**
+ * @brief Update a CRC32 with a block of data
+ *
+ * @param crc CRC32 so far
+ * @param data data to add
+ * @param len length of data
+ * @return uint32_t updated CRC32
+ */
+static uint32_t queue_crc_update(uint32_t crc, const uint8_t *data, uint16_t len)
+{
+	for (uint16_t idx = 0; idx < len; idx++)
+	{
+		crc ^= data[idx];
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief Calculate the CRC32 of a record
+ *        The state is not included, older firmware changed it when the record was sent
+ *
+ * @param record record to check
+ * @return uint32_t CRC32
+ */
+static uint32_t queue_crc(s_queue_record *record)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	crc = queue_crc_update(crc, (uint8_t *)&record->seq, sizeof(record->seq));
+	crc = queue_crc_update(crc, &record->len, 1);
+	crc = queue_crc_update(crc, record->payload, record->len);
+	return ~crc;
+}
+
+/**
+ * @brief Get the filename of a slot
+ *
+ * @param slot slot number
+ * @param name buffer of QUEUE_SLOT_NAME_SIZE bytes for the name
+ */
+static void queue_slot_name(uint32_t slot, char *name)
+{
+	snprintf(name, QUEUE_SLOT_NAME_SIZE, QUEUE_SLOT_PREFIX "%02d", (int)slot);
+}
+
+/**
+ * @brief Check a record that was read
+ *
+ * @param record record to check
+ * @param slot slot the record was read from
+ * @return true if the record is complete and belongs to this slot
+ */
+static bool queue_valid(s_queue_record *record, uint32_t slot)
+{
+	return (record->mark == QUEUE_MARK) && ((record->seq % QUEUE_SLOTS) == slot) && (record->len <= QUEUE_PAYLOAD_SIZE) && (record->crc == queue_crc(record));
+}
+
+/**
+ * @brief Read the record of a slot
+ *
+ * @param slot slot number
+ * @param record buffer for the record
+ * @return true if the slot holds a valid record
+ * @return false if the slot is empty or corrupted
+ */
+static bool queue_read_slot(uint32_t slot, s_queue_record *record)
+{
+	char name[QUEUE_SLOT_NAME_SIZE];
+	queue_slot_name(slot, name);
+	if (!queue_file.open(name, FILE_O_READ))
+	{
+		return false;
+	}
+	bool read_ok = queue_file.read((void *)record, sizeof(s_queue_record)) == sizeof(s_queue_record);
+	queue_file.close();
+	return read_ok && queue_valid(record, slot);
+}
+
+/**
+ * @brief Write a record into its slot
+ *        Each slot is a small file of its own. LittleFS rewrites a file from the
+ *        written position to its end, in a single file for all slots a record in
+ *        the middle would cost the rest of the ring. The new content becomes
+ *        valid when the file is closed, a reset keeps the old record.
+ *
+ * @param record record to write
+ * @return true if the record was written
+ */
+static bool queue_write_slot(s_queue_record *record)
+{
+	char name[QUEUE_SLOT_NAME_SIZE];
+	queue_slot_name(record->seq % QUEUE_SLOTS, name);
+	if (!queue_file.open(name, FILE_O_WRITE))
+	{
+		return false;
+	}
+	queue_file.seek(0);
+	bool written = queue_file.write((const uint8_t *)record, sizeof(s_queue_record)) == sizeof(s_queue_record);
+	queue_file.close();
+	return written;
+}
+
+/**
+ * @brief Read a record from its slot
+ *
+ * @param seq sequence number of the record
+ * @param record buffer for the record
+ * @return true if the slot holds a valid record with this sequence number
+ * @return false if the slot is empty, corrupted or holds another record
+ */
+static bool queue_read(uint32_t seq, s_queue_record *record)
+{
+	return queue_read_slot(seq % QUEUE_SLOTS, record) && (record->seq == seq);
+}
+
+/**
+ * @brief Move the records of the single queue file of older firmware into slot files
+ *
+ */
+static void queue_migrate(void)
+{
+	if (!InternalFS.exists(queue_legacy_name))
+	{
+		return;
+	}
+	s_queue_record record;
+	uint8_t moved = 0;
+	for (uint32_t slot = 0; slot < QUEUE_SLOTS; slot++)
+	{
+		if (!queue_file.open(queue_legacy_name, FILE_O_READ))
+		{
+			break;
+		}
+		bool read_ok = queue_file.seek(slot * sizeof(s_queue_record)) && (queue_file.read((void *)&record, sizeof(s_queue_record)) == sizeof(s_queue_record));
+		queue_file.close();
+		if (read_ok && queue_valid(&record, slot) && queue_write_slot(&record))
+		{
+			moved++;
+		}
+	}
+	InternalFS.remove(queue_legacy_name);
+	MYLOG("QUEUE", "Moved %d records into slot files", moved);
+}
+
+/**
+ * @brief Save the sent position
+ *        LittleFS rewrites a file from the written position to its end, even for a
+ *        single byte. The sent position is kept in its own small file instead of a
+ *        state byte in the records, so sending a record does not rewrite a slot.
+ *        Files this small are stored inside the directory entry.
+ *
+ */
+static void queue_save_head(void)
+{
+	s_queue_head saved = {queue_head, ~queue_head};
+	if (queue_file.open(queue_head_file_name, FILE_O_WRITE))
+	{
+		queue_file.seek(0);
+		queue_file.write((const uint8_t *)&saved, sizeof(s_queue_head));
+		queue_file.close();
+	}
+}
+
+/**
+ * @brief Remove the sent records from the queue
+ *
+ * @param new_head sequence number of the oldest record that was not sent
+ */
+static void queue_advance(uint32_t new_head)
+{
+	if (new_head == queue_head)
+	{
+		return;
+	}
+	queue_head = new_head;
+	g_queue_stats.depth = queue_tail - queue_head;
+	queue_save_head();
+}
+
+/**
+ * @brief Recover head and tail of the queue from the records in the file
+ *
+ */
+void init_packet_queue(void)
+{
+	s_queue_record record;
+	bool found = false;
+	uint32_t oldest_pending = UINT32_MAX;
+	uint32_t newest = 0;
+
+	queue_head = 0;
+	queue_tail = 0;
+	queue_migrate();
+	for (uint32_t slot = 0; slot < QUEUE_SLOTS; slot++)
+	{
+		if (!queue_read_slot(slot, &record))
+		{
+			continue;
+		}
+		if (!found || (record.seq > newest))
+		{
+			newest = record.seq;
+		}
+		if ((record.state == QUEUE_REC_PENDING) && (record.seq < oldest_pending))
+		{
+			oldest_pending = record.seq;
+		}
+		found = true;
+	}
+
+	if (found)
+	{
+		queue_tail = newest + 1;
+		queue_head = oldest_pending == UINT32_MAX ? queue_tail : oldest_pending;
+
+		// The saved sent position is used if it fits to the records, files of older firmware have the sent state in the records
+		s_queue_head saved;
+		if (queue_file.open(queue_head_file_name, FILE_O_READ))
+		{
+			if ((queue_file.read((void *)&saved, sizeof(s_queue_head)) == sizeof(s_queue_head)) && (saved.check == ~saved.head) && (saved.head <= queue_tail))
+			{
+				queue_head = saved.head;
+			}
+			queue_file.close();
+		}
+		// Pending records older than one ring length were overwritten
+		if (queue_tail - queue_head > QUEUE_SLOTS)
+		{
+			queue_head = queue_tail - QUEUE_SLOTS;
+		}
+	}
+	g_queue_stats.depth = queue_tail - queue_head;
+	MYLOG("QUEUE", "%ld queued packets", g_queue_stats.depth);
+}
+
+/**
+ * @brief Store a payload that could not be sent over any link
+ *        If the queue is full, the oldest record is dropped.
+ *        The record replaces the file of its slot in the ring, a write costs one
+ *        record, not the rest of the ring. Writes only happen when both links failed.
+ *
+ * @param data payload
+ * @param data_len payload length
+ * @return true if the payload was stored
+ * @return false if the payload is too large or could not be written
+ */
+bool packet_queue_push(uint8_t *data, uint16_t data_len)
+{
+	if (data_len > QUEUE_PAYLOAD_SIZE)
+	{
+		MYLOG("QUEUE", "Payload too large for queue: %d bytes", data_len);
+		g_queue_stats.drops++;
+		return false;
+	}
+
+	s_queue_record record;
+	memset((void *)&record, 0, sizeof(s_queue_record));
+	record.mark = QUEUE_MARK;
+	record.state = QUEUE_REC_PENDING;
+	record.len = data_len;
+	record.seq = queue_tail;
+	memcpy(record.payload, data, data_len);
+	record.crc = queue_crc(&record);
+
+	if (!queue_write_slot(&record))
+	{
+		MYLOG("QUEUE", "Could not write queue record");
+		g_queue_stats.drops++;
+		return false;
+	}
+
+	queue_tail++;
+	if (queue_tail - queue_head > QUEUE_SLOTS)
+	{
+		// Oldest record was overwritten
+		queue_advance(queue_tail - QUEUE_SLOTS);
+		g_queue_stats.drops++;
+	}
+	g_queue_stats.depth = queue_tail - queue_head;
+	MYLOG("QUEUE", "Queued packet %ld, %ld in queue", record.seq, g_queue_stats.depth);
+	return true;
+}
+
+/**
+ * @brief Send queued payloads over the cellular connection
+ *        The records are handed to the NoteCard task as payload jobs tagged with
+ *        their sequence number, up to QUEUE_CELL_JOBS at a time. A record is removed
+ *        when packet_queue_cell_result() gets its result.
+ *
+ * @return uint16_t number of records handed to the NoteCard task
+ */
+uint16_t packet_queue_drain_cellular(void)
+{
+	s_queue_record record;
+	uint16_t queued = 0;
+
+	if (queue_cell_inflight == 0)
+	{
+		queue_cell_next = queue_head;
+		queue_cell_failed = false;
+		queue_cell_last_ms = millis();
+	}
+
+	while ((queue_cell_next != queue_tail) && (queue_cell_inflight < QUEUE_CELL_JOBS))
+	{
+		if (queue_cell_next == queue_lora_inflight)
+		{
+			break;
+		}
+		if (!queue_read(queue_cell_next, &record))
+		{
+			// Corrupted, skip it
+			g_queue_stats.drops++;
+			if (queue_cell_next == queue_head)
+			{
+				queue_advance(queue_head + 1);
+			}
+			queue_cell_next++;
+			continue;
+		}
+		if (!blues_queue_job(BLUES_JOB_PAYLOAD, record.payload, record.len, queue_cell_next))
+		{
+			break;
+		}
+		queue_cell_inflight++;
+		queue_cell_next++;
+		queued++;
+	}
+
+	if (queued != 0)
+	{
+		MYLOG("QUEUE", "Sending %d queued packets over cellular, %ld in queue", queued, g_queue_stats.depth);
+	}
+	return queued;
+}
+
+/**
+ * @brief Handle the result of a payload job
+ *        The NoteCard task finishes the jobs in order, a sent record removes
+ *        all records up to it. After a failure the records stay queued.
+ *
+ * @param seq tag of the job, sequence number of the record or BLUES_TAG_NONE
+ * @param success true if the NoteCard accepted the note
+ * @return true if the job was for a queued record
+ * @return false if the job was for a live payload
+ */
+bool packet_queue_cell_result(uint32_t seq, bool success)
+{
+	if (seq == BLUES_TAG_NONE)
+	{
+		return false;
+	}
+	if (queue_cell_inflight != 0)
+	{
+		queue_cell_inflight--;
+	}
+	if (!success)
+	{
+		queue_cell_failed = true;
+		return true;
+	}
+	// Records that were dropped from the queue while the job was waiting are ignored
+	if (!queue_cell_failed && ((seq - queue_head) < (queue_tail - queue_head)))
+	{
+		queue_advance(seq + 1);
+		g_queue_stats.drained++;
+		g_queue_stats.drain_ms_per_packet = millis() - queue_cell_last_ms;
+		queue_cell_last_ms = millis();
+	}
+	return true;
+}
+
+/**
+ * @brief Send the oldest queued payload over LoRaWAN
+ *        The record is removed when the TX cycle finished with ACK
+ *
+ * @return true if a queued payload was enqueued for sending
+ * @return false if the queue is empty or sending failed
+ */
+bool packet_queue_drain_lora(void)
+{
+	s_queue_record record;
+
+	uint32_t new_head = queue_head;
+	while (new_head != queue_tail)
+	{
+		if (queue_read(new_head, &record))
+		{
+			break;
+		}
+		// Corrupted, skip it
+		g_queue_stats.drops++;
+		new_head++;
+	}
+	queue_advance(new_head);
+	if ((queue_head == queue_tail) || (queue_cell_inflight != 0))
+	{
+		// Empty or the records are sent over cellular
+		return false;
+	}
+
+	g_queue_stats.drain_start_ms = millis();
+	if (send_lora_packet(record.payload, record.len) != LMH_SUCCESS)
+	{
+		return false;
+	}
+	timing_start(TIMING_LORA_TX);
+	queue_lora_inflight = queue_head;
+	MYLOG("QUEUE", "Sending queued packet %ld over LoRaWAN", queue_head);
+	return true;
+}
+
+/**
+ * @brief Handle the end of a LoRaWAN TX cycle
+ *
+ * @param ack true if the TX cycle finished with ACK
+ * @return true if the TX cycle was for a queued payload
+ * @return false if the TX cycle was for a live payload
+ */
+bool packet_queue_lora_tx_fin(bool ack)
+{
+	if (queue_lora_inflight == UINT32_MAX)
+	{
+		return false;
+	}
+	if (ack && (queue_lora_inflight == queue_head))
+	{
+		queue_advance(queue_head + 1);
+		g_queue_stats.drained++;
+		g_queue_stats.drain_ms_per_packet = millis() - g_queue_stats.drain_start_ms;
+	}
+	queue_lora_inflight = UINT32_MAX;
+	return true;
+}
+
+/**
+ * @brief Remove all queued payloads
+ *
+ */
+void packet_queue_clear(void)
+{
+	char name[QUEUE_SLOT_NAME_SIZE];
+	for (uint32_t slot = 0; slot < QUEUE_SLOTS; slot++)
+	{
+		queue_slot_name(slot, name);
+		if (InternalFS.exists(name))
+		{
+			InternalFS.remove(name);
+		}
+	}
+	if (InternalFS.exists(queue_legacy_name))
+	{
+		InternalFS.remove(queue_legacy_name);
+	}
+	if (InternalFS.exists(queue_head_file_name))
+	{
+		InternalFS.remove(queue_head_file_name);
+	}
+	queue_head = queue_tail = 0;
+	queue_lora_inflight = UINT32_MAX;
+	queue_cell_next = 0;
+	queue_cell_inflight = 0;
+	g_queue_stats.depth = 0;
+}
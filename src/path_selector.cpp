@@ -0,0 +1,142 @@
+/**
+ * @file path_selector.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Select LoRaWAN or cellular from the recent link quality
+ * @version 0.1
+ * @date 2023-09-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Weight of a new result in the rolling success rates */
+#define PATH_EWMA_WEIGHT 0.125
+
+/** LoRaWAN success rate below which cellular is used directly */
+#define PATH_LORA_POOR 0.25
+
+/** LoRaWAN success rate below which a weak link is skipped */
+#define PATH_LORA_WEAK 0.5
+
+/** RSSI in dBm and SNR in dB of the last ACK below which the LoRaWAN link is close to its limit */
+#define PATH_RSSI_WEAK -115
+#define PATH_SNR_WEAK -10
+
+/** Cellular success rate needed to skip LoRaWAN */
+#define PATH_CELL_USABLE 0.5
+
+/** While LoRaWAN is skipped, it is tried again every PATH_PROBE_CYCLES readings */
+#define PATH_PROBE_CYCLES 8
+
+/** Shortest and longest wait before the cellular fallback */
+#define PATH_FALLBACK_MIN_MS 1000
+#define PATH_FALLBACK_MAX_MS 15000
+
+/** Link statistics */
+s_path_stats g_path_stats;
+
+/** Signal bars of the NoteCard, written by the NoteCard task */
+static volatile int8_t path_cell_bars = -1;
+
+/**
+ * @brief Set the start values, both links are assumed to work
+ *
+ */
+void init_path_selector(void)
+{
+	g_path_stats.lora_success = 1.0;
+	g_path_stats.cell_success = 1.0;
+	g_path_stats.lora_rssi = 0;
+	g_path_stats.lora_snr = 0;
+	g_path_stats.cell_bars = -1;
+	g_path_stats.skipped = 0;
+	g_path_stats.cycles_skipped = 0;
+}
+
+/**
+ * @brief Update the LoRaWAN statistics after a TX cycle
+ *
+ * @param ack true if the TX cycle finished with ACK
+ * @param rssi RSSI of the last received packet
+ * @param snr SNR of the last received packet
+ */
+void path_lora_result(bool ack, int16_t rssi, int8_t snr)
+{
+	g_path_stats.lora_success += ((ack ? 1.0 : 0.0) - g_path_stats.lora_success) * PATH_EWMA_WEIGHT;
+	if (ack)
+	{
+		// One good probe is enough to use LoRaWAN first again
+		if (g_path_stats.lora_success < PATH_LORA_POOR)
+		{
+			g_path_stats.lora_success = PATH_LORA_POOR;
+		}
+		g_path_stats.lora_rssi = rssi;
+		g_path_stats.lora_snr = snr;
+	}
+}
+
+/**
+ * @brief Update the cellular statistics after a note was added
+ *
+ * @param success true if the NoteCard accepted the note
+ */
+void path_cell_result(bool success)
+{
+	g_path_stats.cell_success += ((success ? 1.0 : 0.0) - g_path_stats.cell_success) * PATH_EWMA_WEIGHT;
+	g_path_stats.cell_bars = path_cell_bars;
+}
+
+/**
+ * @brief Remember the signal bars of the NoteCard
+ *        Called from the NoteCard task
+ *
+ * @param bars signal bars 0 to 4, -1 if unknown
+ */
+void path_cell_signal(int8_t bars)
+{
+	path_cell_bars = bars;
+}
+
+/**
+ * @brief Select the path for the next reading
+ *        LoRaWAN is cheaper and used as long as it works. If most of the
+ *        recent LoRaWAN packets failed and the cellular link works, LoRaWAN
+ *        is skipped and only tried again every PATH_PROBE_CYCLES readings.
+ *        If RSSI or SNR of the last ACK show a link close to its limit,
+ *        LoRaWAN is already skipped when half of the packets failed.
+ *
+ * @return uint8_t PATH_LORA or PATH_CELLULAR
+ */
+uint8_t path_select(void)
+{
+	bool lora_weak = (g_path_stats.lora_rssi < PATH_RSSI_WEAK) || (g_path_stats.lora_snr < PATH_SNR_WEAK);
+	if (g_path_stats.lora_success >= (lora_weak ? PATH_LORA_WEAK : PATH_LORA_POOR))
+	{
+		g_path_stats.cycles_skipped = 0;
+		return PATH_LORA;
+	}
+
+	bool cell_usable = (g_path_stats.cell_success >= PATH_CELL_USABLE) && (g_path_stats.cell_bars != 0);
+	if (!cell_usable || (g_path_stats.cycles_skipped >= PATH_PROBE_CYCLES))
+	{
+		// Probe LoRaWAN, a good result brings the success rate up again
+		g_path_stats.cycles_skipped = 0;
+		return PATH_LORA;
+	}
+	g_path_stats.cycles_skipped++;
+	g_path_stats.skipped++;
+	return PATH_CELLULAR;
+}
+
+/**
+ * @brief Get the wait time before a packet that failed on LoRaWAN is sent over cellular
+ *        With a good LoRaWAN link a failure is rare and the full time is used to
+ *        keep LoRaWAN and cellular apart. With a poor link the fallback is faster.
+ *
+ * @return uint32_t wait time in milliseconds
+ */
+uint32_t path_fallback_delay(void)
+{
+	return PATH_FALLBACK_MIN_MS + (uint32_t)(g_path_stats.lora_success * (PATH_FALLBACK_MAX_MS - PATH_FALLBACK_MIN_MS));
+}
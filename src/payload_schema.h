@@ -0,0 +1,103 @@
+/**
+ * @file payload_schema.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Payload schema, channels, Cayenne LPP types and sizes of all fields
+ *        The Decoder.js type table is generated from this file by gen_decoder.py
+ * @version 0.1
+ * @date 2023-09-27
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef PAYLOAD_SCHEMA_H
+#define PAYLOAD_SCHEMA_H
+#include <stdint.h>
+
+/**
+ * Fields of the payload
+ * FIELD(id, channel, LPP type, data size (0 = variable), scale, signed, layout, decoder name)
+ * A SCALAR field is one value, multiplied by scale and written MSB first.
+ * The other layouts have their own decoder in lpp_decoder.h and Decoder.js,
+ * gen_decoder.py fails the build if Decoder.js has no decoder for one of them:
+ *  GPS_6     latitude and longitude 4 bytes with scale, altitude 3 bytes with PAYLOAD_ALTITUDE_SCALE
+ *  TRACK     point count, first point and varint deltas, latitude and longitude with scale
+ *  FRAGMENT  packet ID, fragment index (high nibble) and fragment count (low nibble)
+ *  DIAG      reset cause, boots, abnormal resets, uptime before the reset, heap usage
+ *  TIMING    six 2 byte values, see stage_timing.cpp
+ */
+#define PAYLOAD_SCHEMA(FIELD)                                          \
+	FIELD(CELL_DEVID, 0, 255, 4, 1, false, SCALAR, "dev_id")           \
+	FIELD(BATT, 1, 116, 2, 100, false, SCALAR, "voltage")              \
+	FIELD(HUMID_2, 6, 104, 1, 2, false, SCALAR, "humidity")            \
+	FIELD(TEMP_2, 7, 103, 2, 10, true, SCALAR, "temperature")          \
+	FIELD(PRESS_2, 8, 115, 2, 10, false, SCALAR, "barometer")          \
+	FIELD(GAS_2, 9, 2, 2, 100, true, SCALAR, "analog_in")              \
+	FIELD(GPS, 10, 137, 11, 1000000, true, GPS_6, "gps")               \
+	FIELD(TRACK, 11, 140, 0, 1000000, true, TRACK, "track")            \
+	FIELD(FRAG, 12, 141, 2, 1, false, FRAGMENT, "fragment")            \
+	FIELD(SEQ, 13, 143, 4, 1, false, SCALAR, "sequence")               \
+	FIELD(DIAG, 14, 144, 8, 1, false, DIAG, "diag")                    \
+	FIELD(TIMING, 15, 145, 12, 1, false, TIMING, "timing")
+
+/** Scale of the altitude of a GPS_6 field, 0.01 m */
+#define PAYLOAD_ALTITUDE_SCALE 100
+
+/** Channel and type of each field, PAYLOAD_CH_xxx and PAYLOAD_TYPE_xxx */
+#define PAYLOAD_ENUM_CHANNEL(id, channel, type, size, scale, is_signed, layout, name) PAYLOAD_CH_##id = channel,
+#define PAYLOAD_ENUM_TYPE(id, channel, type, size, scale, is_signed, layout, name) PAYLOAD_TYPE_##id = type,
+enum payload_channel
+{
+	PAYLOAD_SCHEMA(PAYLOAD_ENUM_CHANNEL)
+};
+enum payload_type
+{
+	PAYLOAD_SCHEMA(PAYLOAD_ENUM_TYPE)
+};
+
+/** Description of one field, all values are known at compile time */
+template <uint8_t Channel, uint8_t Type, uint8_t Size, uint32_t Scale, bool Signed>
+struct PayloadField
+{
+	static constexpr uint8_t channel = Channel;
+	static constexpr uint8_t type = Type;
+	static constexpr uint8_t size = Size;		  // Data size
+	static constexpr uint8_t total = Size + 2;	  // Size including channel and type
+	static constexpr uint32_t scale = Scale;
+	static constexpr bool is_signed = Signed;
+};
+
+/** One type per field, PayloadField_xxx */
+#define PAYLOAD_FIELD_TYPE(id, channel, type, size, scale, is_signed, layout, name) \
+	typedef PayloadField<channel, type, size, scale, is_signed> PayloadField_##id;
+PAYLOAD_SCHEMA(PAYLOAD_FIELD_TYPE)
+
+/** Largest payload if every fixed size field is added once */
+#define PAYLOAD_FIXED_SIZE(id, channel, type, size, scale, is_signed, layout, name) +((size) == 0 ? 0 : (size) + 2)
+static constexpr uint16_t PAYLOAD_FIXED_MAX = 0 PAYLOAD_SCHEMA(PAYLOAD_FIXED_SIZE);
+
+/** Size of the payload buffer */
+#define PAYLOAD_BUFFER_SIZE 255
+static_assert(PAYLOAD_FIXED_MAX <= PAYLOAD_BUFFER_SIZE, "Payload schema does not fit into the payload buffer");
+
+/**
+ * @brief Write a value MSB first, unrolled at compile time
+ *
+ * @tparam Size number of bytes
+ */
+template <uint8_t Size>
+struct PayloadBytes
+{
+	static inline void put(uint8_t *buffer, uint32_t value)
+	{
+		buffer[0] = (uint8_t)(value >> (8 * (Size - 1)));
+		PayloadBytes<Size - 1>::put(&buffer[1], value);
+	}
+};
+
+template <>
+struct PayloadBytes<0>
+{
+	static inline void put(uint8_t *, uint32_t) {}
+};
+
+#endif // PAYLOAD_SCHEMA_H
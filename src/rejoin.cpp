@@ -0,0 +1,301 @@
+/**
+ * @file rejoin.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Schedule LoRaWAN rejoins with back-off and the join duty cycle
+ * @version 0.1
+ * @date 2023-09-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Filename of the rejoin state */
+static const char rejoin_file_name[] = "JOIN";
+
+/** Filename of the rejoin state while it is written */
+static const char rejoin_tmp_name[] = "JOIN.TMP";
+
+/** Wait time after the first failed join, doubled with every failure */
+#define REJOIN_BASE_MS 300000
+
+/** Longest wait time between two joins */
+#define REJOIN_MAX_MS 86400000
+
+/** Random part of the wait time in percent, keeps devices from joining at the same time */
+#define REJOIN_JITTER 25
+
+/** Payload size of a join request */
+#define JOIN_REQUEST_SIZE 23
+
+/** Weight of a new result in the rolling join success rate */
+#define REJOIN_EWMA_WEIGHT 0.25
+
+/** Wait time before the next try if the LoRaWAN stack could not start the join */
+#define REJOIN_BUSY_MS 60000
+
+/** A join cycle without result after this time is handled as failed */
+#define REJOIN_TIMEOUT_MS 600000
+
+/** File for the rejoin state */
+static File rejoin_file(InternalFS);
+
+/** Rejoin state and statistics */
+s_rejoin_state g_rejoin_state;
+
+/** millis() when the next join is allowed */
+static uint32_t rejoin_next_ms = 0;
+
+/** A join cycle started by the scheduler is running */
+static bool rejoin_running = false;
+
+/** millis() when the running join cycle was started */
+static uint32_t rejoin_start_ms = 0;
+
+/**
+ * @brief Estimate the airtime of one join request
+ *        Uses the spreading factor of the current data rate, 125 kHz,
+ *        coding rate 4/5, 8 symbols preamble, explicit header and CRC.
+ *        Data rates above the SF7 data rate are counted as SF7.
+ *
+ * @return uint32_t airtime in milliseconds
+ */
+static uint32_t rejoin_airtime(void)
+{
+	// US915 starts with SF10 at DR0
+	int8_t sf_dr0 = g_lorawan_settings.lora_region == LORAMAC_REGION_US915 ? 10 : 12;
+	uint8_t data_rate = g_lorawan_settings.data_rate;
+	if (data_rate > (sf_dr0 - 7))
+	{
+		data_rate = sf_dr0 - 7;
+	}
+	int8_t sf = sf_dr0 - data_rate;
+
+	float t_sym = (float)(1 << sf) / 125.0;
+	int8_t de = sf >= 11 ? 1 : 0;
+	int32_t bits = 8 * JOIN_REQUEST_SIZE - 4 * sf + 28 + 16;
+	int32_t divisor = 4 * (sf - 2 * de);
+	int32_t symbols = 8;
+	if (bits > 0)
+	{
+		symbols += ((bits + divisor - 1) / divisor) * 5;
+	}
+	return (uint32_t)((12.25 + symbols) * t_sym);
+}
+
+/**
+ * @brief Get the allowed join duty cycle of the LoRaWAN specification
+ *        1% in the first hour after reset, 0.1% up to 11 hours, then 0.01%
+ *
+ * @return uint32_t inverse of the duty cycle
+ */
+static uint32_t rejoin_duty_cycle(void)
+{
+	uint32_t uptime = millis();
+	if (uptime < 3600000)
+	{
+		return 100;
+	}
+	if (uptime < 39600000)
+	{
+		return 1000;
+	}
+	return 10000;
+}
+
+/**
+ * @brief Save the state, the remaining wait time is kept across a reset
+ *
+ */
+static void rejoin_save(void)
+{
+	int32_t wait = (int32_t)(rejoin_next_ms - millis());
+	g_rejoin_state.wait_ms = wait > 0 ? wait : 0;
+
+	// The rename replaces the old file in one step, a reset never leaves a partial file
+	if (InternalFS.exists(rejoin_tmp_name))
+	{
+		InternalFS.remove(rejoin_tmp_name);
+	}
+	if (!rejoin_file.open(rejoin_tmp_name, FILE_O_WRITE))
+	{
+		MYLOG("JOIN", "Could not save rejoin state");
+		return;
+	}
+	bool written = rejoin_file.write((const uint8_t *)&g_rejoin_state, sizeof(s_rejoin_state)) == sizeof(s_rejoin_state);
+	rejoin_file.close();
+	if (!written || !InternalFS.rename(rejoin_tmp_name, rejoin_file_name))
+	{
+		MYLOG("JOIN", "Could not save rejoin state");
+		InternalFS.remove(rejoin_tmp_name);
+	}
+}
+
+/**
+ * @brief Restore the state and the wait time from before the reset
+ *
+ */
+void init_rejoin(void)
+{
+	// A save was interrupted before the rename, the old file is still complete
+	if (InternalFS.exists(rejoin_tmp_name))
+	{
+		InternalFS.remove(rejoin_tmp_name);
+	}
+
+	s_rejoin_state saved;
+	bool valid = false;
+	if (InternalFS.exists(rejoin_file_name))
+	{
+		if (rejoin_file.open(rejoin_file_name, FILE_O_READ))
+		{
+			valid = (rejoin_file.read((void *)&saved, sizeof(s_rejoin_state)) == sizeof(s_rejoin_state)) && (saved.valid_mark == 0xAA55);
+			rejoin_file.close();
+		}
+	}
+	if (valid)
+	{
+		g_rejoin_state = saved;
+	}
+	else
+	{
+		rejoin_reset();
+	}
+	rejoin_next_ms = millis() + g_rejoin_state.wait_ms;
+
+	// Different devices should not follow the same jitter
+	uint32_t seed = millis();
+	for (uint8_t idx = 0; idx < 8; idx++)
+	{
+		seed = (seed << 5) ^ (seed >> 27) ^ g_lorawan_settings.node_device_eui[idx];
+	}
+	randomSeed(seed);
+
+	MYLOG("JOIN", "%d failed joins, next join in %ld s", g_rejoin_state.failures, g_rejoin_state.wait_ms / 1000);
+}
+
+/**
+ * @brief Start a rejoin if the back-off and the join duty cycle allow it
+ *        A join cycle that got no result within REJOIN_TIMEOUT_MS is handled as failed,
+ *        otherwise a lost join callback would block all later rejoins.
+ *
+ * @return true if a join was started
+ * @return false if the device has to wait
+ */
+bool rejoin_try(void)
+{
+	if (rejoin_running && ((millis() - rejoin_start_ms) >= REJOIN_TIMEOUT_MS))
+	{
+		MYLOG("JOIN", "No join result, join cycle timed out");
+		rejoin_result(false);
+	}
+	if (rejoin_running || ((int32_t)(millis() - rejoin_next_ms) < 0))
+	{
+		MYLOG("JOIN", "Rejoin postponed, %ld s left", rejoin_running ? 0 : (rejoin_next_ms - millis()) / 1000);
+		return false;
+	}
+	MYLOG("JOIN", "Retry to join LNS");
+	g_lpwan_has_joined = false;
+	lmh_error_status result = lmh_join();
+	if (result != LMH_SUCCESS)
+	{
+		// No join callback will come, try again later
+		MYLOG("JOIN", "Join not started, error %d", result);
+		rejoin_next_ms = millis() + REJOIN_BUSY_MS;
+		return false;
+	}
+	g_rejoin_state.attempts++;
+	rejoin_running = true;
+	rejoin_start_ms = millis();
+	return true;
+}
+
+/**
+ * @brief Handle the result of a join cycle and plan the next one
+ *        After a failure the wait time doubles, limited by REJOIN_MAX_MS,
+ *        with a random part of REJOIN_JITTER percent. A device that failed
+ *        most of its recent joins waits up to twice as long. The wait is never
+ *        shorter than the join duty cycle needs for the airtime used.
+ *        Only join cycles started by rejoin_try are counted, not the join after boot.
+ *
+ * @param success true if the device joined
+ */
+void rejoin_result(bool success)
+{
+	if (!rejoin_running)
+	{
+		return;
+	}
+	rejoin_running = false;
+
+	// A failed join cycle used all join trials
+	uint8_t requests = 1;
+	if (!success)
+	{
+		requests = g_lorawan_settings.join_trials != 0 ? g_lorawan_settings.join_trials : 1;
+	}
+	uint32_t airtime = requests * rejoin_airtime();
+	g_rejoin_state.airtime_ms += airtime;
+	g_rejoin_state.success_rate += ((success ? 1.0 : 0.0) - g_rejoin_state.success_rate) * REJOIN_EWMA_WEIGHT;
+
+	uint32_t wait = airtime * (rejoin_duty_cycle() - 1);
+	if (success)
+	{
+		g_rejoin_state.joined++;
+		g_rejoin_state.failures = 0;
+	}
+	else
+	{
+		if (g_rejoin_state.failures < 255)
+		{
+			g_rejoin_state.failures++;
+		}
+		uint32_t back_off = REJOIN_MAX_MS;
+		if (g_rejoin_state.failures <= 9)
+		{
+			back_off = (uint32_t)REJOIN_BASE_MS << (g_rejoin_state.failures - 1);
+			back_off = (uint32_t)(back_off * (2.0 - g_rejoin_state.success_rate));
+			if (back_off > REJOIN_MAX_MS)
+			{
+				back_off = REJOIN_MAX_MS;
+			}
+		}
+		int32_t jitter = (int32_t)(back_off / 100 * REJOIN_JITTER);
+		back_off += random(-jitter, jitter + 1);
+		if (back_off > wait)
+		{
+			wait = back_off;
+		}
+	}
+	rejoin_next_ms = millis() + wait;
+	rejoin_save();
+	MYLOG("JOIN", "Join %s, next join allowed in %ld s", success ? "success" : "failed", wait / 1000);
+}
+
+/**
+ * @brief Clear the back-off and the statistics
+ *
+ */
+void rejoin_reset(void)
+{
+	memset((void *)&g_rejoin_state, 0, sizeof(s_rejoin_state));
+	g_rejoin_state.valid_mark = 0xAA55;
+	g_rejoin_state.success_rate = 1.0;
+	rejoin_next_ms = millis();
+	rejoin_save();
+}
+
+/**
+ * @brief Get the time until the next join is allowed
+ *
+ * @return uint32_t wait time in milliseconds
+ */
+uint32_t rejoin_wait(void)
+{
+	int32_t wait = (int32_t)(rejoin_next_ms - millis());
+	return wait > 0 ? wait : 0;
+}
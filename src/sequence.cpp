@@ -0,0 +1,160 @@
+/**
+ * @file sequence.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Sequence number for every reading, kept across resets
+ * @version 0.1
+ * @date 2023-09-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Filename of the sequence number */
+static const char seq_file_name[] = "SEQNO";
+
+/** Filename of the sequence number while it is written */
+static const char seq_tmp_name[] = "SEQNO.TMP";
+
+/** Sequence numbers reserved with one write to the flash */
+#define SEQ_BLOCK 64
+
+/** Marker of a sequence record */
+#define SEQ_MAGIC 0x53455131
+
+/** Sequence record in the flash */
+struct s_seq_record
+{
+	uint32_t magic;	   // SEQ_MAGIC
+	uint32_t reserved; // First sequence number that is not reserved
+	uint32_t check;	   // Inverted reserved, detects a damaged record
+};
+
+/** File for the sequence number */
+static File seq_file(InternalFS);
+
+/** Next sequence number */
+static uint32_t seq_next = 0;
+
+/** First sequence number that is not reserved in the flash */
+static uint32_t seq_reserved = 0;
+
+/**
+ * @brief Save the end of the next block of sequence numbers
+ *        After a reset the sequence continues at the end of the block,
+ *        so no number is used twice. The record is written to a new file that
+ *        replaces the old one with a rename, a reset never leaves no record.
+ *
+ */
+static void seq_reserve(void)
+{
+	seq_reserved = seq_next + SEQ_BLOCK;
+	s_seq_record record = {SEQ_MAGIC, seq_reserved, ~seq_reserved};
+
+	if (InternalFS.exists(seq_tmp_name))
+	{
+		InternalFS.remove(seq_tmp_name);
+	}
+	if (!seq_file.open(seq_tmp_name, FILE_O_WRITE))
+	{
+		MYLOG("SEQ", "Could not save sequence number");
+		return;
+	}
+	bool written = seq_file.write((const uint8_t *)&record, sizeof(s_seq_record)) == sizeof(s_seq_record);
+	seq_file.close();
+	if (!written || !InternalFS.rename(seq_tmp_name, seq_file_name))
+	{
+		MYLOG("SEQ", "Could not save sequence number");
+		InternalFS.remove(seq_tmp_name);
+	}
+}
+
+/**
+ * @brief Read a sequence record
+ *
+ * @param name file name
+ * @param reserved end of the reserved block from the record
+ * @return true if the file holds a valid record
+ */
+static bool seq_read(const char *name, uint32_t *reserved)
+{
+	s_seq_record record;
+	if (!seq_file.open(name, FILE_O_READ))
+	{
+		return false;
+	}
+	int len = seq_file.read((void *)&record, sizeof(s_seq_record));
+	seq_file.close();
+	if (len == sizeof(uint32_t))
+	{
+		// Older firmware wrote the plain number
+		*reserved = record.magic;
+		return true;
+	}
+	if ((len != sizeof(s_seq_record)) || (record.magic != SEQ_MAGIC) || (record.check != ~record.reserved))
+	{
+		return false;
+	}
+	*reserved = record.reserved;
+	return true;
+}
+
+/**
+ * @brief Continue the sequence after the block that was reserved before the reset
+ *        The temporary file is complete if the reset came between its close and
+ *        the rename. If a file exists but is damaged, the sequence skips one more
+ *        block, numbers are never used twice.
+ *
+ */
+void init_sequence(void)
+{
+	seq_next = 0;
+	bool damaged = false;
+	const char *names[] = {seq_file_name, seq_tmp_name};
+	for (uint8_t idx = 0; idx < 2; idx++)
+	{
+		uint32_t reserved;
+		if (!InternalFS.exists(names[idx]))
+		{
+			continue;
+		}
+		if (seq_read(names[idx], &reserved))
+		{
+			if (reserved > seq_next)
+			{
+				seq_next = reserved;
+			}
+		}
+		else if (idx == 0)
+		{
+			// The temporary file is incomplete after a reset during its write, only a damaged record counts
+			damaged = true;
+		}
+	}
+	if (damaged)
+	{
+		MYLOG("SEQ", "Sequence file damaged, skip %d numbers", SEQ_BLOCK);
+		seq_next += SEQ_BLOCK;
+	}
+	seq_reserve();
+	MYLOG("SEQ", "Sequence continues at %ld", seq_next);
+}
+
+/**
+ * @brief Get the sequence number for the next reading
+ *
+ * @return uint32_t sequence number
+ */
+uint32_t sequence_next(void)
+{
+	uint32_t seq = seq_next++;
+	if (seq_next >= seq_reserved)
+	{
+		seq_reserve();
+	}
+	return seq;
+}
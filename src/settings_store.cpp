@@ -0,0 +1,446 @@
+/**
+ * @file settings_store.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Blues settings as versioned key-value records, changes are appended
+ * @version 0.1
+ * @date 2023-09-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Filename of the settings records */
+static const char settings_file_name[] = "BSET";
+
+/** Filename used while the records are compacted */
+static const char settings_tmp_name[] = "BSET.TMP";
+
+/** Filename of the settings before the key-value store, raw s_blues_settings */
+static const char settings_legacy_name[] = "BLUES";
+
+/** Marker at the start of the file, "BSET" */
+#define SETTINGS_MAGIC 0x54455342
+
+/** Layout version of the records, increase if the meaning of a key changes */
+#define SETTINGS_VERSION 1
+
+/** File size that starts a compaction */
+#define SETTINGS_COMPACT_SIZE 2048
+
+/** File header */
+struct s_settings_header
+{
+	uint32_t magic;		// SETTINGS_MAGIC
+	uint8_t version;	// SETTINGS_VERSION of the writer
+	uint8_t reserved[3];
+};
+
+/**
+ * Record format: key, value length, value, CRC16 (LSB) over key, length and value.
+ * Numbers are stored LSB first with their size, strings without the terminator.
+ * The last record of a key is valid.
+ */
+#define SETTINGS_RECORD_OVERHEAD 4
+
+/** Description of one setting */
+struct s_setting_key
+{
+	uint8_t key;		// Never reused for another setting
+	uint16_t offset;	// Offset in s_blues_settings
+	uint16_t size;		// Size in s_blues_settings, strings including the terminator
+	bool is_string;		// Stored without the unused part of the buffer
+};
+
+#define SETTING(key, field, is_string) {key, offsetof(s_blues_settings, field), sizeof(s_blues_settings::field), is_string}
+
+/** Keys of the settings, new settings get a new key */
+static const s_setting_key settings_keys[] = {
+	SETTING(1, product_uid, true),
+	SETTING(2, conn_continous, false),
+	SETTING(3, use_ext_sim, false),
+	SETTING(4, ext_sim_apn, true),
+	SETTING(5, motion_trigger, false),
+	SETTING(6, batch_size, false),
+	SETTING(7, min_interval, false),
+	SETTING(8, max_interval, false),
+	SETTING(9, track_tolerance, false),
+	SETTING(10, timing_channel, false),
+};
+
+#define SETTINGS_KEY_NUM (sizeof(settings_keys) / sizeof(s_setting_key))
+
+/** File for the settings */
+static File settings_file(InternalFS);
+
+/** Settings as they are stored in the file */
+static s_blues_settings settings_stored;
+
+/**
+ * @brief Update a CRC16 (CCITT) with a block of data
+ *
+ * @param crc CRC16 so far
+ * @param data data to add
+ * @param len length of data
+ * @return uint16_t updated CRC16
+ */
+static uint16_t settings_crc_update(uint16_t crc, const uint8_t *data, uint16_t len)
+{
+	for (uint16_t idx = 0; idx < len; idx++)
+	{
+		crc ^= (uint16_t)data[idx] << 8;
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc << 1) ^ (0x1021 & (0 - (crc >> 15)));
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief Get the stored length of a setting
+ *
+ * @param settings settings to read from
+ * @param setting key description
+ * @return uint8_t value length
+ */
+static uint8_t settings_value_len(s_blues_settings *settings, const s_setting_key *setting)
+{
+	if (setting->is_string)
+	{
+		return strnlen((char *)settings + setting->offset, setting->size - 1);
+	}
+	return setting->size;
+}
+
+/**
+ * @brief Write the record of one setting to the open file
+ *
+ * @param settings settings to read from
+ * @param setting key description
+ * @return true if the record was written
+ */
+static bool settings_write_record(s_blues_settings *settings, const s_setting_key *setting)
+{
+	uint8_t *value = (uint8_t *)settings + setting->offset;
+	uint8_t head[2] = {setting->key, settings_value_len(settings, setting)};
+	uint16_t crc = settings_crc_update(0xFFFF, head, 2);
+	crc = settings_crc_update(crc, value, head[1]);
+	uint8_t tail[2] = {(uint8_t)crc, (uint8_t)(crc >> 8)};
+
+	return (settings_file.write(head, 2) == 2) && (settings_file.write(value, head[1]) == head[1]) && (settings_file.write(tail, 2) == 2);
+}
+
+/**
+ * @brief Take the value of a record into the settings
+ *        Strings are cut to the buffer size, numbers of another size
+ *        (from another layout version) are cut or extended with zeros
+ *
+ * @param setting key description
+ * @param value value of the record
+ * @param len value length
+ */
+static void settings_apply(const s_setting_key *setting, uint8_t *value, uint8_t len)
+{
+	uint8_t *field = (uint8_t *)&g_blues_settings + setting->offset;
+	if (setting->is_string)
+	{
+		uint16_t copy = len < setting->size ? len : setting->size - 1;
+		memcpy(field, value, copy);
+		field[copy] = 0;
+		return;
+	}
+	memset(field, 0, setting->size);
+	memcpy(field, value, len < setting->size ? len : setting->size);
+}
+
+/**
+ * @brief Write all settings into a new file
+ *        The new file replaces the old one only after it was written completely.
+ *        The rename replaces the old file in one step, there is always a complete file.
+ *
+ * @return true if the settings were written
+ */
+static bool settings_compact(void)
+{
+	if (InternalFS.exists(settings_tmp_name))
+	{
+		InternalFS.remove(settings_tmp_name);
+	}
+	if (!settings_file.open(settings_tmp_name, FILE_O_WRITE))
+	{
+		MYLOG("SET", "Could not create settings file");
+		return false;
+	}
+	s_settings_header header = {SETTINGS_MAGIC, SETTINGS_VERSION, {0, 0, 0}};
+	bool written = settings_file.write((const uint8_t *)&header, sizeof(s_settings_header)) == sizeof(s_settings_header);
+	for (uint8_t idx = 0; written && (idx < SETTINGS_KEY_NUM); idx++)
+	{
+		written = settings_write_record(&g_blues_settings, &settings_keys[idx]);
+	}
+	settings_file.close();
+	if (!written)
+	{
+		MYLOG("SET", "Could not write settings");
+		InternalFS.remove(settings_tmp_name);
+		return false;
+	}
+
+	if (!InternalFS.rename(settings_tmp_name, settings_file_name))
+	{
+		MYLOG("SET", "Could not replace settings file");
+		InternalFS.remove(settings_tmp_name);
+		return false;
+	}
+	memcpy((void *)&settings_stored, (void *)&g_blues_settings, sizeof(s_blues_settings));
+	MYLOG("SET", "Settings compacted");
+	return true;
+}
+
+/** Conversion of the settings read from a file of an older layout version to the next version */
+typedef void (*settings_migration_t)(void);
+
+/**
+ * Conversions, the index is the version of the file. When the meaning of a key
+ * changes, SETTINGS_VERSION is increased and the conversion from the previous
+ * version is added here.
+ */
+static const settings_migration_t settings_migrations[SETTINGS_VERSION] = {
+	NULL, // Version 0 was never written
+};
+
+/**
+ * @brief Convert the settings of a file with another layout version
+ *        The conversions run one after the other from the file version up to SETTINGS_VERSION.
+ *        Files of a newer firmware are taken as they are, only the known keys were read.
+ *
+ * @param version layout version of the file
+ */
+static void settings_migrate(uint8_t version)
+{
+	if (version > SETTINGS_VERSION)
+	{
+		MYLOG("SET", "Settings of newer version %d, unknown keys are dropped", version);
+		return;
+	}
+	for (uint8_t step = version; step < SETTINGS_VERSION; step++)
+	{
+		if (settings_migrations[step] != NULL)
+		{
+			MYLOG("SET", "Convert settings from version %d", step);
+			settings_migrations[step]();
+		}
+	}
+}
+
+/**
+ * @brief Read the settings before the key-value store and convert them
+ *        Settings were only added at the end of the structure. Files of an older
+ *        layout are shorter, only the fields of the first layout are taken from them.
+ *
+ * @return true if valid settings were found
+ */
+static bool settings_migrate_legacy(void)
+{
+	s_blues_settings legacy;
+	uint32_t len = 0;
+	if (settings_file.open(settings_legacy_name, FILE_O_READ))
+	{
+		len = settings_file.read((void *)&legacy, sizeof(s_blues_settings));
+		settings_file.close();
+	}
+	if ((len < offsetof(s_blues_settings, batch_size)) || (legacy.valid_mark != 0xAA55))
+	{
+		return false;
+	}
+
+	if (len == sizeof(s_blues_settings))
+	{
+		memcpy((void *)&g_blues_settings, (void *)&legacy, sizeof(s_blues_settings));
+	}
+	else
+	{
+		memcpy((void *)&g_blues_settings, (void *)&legacy, offsetof(s_blues_settings, batch_size));
+	}
+	g_blues_settings.product_uid[sizeof(g_blues_settings.product_uid) - 1] = 0;
+	g_blues_settings.ext_sim_apn[sizeof(g_blues_settings.ext_sim_apn) - 1] = 0;
+
+	if (settings_compact())
+	{
+		InternalFS.remove(settings_legacy_name);
+	}
+	MYLOG("SET", "Converted %ld bytes of old settings", len);
+	return true;
+}
+
+/**
+ * @brief Read the settings records
+ *        Reading stops at the first damaged record, e.g. from a reset during
+ *        an update. The file is then rewritten, so later records are readable.
+ *
+ * @return true if valid settings were found
+ */
+static bool settings_load(void)
+{
+	// A compaction was interrupted before the rename, the old file is still complete
+	if (InternalFS.exists(settings_tmp_name))
+	{
+		InternalFS.remove(settings_tmp_name);
+	}
+
+	if (!settings_file.open(settings_file_name, FILE_O_READ))
+	{
+		return false;
+	}
+	s_settings_header header;
+	if ((settings_file.read((void *)&header, sizeof(s_settings_header)) != sizeof(s_settings_header)) || (header.magic != SETTINGS_MAGIC))
+	{
+		settings_file.close();
+		MYLOG("SET", "Settings file invalid");
+		return false;
+	}
+
+	uint8_t value[256];
+	uint16_t records = 0;
+	bool damaged = false;
+	while (settings_file.available() > 0)
+	{
+		uint8_t head[2];
+		uint8_t tail[2];
+		if ((settings_file.read(head, 2) != 2) || (settings_file.read(value, head[1]) != head[1]) || (settings_file.read(tail, 2) != 2))
+		{
+			damaged = true;
+			break;
+		}
+		uint16_t crc = settings_crc_update(0xFFFF, head, 2);
+		crc = settings_crc_update(crc, value, head[1]);
+		if (crc != (tail[0] | (tail[1] << 8)))
+		{
+			damaged = true;
+			break;
+		}
+		records++;
+		// Keys of a newer firmware are skipped
+		for (uint8_t idx = 0; idx < SETTINGS_KEY_NUM; idx++)
+		{
+			if (settings_keys[idx].key == head[0])
+			{
+				settings_apply(&settings_keys[idx], value, head[1]);
+				break;
+			}
+		}
+	}
+	settings_file.close();
+	MYLOG("SET", "%d records, version %d", records, header.version);
+
+	if (header.version != SETTINGS_VERSION)
+	{
+		settings_migrate(header.version);
+	}
+	memcpy((void *)&settings_stored, (void *)&g_blues_settings, sizeof(s_blues_settings));
+	if (damaged || (header.version != SETTINGS_VERSION))
+	{
+		MYLOG("SET", "Rewrite settings, damaged %d, version %d", damaged, header.version);
+		settings_compact();
+	}
+	return true;
+}
+
+/**
+ * @brief Read saved Blues settings
+ *        Settings of older firmware versions are converted
+ *
+ * @return true if saved settings were found
+ */
+bool read_blues_settings(void)
+{
+	bool structure_valid = settings_load();
+	if (!structure_valid && InternalFS.exists(settings_legacy_name))
+	{
+		structure_valid = settings_migrate_legacy();
+	}
+	g_blues_settings.valid_mark = 0xAA55;
+
+	if (!structure_valid)
+	{
+		memcpy((void *)&settings_stored, (void *)&g_blues_settings, sizeof(s_blues_settings));
+		MYLOG("USR_AT", "No valid Blues settings found");
+		return false;
+	}
+
+	MYLOG("USR_AT", "Valid Blues settings found, Blues Product UID = %s", g_blues_settings.product_uid);
+	if (g_blues_settings.use_ext_sim)
+	{
+		MYLOG("USR_AT", "Using external SIM with APN = %s", g_blues_settings.ext_sim_apn);
+	}
+	else
+	{
+		MYLOG("USR_AT", "Using eSIM");
+	}
+	return true;
+}
+
+/**
+ * @brief Save the changed Blues settings
+ *        Only the records of changed settings are appended to the file.
+ *        When the file gets too large, it is rewritten with one record per setting.
+ *
+ */
+void save_blues_settings(void)
+{
+	if (!InternalFS.exists(settings_file_name))
+	{
+		settings_compact();
+		return;
+	}
+
+	if (!settings_file.open(settings_file_name, FILE_O_WRITE))
+	{
+		MYLOG("SET", "Could not open settings file");
+		return;
+	}
+	settings_file.seek(settings_file.size());
+	uint8_t changed = 0;
+	bool written = true;
+	for (uint8_t idx = 0; written && (idx < SETTINGS_KEY_NUM); idx++)
+	{
+		const s_setting_key *setting = &settings_keys[idx];
+		uint8_t len = settings_value_len(&g_blues_settings, setting);
+		if ((len == settings_value_len(&settings_stored, setting)) && (memcmp((uint8_t *)&g_blues_settings + setting->offset, (uint8_t *)&settings_stored + setting->offset, len) == 0))
+		{
+			continue;
+		}
+		written = settings_write_record(&g_blues_settings, setting);
+		changed++;
+	}
+	uint32_t file_size = settings_file.size();
+	settings_file.close();
+
+	if (!written || (file_size > SETTINGS_COMPACT_SIZE))
+	{
+		settings_compact();
+		return;
+	}
+	memcpy((void *)&settings_stored, (void *)&g_blues_settings, sizeof(s_blues_settings));
+	MYLOG("USR_AT", "Saved %d changed Blues settings", changed);
+}
+
+/**
+ * @brief Remove all saved Blues settings
+ *
+ */
+void clear_blues_settings(void)
+{
+	const char *names[] = {settings_file_name, settings_tmp_name, settings_legacy_name};
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		if (InternalFS.exists(names[idx]))
+		{
+			InternalFS.remove(names[idx]);
+		}
+	}
+}
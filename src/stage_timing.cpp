@@ -0,0 +1,166 @@
+/**
+ * @file stage_timing.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Time and estimated charge of the stages of a wakeup cycle
+ * @version 0.1
+ * @date 2023-09-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Current of the MCU while the CPU runs, in uA */
+#define TIMING_CPU_UA 3300
+
+/** Current of the whole device while it sleeps, in uA */
+#define TIMING_SLEEP_UA 40
+
+/** Current of the peripheral that is active during each stage, in uA */
+static const uint32_t timing_periph_ua[TIMING_NUM] = {
+	0,		// TIMING_EVENT, MCU only
+	714,	// TIMING_BME, BME680 pressure measurement, gas heater is off
+	20000,	// TIMING_LOCATION, NoteCard active
+	20000,	// TIMING_CELL_SEND, NoteCard active
+	10000,	// TIMING_LORA_TX, average of TX, RX windows and waiting
+};
+
+/** Statistics per stage */
+s_timing_stats g_timing_stats[TIMING_NUM];
+
+/** Estimated charge of the last complete cycle in uAh */
+float g_timing_cycle_uah = 0;
+
+/** Start of each running stage, millis() */
+static uint32_t timing_start_ms[TIMING_NUM];
+
+/** Start of each running stage, CPU cycles */
+static uint32_t timing_start_cycles[TIMING_NUM];
+
+/** Running stages */
+static volatile uint8_t timing_running = 0;
+
+/** Charge of the stages since the last cycle started in uAh */
+static float timing_charge_uah = 0;
+
+/** Start of the current cycle, millis() */
+static uint32_t timing_cycle_start_ms = 0;
+
+/**
+ * @brief Start the CPU cycle counter
+ *        The counter stops while the CPU sleeps, so the cycles of a stage
+ *        are the time the CPU was really running
+ *
+ */
+void init_timing(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	timing_reset();
+}
+
+/**
+ * @brief Start measuring a stage
+ *
+ * @param stage TIMING_xxx
+ */
+void timing_start(uint8_t stage)
+{
+	if (stage >= TIMING_NUM)
+	{
+		return;
+	}
+	timing_start_cycles[stage] = DWT->CYCCNT;
+	timing_start_ms[stage] = millis();
+	taskENTER_CRITICAL();
+	timing_running |= (1 << stage);
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Finish measuring a stage and add it to the statistics
+ *
+ * @param stage TIMING_xxx
+ */
+void timing_end(uint8_t stage)
+{
+	if ((stage >= TIMING_NUM) || ((timing_running & (1 << stage)) == 0))
+	{
+		return;
+	}
+	uint32_t cycles = DWT->CYCCNT - timing_start_cycles[stage];
+	uint32_t time_ms = millis() - timing_start_ms[stage];
+	uint32_t active_us = cycles / (SystemCoreClock / 1000000);
+
+	// Charge = I * t, uA * us / 3600e6 = uAh
+	float charge_uah = ((float)TIMING_CPU_UA * active_us + (float)timing_periph_ua[stage] * time_ms * 1000.0) / 3600000000.0;
+
+	uint8_t bucket = 0;
+	while ((bucket < (TIMING_BUCKETS - 1)) && (time_ms >= (1UL << bucket)))
+	{
+		bucket++;
+	}
+
+	taskENTER_CRITICAL();
+	timing_running &= ~(1 << stage);
+	s_timing_stats *stats = &g_timing_stats[stage];
+	stats->count++;
+	stats->sum_ms += time_ms;
+	if (time_ms > stats->max_ms)
+	{
+		stats->max_ms = time_ms;
+	}
+	stats->sum_active_us += active_us;
+	stats->sum_uah += charge_uah;
+	if (stats->histogram[bucket] < 0xFFFF)
+	{
+		stats->histogram[bucket]++;
+	}
+	timing_charge_uah += charge_uah;
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Close the estimate of the last cycle, called when a new cycle starts
+ *        The charge of the cycle is the charge of its stages plus the sleep
+ *        current over the whole cycle time
+ *
+ */
+void timing_cycle_done(void)
+{
+	uint32_t now = millis();
+	float sleep_uah = (float)TIMING_SLEEP_UA * (now - timing_cycle_start_ms) / 3600000.0;
+	taskENTER_CRITICAL();
+	g_timing_cycle_uah = timing_charge_uah + sleep_uah;
+	timing_charge_uah = 0;
+	taskEXIT_CRITICAL();
+	timing_cycle_start_ms = now;
+	MYLOG("TIME", "Last cycle used %.1f uAh", g_timing_cycle_uah);
+}
+
+/**
+ * @brief Get the average time of a stage
+ *
+ * @param stage TIMING_xxx
+ * @return uint32_t average time in ms
+ */
+uint32_t timing_avg_ms(uint8_t stage)
+{
+	s_timing_stats *stats = &g_timing_stats[stage];
+	return stats->count == 0 ? 0 : stats->sum_ms / stats->count;
+}
+
+/**
+ * @brief Clear all stage statistics
+ *
+ */
+void timing_reset(void)
+{
+	taskENTER_CRITICAL();
+	memset(g_timing_stats, 0, sizeof(g_timing_stats));
+	timing_charge_uah = 0;
+	g_timing_cycle_uah = 0;
+	taskEXIT_CRITICAL();
+	timing_cycle_start_ms = millis();
+}
@@ -0,0 +1,163 @@
+/**
+ * @file sync_scheduler.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Decide when the NoteCard should sync its notes with NoteHub
+ * @version 0.1
+ * @date 2023-09-08
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Battery level in mV below which syncs are delayed */
+#define SYNC_BATT_LOW_MV 3500
+
+/** Factor for the sync thresholds when the battery is low */
+#define SYNC_BATT_LOW_FACTOR 4
+
+/** Factor for the sync thresholds when the NoteCard has no signal, or only one bar */
+#define SYNC_NO_SIGNAL_FACTOR 4
+#define SYNC_WEAK_SIGNAL_FACTOR 2
+
+/** Retry time after the first failed sync */
+#define SYNC_RETRY_MIN_MS 60000
+
+/** Longest retry time after failed syncs */
+#define SYNC_RETRY_MAX_MS 3600000
+
+/** Failed syncs after which the retry time stays at SYNC_RETRY_MAX_MS */
+#define SYNC_RETRY_MAX_STEPS 7
+
+/** Scheduler state */
+s_sync_state g_sync_state;
+
+/**
+ * @brief Count a note that was added on the NoteCard but not yet synced
+ *
+ */
+void sync_note_added(void)
+{
+	if (g_sync_state.pending_notes == 0)
+	{
+		g_sync_state.oldest_note_ms = millis();
+	}
+	g_sync_state.pending_notes++;
+}
+
+/**
+ * @brief Remember the last battery level for the sync decision
+ *
+ * @param batt_mv battery level in mV
+ */
+void sync_set_battery(float batt_mv)
+{
+	g_sync_state.batt_mv = (uint16_t)batt_mv;
+}
+
+/**
+ * @brief Check whether a sync with NoteHub is due
+ *        A sync is due if a full batch of notes is waiting or if the oldest
+ *        note waited longer than one batch worth of the current send interval.
+ *        With a low battery or a weak cellular signal both limits are extended,
+ *        after failed syncs the next try is delayed with an exponential back-off.
+ *
+ * @return true if hub.sync should be requested now
+ * @return false if the notes can wait
+ */
+bool sync_is_due(void)
+{
+	if (g_sync_state.pending_notes == 0)
+	{
+		return false;
+	}
+
+	if (g_sync_state.failed_syncs != 0)
+	{
+		uint8_t steps = g_sync_state.failed_syncs > SYNC_RETRY_MAX_STEPS ? SYNC_RETRY_MAX_STEPS : g_sync_state.failed_syncs;
+		uint32_t retry_ms = (uint32_t)SYNC_RETRY_MIN_MS << (steps - 1);
+		if (retry_ms > SYNC_RETRY_MAX_MS)
+		{
+			retry_ms = SYNC_RETRY_MAX_MS;
+		}
+		if ((millis() - g_sync_state.last_try_ms) < retry_ms)
+		{
+			return false;
+		}
+	}
+
+	uint32_t batch_size = g_blues_settings.batch_size == 0 ? 1 : g_blues_settings.batch_size;
+	uint32_t max_age_ms = batch_size * interval_current();
+	if ((g_sync_state.batt_mv != 0) && (g_sync_state.batt_mv < SYNC_BATT_LOW_MV))
+	{
+		batch_size *= SYNC_BATT_LOW_FACTOR;
+		max_age_ms *= SYNC_BATT_LOW_FACTOR;
+	}
+
+	// The signal bars are updated with each sync, so a sync without signal is delayed but not stopped
+	uint8_t signal_factor = 1;
+	if (g_path_stats.cell_bars == 0)
+	{
+		signal_factor = SYNC_NO_SIGNAL_FACTOR;
+	}
+	else if (g_path_stats.cell_bars == 1)
+	{
+		signal_factor = SYNC_WEAK_SIGNAL_FACTOR;
+	}
+	batch_size *= signal_factor;
+	max_age_ms *= signal_factor;
+
+	if (g_sync_state.pending_notes >= batch_size)
+	{
+		return true;
+	}
+	return (millis() - g_sync_state.oldest_note_ms) >= max_age_ms;
+}
+
+/**
+ * @brief Update the scheduler after a sync request
+ *
+ * @param success true if hub.sync was accepted by the NoteCard
+ */
+void sync_done(bool success)
+{
+	g_sync_state.sync_queued = false;
+	g_sync_state.last_try_ms = millis();
+	if (success)
+	{
+		// Notes added while the sync was queued wait for the next sync
+		g_sync_state.pending_notes -= g_sync_state.queued_notes;
+		if (g_sync_state.pending_notes != 0)
+		{
+			g_sync_state.oldest_note_ms = g_sync_state.last_try_ms;
+		}
+		g_sync_state.failed_syncs = 0;
+		g_sync_state.syncs++;
+	}
+	else
+	{
+		if (g_sync_state.failed_syncs < 255)
+		{
+			g_sync_state.failed_syncs++;
+		}
+	}
+}
+
+/**
+ * @brief Queue a sync with NoteHub for the NoteCard task if the scheduler says it is due
+ *        The result is handed to sync_done() by the BLUES_DONE event
+ *
+ * @return true if a sync was queued
+ * @return false if no sync is due or the job queue is full
+ */
+bool sync_check(void)
+{
+	if (g_sync_state.sync_queued || !sync_is_due())
+	{
+		return false;
+	}
+	MYLOG("SYNC", "Sync %d notes with NoteHub", g_sync_state.pending_notes);
+	g_sync_state.queued_notes = g_sync_state.pending_notes;
+	g_sync_state.sync_queued = blues_queue_job(BLUES_JOB_SYNC, NULL, 0, BLUES_TAG_NONE);
+	return g_sync_state.sync_queued;
+}
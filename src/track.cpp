@@ -0,0 +1,211 @@
+/**
+ * @file track.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Trajectory simplification of the GNSS fixes before they are sent
+ * @version 0.1
+ * @date 2023-09-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Maximum number of fixes in the opening window */
+#define TRACK_WINDOW 16
+
+/** Mean earth radius in m */
+#define EARTH_RADIUS 6371000.0
+
+/** Points are rounded to 0.000001 deg, this moves a fix by up to 0.08 m */
+#define TRACK_ROUND_MARGIN 0.1f
+
+/** Fixes since the last significant point, the anchor is the first one */
+static s_track_point track_window[TRACK_WINDOW];
+
+/** Number of fixes in the window */
+static uint8_t track_window_len = 0;
+
+/** Significant points waiting to be sent */
+static s_track_point track_points[TRACK_MAX_POINTS];
+
+/** Index of the oldest significant point */
+static uint8_t track_head = 0;
+
+/** Number of significant points waiting */
+static uint8_t track_len = 0;
+
+/** Statistics of the simplifier */
+s_track_stats g_track_stats;
+
+/**
+ * @brief Keep a significant point for sending
+ *        If the buffer is full, the oldest point is dropped
+ *
+ * @param point significant point
+ */
+static void track_emit(s_track_point *point)
+{
+	if (track_len == TRACK_MAX_POINTS)
+	{
+		track_head = (track_head + 1) % TRACK_MAX_POINTS;
+		track_len--;
+		g_track_stats.dropped++;
+	}
+	track_points[(track_head + track_len) % TRACK_MAX_POINTS] = *point;
+	track_len++;
+	g_track_stats.points_out++;
+}
+
+/**
+ * @brief Distance of a point from the line between anchor and end point
+ *        The locations are projected on a plane around the anchor.
+ *        The differences of the rounded points are small integers, so the
+ *        float calculation keeps cm resolution anywhere on earth
+ *
+ * @param anchor start of the line
+ * @param end end of the line
+ * @param point point to check
+ * @return float distance in m
+ */
+static float track_offset(s_track_point *anchor, s_track_point *end, s_track_point *point)
+{
+	float scale_y = DEG_TO_RAD * EARTH_RADIUS / 1000000.0;
+	float scale_x = cosf(anchor->latitude / 1000000.0 * DEG_TO_RAD) * scale_y;
+
+	float end_x = (float)(end->longitude - anchor->longitude) * scale_x;
+	float end_y = (float)(end->latitude - anchor->latitude) * scale_y;
+	float pt_x = (float)(point->longitude - anchor->longitude) * scale_x;
+	float pt_y = (float)(point->latitude - anchor->latitude) * scale_y;
+
+	float len_sq = end_x * end_x + end_y * end_y;
+	float t = len_sq == 0.0 ? 0.0 : (pt_x * end_x + pt_y * end_y) / len_sq;
+	if (t < 0.0)
+	{
+		t = 0.0;
+	}
+	else if (t > 1.0)
+	{
+		t = 1.0;
+	}
+	float dx = pt_x - t * end_x;
+	float dy = pt_y - t * end_y;
+	return sqrtf(dx * dx + dy * dy);
+}
+
+/**
+ * @brief Add a GNSS fix to the track
+ *        Opening window simplification: the fix extends the line from the
+ *        anchor as long as all fixes in between stay within the tolerance.
+ *        Otherwise the previous fix is significant and becomes the new anchor.
+ *        The fix is rounded like in the payload. The tolerance is reduced by
+ *        the rounding, so the sent track stays within the tolerance of the
+ *        fixes before they were rounded.
+ *
+ * @param latitude latitude in degrees
+ * @param longitude longitude in degrees
+ * @param fix_time epoch time of the fix
+ */
+void track_add_fix(double latitude, double longitude, uint32_t fix_time)
+{
+	s_track_point fix = {(int32_t)lround(latitude * 1000000), (int32_t)lround(longitude * 1000000), fix_time};
+
+	if ((track_window_len != 0) && (track_window[track_window_len - 1].fix_time == fix_time))
+	{
+		// Same fix as before
+		return;
+	}
+	g_track_stats.fixes_in++;
+
+	if ((track_window_len == 0) || (g_blues_settings.track_tolerance == 0))
+	{
+		// First fix or simplification disabled, the fix is significant
+		track_emit(&fix);
+		track_window[0] = fix;
+		track_window_len = 1;
+		return;
+	}
+
+	float tolerance = g_blues_settings.track_tolerance - TRACK_ROUND_MARGIN;
+	bool outside = track_window_len == TRACK_WINDOW;
+	for (uint8_t idx = 1; (idx < track_window_len) && !outside; idx++)
+	{
+		outside = track_offset(&track_window[0], &fix, &track_window[idx]) > tolerance;
+	}
+
+	if (outside)
+	{
+		// Last fix that was still on the line starts a new window
+		track_emit(&track_window[track_window_len - 1]);
+		track_window[0] = track_window[track_window_len - 1];
+		track_window_len = 1;
+	}
+	track_window[track_window_len] = fix;
+	track_window_len++;
+}
+
+/**
+ * @brief Make the last fix of the window a significant point
+ *        Used before the points are sent, so the track ends at the current location
+ *
+ */
+void track_flush(void)
+{
+	if (track_window_len > 1)
+	{
+		track_emit(&track_window[track_window_len - 1]);
+		track_window[0] = track_window[track_window_len - 1];
+		track_window_len = 1;
+	}
+}
+
+/**
+ * @brief Get the number of significant points waiting
+ *
+ * @return uint8_t number of points
+ */
+uint8_t track_available(void)
+{
+	return track_len;
+}
+
+/**
+ * @brief Get a significant point without removing it
+ *
+ * @param idx index of the point, 0 is the oldest
+ * @return s_track_point* point, NULL if idx is out of range
+ */
+s_track_point *track_peek(uint8_t idx)
+{
+	if (idx >= track_len)
+	{
+		return NULL;
+	}
+	return &track_points[(track_head + idx) % TRACK_MAX_POINTS];
+}
+
+/**
+ * @brief Remove the oldest significant points after they were sent
+ *
+ * @param count number of points to remove
+ */
+void track_consume(uint8_t count)
+{
+	if (count > track_len)
+	{
+		count = track_len;
+	}
+	track_head = (track_head + count) % TRACK_MAX_POINTS;
+	track_len -= count;
+}
+
+/**
+ * @brief Remove all fixes and points
+ *
+ */
+void track_reset(void)
+{
+	track_window_len = 0;
+	track_head = 0;
+	track_len = 0;
+	memset((void *)&g_track_stats, 0, sizeof(s_track_stats));
+}
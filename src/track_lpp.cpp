@@ -0,0 +1,242 @@
+/**
+ * @file track_lpp.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Cayenne LPP types for a track of GNSS points with delta encoding, the sequence number, the diagnostics and the stage timing
+ * @version 0.1
+ * @date 2023-09-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Size of channel, type and point count */
+#define TRACK_HEADER_SIZE 3
+
+/** Size of the absolute anchor point, latitude, longitude and time */
+#define TRACK_ANCHOR_SIZE 12
+
+/** Longest encoding of one delta point, three 32 bit varints */
+#define TRACK_DELTA_MAX_SIZE 15
+
+/** Room kept free for the device ID that is added on the cellular path */
+#define TRACK_RESERVE PayloadField_CELL_DEVID::total
+
+/**
+ * @brief Write a value as big endian into the buffer
+ *
+ * @param buffer destination
+ * @param value value to write
+ */
+static void track_put_u32(uint8_t *buffer, uint32_t value)
+{
+	buffer[0] = value >> 24;
+	buffer[1] = value >> 16;
+	buffer[2] = value >> 8;
+	buffer[3] = value;
+}
+
+/**
+ * @brief Write a value as big endian into the buffer
+ *
+ * @param buffer destination
+ * @param value value to write
+ */
+static void track_put_u16(uint8_t *buffer, uint16_t value)
+{
+	buffer[0] = value >> 8;
+	buffer[1] = value;
+}
+
+/**
+ * @brief Write a value as varint, 7 bits per byte, lowest bits first
+ *
+ * @param buffer destination
+ * @param value value to write
+ * @return uint8_t number of bytes written
+ */
+static uint8_t track_put_varint(uint8_t *buffer, uint32_t value)
+{
+	uint8_t len = 0;
+	while (value >= 0x80)
+	{
+		buffer[len++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	buffer[len++] = value;
+	return len;
+}
+
+/**
+ * @brief Map a signed value to an unsigned one, small magnitudes give small values
+ *
+ * @param value signed value
+ * @return uint32_t zigzag encoded value
+ */
+static uint32_t track_zigzag(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/**
+ * @brief Get the largest payload that can be sent right now
+ *        Over LoRaWAN the limit depends on the data rate. The packet must
+ *        fit into the store-and-forward queue as well.
+ *
+ * @return uint8_t maximum payload size
+ */
+uint8_t track_max_payload(void)
+{
+	uint8_t max_size = QUEUE_PAYLOAD_SIZE - TRACK_RESERVE;
+	if (g_lorawan_settings.lorawan_enable && g_lpwan_has_joined)
+	{
+		uint8_t lora_max = lora_max_payload();
+		if (lora_max < max_size)
+		{
+			max_size = lora_max;
+		}
+	}
+	return max_size;
+}
+
+/**
+ * @brief Add the waiting significant track points to the payload
+ *        Format: channel, type 140, number of points, first point with latitude,
+ *        longitude (0.000001 deg signed MSB) and epoch time (unsigned MSB),
+ *        then per point the zigzag varint deltas of latitude and longitude and
+ *        the varint time delta to the previous point.
+ *        As many points as fit into max_size are added and removed from the track.
+ *
+ * @param channel LPP channel
+ * @param max_size maximum size of the whole payload
+ * @return uint8_t number of points added
+ */
+uint8_t WisCayenneTracker::addTrack(uint8_t channel, uint8_t max_size)
+{
+	uint8_t limit = max_size < _maxsize ? max_size : _maxsize;
+	if ((track_available() == 0) || ((_cursor + TRACK_HEADER_SIZE + TRACK_ANCHOR_SIZE) > limit))
+	{
+		return 0;
+	}
+
+	uint8_t count_pos = _cursor + 2;
+	_buffer[_cursor++] = channel;
+	_buffer[_cursor++] = PAYLOAD_TYPE_TRACK;
+	_buffer[_cursor++] = 1;
+
+	s_track_point *point = track_peek(0);
+	int32_t last_lat = point->latitude;
+	int32_t last_lon = point->longitude;
+	uint32_t last_time = point->fix_time;
+	track_put_u32(&_buffer[_cursor], (uint32_t)last_lat);
+	track_put_u32(&_buffer[_cursor + 4], (uint32_t)last_lon);
+	track_put_u32(&_buffer[_cursor + 8], last_time);
+	_cursor += TRACK_ANCHOR_SIZE;
+
+	uint8_t count = 1;
+	uint8_t delta[TRACK_DELTA_MAX_SIZE];
+	while ((count < track_available()) && (count < 255))
+	{
+		point = track_peek(count);
+		int32_t lat = point->latitude;
+		int32_t lon = point->longitude;
+
+		uint8_t len = track_put_varint(delta, track_zigzag(lat - last_lat));
+		len += track_put_varint(&delta[len], track_zigzag(lon - last_lon));
+		len += track_put_varint(&delta[len], point->fix_time - last_time);
+		if ((_cursor + len) > limit)
+		{
+			break;
+		}
+		memcpy(&_buffer[_cursor], delta, len);
+		_cursor += len;
+
+		last_lat = lat;
+		last_lon = lon;
+		last_time = point->fix_time;
+		count++;
+	}
+	_buffer[count_pos] = count;
+	track_consume(count);
+	return count;
+}
+
+/**
+ * @brief Add the sequence number of the reading
+ *        Format: channel, type 143, sequence number (unsigned MSB)
+ *
+ * @param sequence sequence number
+ * @return uint8_t payload size, 0 if the buffer is full
+ */
+uint8_t WisCayenneTracker::addSequence(uint32_t sequence)
+{
+	static_assert(PayloadField_SEQ::size == 4, "Sequence number does not match the payload schema");
+	if ((_cursor + PayloadField_SEQ::total) > _maxsize)
+	{
+		return 0;
+	}
+	_buffer[_cursor++] = PAYLOAD_CH_SEQ;
+	_buffer[_cursor++] = PAYLOAD_TYPE_SEQ;
+	track_put_u32(&_buffer[_cursor], sequence);
+	_cursor += 4;
+	return _cursor;
+}
+
+/**
+ * @brief Add the diagnostics of the last reset
+ *        Format: channel, type 144, reset cause, boots (unsigned MSB),
+ *        abnormal resets (unsigned MSB), uptime before the reset in minutes (unsigned MSB),
+ *        heap usage before the reset in percent
+ *
+ * @return uint8_t payload size, 0 if the buffer is full
+ */
+uint8_t WisCayenneTracker::addDiag(void)
+{
+	static_assert(PayloadField_DIAG::size == 8, "Diagnostics do not match the payload schema");
+	if ((_cursor + PayloadField_DIAG::total) > _maxsize)
+	{
+		return 0;
+	}
+	uint32_t uptime_min = g_diag.uptime_s / 60;
+	uint32_t heap_total = (uint32_t)dbgHeapTotal();
+	uint32_t heap_percent = heap_total == 0 ? 0 : (g_diag.heap_hwm * 100) / heap_total;
+
+	_buffer[_cursor++] = PAYLOAD_CH_DIAG;
+	_buffer[_cursor++] = PAYLOAD_TYPE_DIAG;
+	_buffer[_cursor++] = g_diag.cause;
+	track_put_u16(&_buffer[_cursor], g_diag.boots);
+	track_put_u16(&_buffer[_cursor + 2], g_diag.abnormal);
+	track_put_u16(&_buffer[_cursor + 4], uptime_min > 0xFFFF ? 0xFFFF : uptime_min);
+	_cursor += 6;
+	_buffer[_cursor++] = heap_percent > 100 ? 100 : heap_percent;
+	return _cursor;
+}
+
+/**
+ * @brief Add the average stage times and the charge of the last cycle
+ *        Format: channel, type 145, average time in ms of the event handler, BME680,
+ *        location, cellular send and LoRaWAN TX (each unsigned MSB),
+ *        estimated charge of the last cycle in uAh (unsigned MSB)
+ *
+ * @return uint8_t payload size, 0 if the buffer is full
+ */
+uint8_t WisCayenneTracker::addTiming(void)
+{
+	static_assert(PayloadField_TIMING::size == 2 * (TIMING_NUM + 1), "Stage timing does not match the payload schema");
+	if ((_cursor + PayloadField_TIMING::total) > _maxsize)
+	{
+		return 0;
+	}
+	_buffer[_cursor++] = PAYLOAD_CH_TIMING;
+	_buffer[_cursor++] = PAYLOAD_TYPE_TIMING;
+	for (uint8_t stage = 0; stage < TIMING_NUM; stage++)
+	{
+		uint32_t avg_ms = timing_avg_ms(stage);
+		track_put_u16(&_buffer[_cursor], avg_ms > 0xFFFF ? 0xFFFF : avg_ms);
+		_cursor += 2;
+	}
+	uint32_t charge = (uint32_t)g_timing_cycle_uah;
+	track_put_u16(&_buffer[_cursor], charge > 0xFFFF ? 0xFFFF : charge);
+	_cursor += 2;
+	return _cursor;
+}
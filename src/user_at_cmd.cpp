@@ -10,16 +10,6 @@
  */
 #include "main.h"
 
-#include <Adafruit_LittleFS.h>
-#include <InternalFileSystem.h>
-using namespace Adafruit_LittleFS_Namespace;
-
-/** Filename to save Blues settings */
-static const char blues_file_name[] = "BLUES";
-
-/** File to save battery check status */
-File this_file(InternalFS);
-
 /** Structure for saved Blues Notecard settings */
 s_blues_settings g_blues_settings;
 
@@ -276,97 +266,160 @@ int at_query_blues_trigger(void)
 }
 
 /**
- * @brief Reset saved NoteCard settings
+ * @brief Set the limits of the adaptive send interval
  *
- * @return int AT_SUCCESS
+ * @param str params as string, format <min>:<max> in seconds, 0 as min to use the fixed interval
+ * @return int
+ * 			AT_SUCCESS is params are set correct
+ * 			AT_ERRNO_PARA_NUM if params error
+ * 			AT_ERRNO_PARA_VAL if values are out of range
  */
-static int at_reset_blues_settings(void)
+int at_set_blues_interval(char *str)
 {
-	if (InternalFS.exists(blues_file_name))
+	char *param = strtok(str, ":");
+	if (param == NULL)
 	{
-		InternalFS.remove(blues_file_name);
+		return AT_ERRNO_PARA_NUM;
+	}
+	long new_min = strtol(param, NULL, 0);
+	long new_max = g_blues_settings.max_interval;
+	param = strtok(NULL, ":");
+	if (param != NULL)
+	{
+		new_max = strtol(param, NULL, 0);
+	}
+
+	if (new_min != 0)
+	{
+		if ((new_min < 10) || (new_max < new_min) || (new_max > 86400))
+		{
+			MYLOG("USR_AT", "Invalid interval limits %ld:%ld", new_min, new_max);
+			return AT_ERRNO_PARA_VAL;
+		}
+	}
+
+	if ((new_min != g_blues_settings.min_interval) || (new_max != g_blues_settings.max_interval))
+	{
+		g_blues_settings.min_interval = new_min;
+		g_blues_settings.max_interval = new_max;
+		save_blues_settings();
+		// Start again from the fixed interval
+		interval_reset();
 	}
 	return AT_SUCCESS;
 }
 
 /**
- * @brief Get NoteCard connection information
+ * @brief Get the limits of the adaptive send interval and the interval in use
+ *        Format: min:max:current, all in seconds
  *
  * @return int AT_SUCCESS
  */
-int at_blues_status(void)
+int at_query_blues_interval(void)
 {
-	blues_hub_status();
-	snprintf(g_at_query_buf, ATQUERY_SIZE, "%s", blues_response);
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%lu:%lu:%lu", (unsigned long)g_blues_settings.min_interval,
+			 (unsigned long)g_blues_settings.max_interval, (unsigned long)(interval_current() / 1000));
 	return AT_SUCCESS;
 }
 
 /**
- * @brief Read saved Blues Product ID
+ * @brief Set the allowed error of the track simplification
  *
+ * @param str tolerance in m as string, 0 to 1000, 0 keeps every fix
+ * @return int
+ * 			AT_SUCCESS is params are set correct
+ * 			AT_ERRNO_PARA_VAL if params error
  */
-bool read_blues_settings(void)
+int at_set_track_tolerance(char *str)
 {
-	bool structure_valid = false;
-	if (InternalFS.exists(blues_file_name))
-	{
-		this_file.open(blues_file_name, FILE_O_READ);
-		this_file.read((void *)&g_blues_settings.valid_mark, sizeof(s_blues_settings));
-		this_file.close();
+	long new_tolerance = strtol(str, NULL, 0);
 
-		// Check for valid data
-		if (g_blues_settings.valid_mark == 0xAA55)
-		{
-			structure_valid = true;
-			MYLOG("USR_AT", "Valid Blues settings found, Blues Product UID = %s", g_blues_settings.product_uid);
-			if (g_blues_settings.use_ext_sim)
-			{
-				MYLOG("USR_AT", "Using external SIM with APN = %s", g_blues_settings.ext_sim_apn);
-			}
-			else
-			{
-				MYLOG("USR_AT", "Using eSIM");
-			}
-		}
-		else
-		{
-			MYLOG("USR_AT", "No valid Blues settings found");
-		}
+	if ((new_tolerance < 0) || (new_tolerance > 1000))
+	{
+		MYLOG("USR_AT", "Invalid track tolerance %ld", new_tolerance);
+		return AT_ERRNO_PARA_VAL;
 	}
 
-	if (!structure_valid)
+	if (new_tolerance != g_blues_settings.track_tolerance)
 	{
-		return false;
-
-		// No settings file found optional to set defaults (ommitted!)
-		// g_blues_settings.valid_mark = 0xAA55;										// Validity marker
-		// sprintf(g_blues_settings.product_uid, "com.my-company.my-name:my-project"); // Blues Product UID
-		// g_blues_settings.conn_continous = false;									// Use periodic connection
-		// g_blues_settings.use_ext_sim = false;										// Use external SIM
-		// sprintf(g_blues_settings.ext_sim_apn, "-");									// APN to be used with external SIM
-		// g_blues_settings.motion_trigger = true;										// Send data on motion trigger
-		// save_blues_settings();
+		g_blues_settings.track_tolerance = new_tolerance;
+		save_blues_settings();
+		// Points of the old tolerance are not mixed with the new ones
+		track_reset();
 	}
+	return AT_SUCCESS;
+}
 
-	return true;
+/**
+ * @brief Get the track simplification settings and statistics
+ *        Format: tolerance:fixes:significant points:dropped points
+ *
+ * @return int AT_SUCCESS
+ */
+int at_query_track_tolerance(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%lu:%lu:%lu", g_blues_settings.track_tolerance,
+			 (unsigned long)g_track_stats.fixes_in, (unsigned long)g_track_stats.points_out, (unsigned long)g_track_stats.dropped);
+	return AT_SUCCESS;
 }
 
 /**
- * @brief Save the Blues Product ID
+ * @brief Set the number of notes collected on the NoteCard before a sync
  *
+ * @param str batch size as string, 1 to 50
+ * @return int
+ * 			AT_SUCCESS is params are set correct
+ * 			AT_ERRNO_PARA_VAL if params error
  */
-void save_blues_settings(void)
+int at_set_blues_batch(char *str)
 {
-	if (InternalFS.exists(blues_file_name))
+	long new_batch_size = strtol(str, NULL, 0);
+
+	if ((new_batch_size < 1) || (new_batch_size > 50))
+	{
+		MYLOG("USR_AT", "Invalid batch size %ld", new_batch_size);
+		return AT_ERRNO_PARA_VAL;
+	}
+
+	if (new_batch_size != g_blues_settings.batch_size)
 	{
-		InternalFS.remove(blues_file_name);
+		g_blues_settings.batch_size = new_batch_size;
+		save_blues_settings();
 	}
+	return AT_SUCCESS;
+}
 
-	g_blues_settings.valid_mark = 0xAA55;
-	this_file.open(blues_file_name, FILE_O_WRITE);
-	this_file.write((const char *)&g_blues_settings.valid_mark, sizeof(s_blues_settings));
-	this_file.close();
-	MYLOG("USR_AT", "Saved Blues Settings");
+/**
+ * @brief Get the number of notes collected on the NoteCard before a sync
+ *
+ * @return int AT_SUCCESS
+ */
+int at_query_blues_batch(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d", g_blues_settings.batch_size);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Reset saved NoteCard settings
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_reset_blues_settings(void)
+{
+	clear_blues_settings();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Get NoteCard connection information
+ *
+ * @return int AT_SUCCESS
+ */
+int at_blues_status(void)
+{
+	blues_hub_status(g_at_query_buf, ATQUERY_SIZE);
+	return AT_SUCCESS;
 }
 
 int at_blues_req(char *str)
@@ -377,19 +430,247 @@ int at_blues_req(char *str)
 			str[i] = str[i] + 32;			// converting uppercase to lowercase
 	}
 
-	if (!blues_start_req(str))
+	BluesRequest request(str);
+	if (request.json() == NULL)
 	{
 		snprintf(g_at_query_buf, ATQUERY_SIZE, "Request creation failed");
 		return AT_ERRNO_EXEC_FAIL;
 	}
-	
-	if (!blues_send_req())
+
+	if (!request.send())
 	{
 		snprintf(g_at_query_buf, ATQUERY_SIZE, "Send request failed");
 		return AT_ERRNO_EXEC_FAIL;
 	}
-	// Copy response for AT response
-	snprintf(g_at_query_buf, ATQUERY_SIZE, "%s", blues_response);
+	// Print response for AT response
+	if (!request.print(g_at_query_buf, ATQUERY_SIZE))
+	{
+		snprintf(g_at_query_buf, ATQUERY_SIZE, "Response too large");
+	}
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Get the wakeup cycle statistics
+ *        Format per cycle type: cycles:last ms:avg ms:max ms:last transactions:max transactions:heap HWM
+ *        followed by the request arena usage: arena HWM:heap fallbacks:bulk releases:leaked blocks
+ *
+ * @return int AT_SUCCESS
+ */
+int at_query_cycle_stats(void)
+{
+	int idx = 0;
+	for (uint8_t type = 0; type < CYCLE_NUM; type++)
+	{
+		s_cycle_stats *stats = &g_cycle_stats[type];
+		uint32_t avg_time_ms = stats->cycles == 0 ? 0 : stats->sum_time_ms / stats->cycles;
+		idx += snprintf(&g_at_query_buf[idx], ATQUERY_SIZE - idx, "%s%s:%lu:%lu:%lu:%lu:%d:%d:%lu",
+						type == 0 ? "" : ";",
+						type == CYCLE_STATUS ? "S" : "C",
+						(unsigned long)stats->cycles, (unsigned long)stats->last_time_ms, (unsigned long)avg_time_ms, (unsigned long)stats->max_time_ms,
+						stats->last_nc_trans, stats->max_nc_trans, (unsigned long)stats->heap_hwm);
+		if (idx >= ATQUERY_SIZE)
+		{
+			return AT_SUCCESS;
+		}
+	}
+	snprintf(&g_at_query_buf[idx], ATQUERY_SIZE - idx, ";A:%lu:%lu:%lu:%lu",
+			 (unsigned long)g_arena_stats.high_water_mark, (unsigned long)g_arena_stats.heap_fallbacks,
+			 (unsigned long)g_arena_stats.resets, (unsigned long)g_arena_stats.leaked_blocks);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Clear the wakeup cycle statistics
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_reset_cycle_stats(void)
+{
+	cycle_stats_reset();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Get the store-and-forward queue status
+ *        Format: queued packets:dropped packets:sent packets:ms per sent packet
+ *
+ * @return int AT_SUCCESS
+ */
+int at_query_queue(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%lu:%lu:%lu:%lu",
+			 (unsigned long)g_queue_stats.depth, (unsigned long)g_queue_stats.drops, (unsigned long)g_queue_stats.drained, (unsigned long)g_queue_stats.drain_ms_per_packet);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Get the link statistics of the path selection
+ *        Format: LoRaWAN ACK rate %:RSSI:SNR:cellular success rate %:signal bars:readings that skipped LoRaWAN:fallback delay ms
+ *
+ * @return int AT_SUCCESS
+ */
+int at_query_path(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%d:%d:%d:%d:%lu:%lu",
+			 (int)(g_path_stats.lora_success * 100), g_path_stats.lora_rssi, g_path_stats.lora_snr,
+			 (int)(g_path_stats.cell_success * 100), g_path_stats.cell_bars, (unsigned long)g_path_stats.skipped, (unsigned long)path_fallback_delay());
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Reset the link statistics of the path selection
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_reset_path(void)
+{
+	init_path_selector();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Get the state of the rejoin scheduler
+ *        Format: join cycles:successful joins:failed joins in a row:join success rate %:join airtime ms:seconds until the next join is allowed
+ *
+ * @return int AT_SUCCESS
+ */
+int at_query_rejoin(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%lu:%lu:%d:%d:%lu:%lu",
+			 (unsigned long)g_rejoin_state.attempts, (unsigned long)g_rejoin_state.joined, g_rejoin_state.failures,
+			 (int)(g_rejoin_state.success_rate * 100), (unsigned long)g_rejoin_state.airtime_ms, (unsigned long)(rejoin_wait() / 1000));
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Clear the back-off and the statistics of the rejoin scheduler
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_reset_rejoin(void)
+{
+	rejoin_reset();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Get the diagnostics of the last reset
+ *        Format: reset cause:boots:abnormal resets:uptime before the reset s:heap HWM before the reset:last NoteCard error
+ *        In the debug build the saved log records are printed before, decode them with decode_log.py
+ *
+ * @return int AT_SUCCESS
+ */
+int at_query_diag(void)
+{
+#if MY_DEBUG > 0
+	char line[LOG_HEX_SIZE];
+	for (uint8_t idx = 0; idx < g_diag.log_count; idx++)
+	{
+		log_to_hex(&g_diag.log[idx], line);
+		AT_PRINTF("%s", line);
+	}
+#endif
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%d:%d:%lu:%lu:%s",
+			 g_diag.cause, g_diag.boots, g_diag.abnormal, (unsigned long)g_diag.uptime_s, (unsigned long)g_diag.heap_hwm, g_diag.note_error);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Clear the reset counters
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_reset_diag(void)
+{
+	diag_clear();
+	return AT_SUCCESS;
+}
+
+/** Short names of the stages in the AT command response */
+static const char *timing_names[TIMING_NUM] = {"E", "B", "L", "C", "T"};
+
+/**
+ * @brief Get the stage timing
+ *        The wall time histogram of each stage is printed before, bucket n counts times below 2^n ms
+ *        Format per stage: name:count:avg ms:max ms:avg CPU us:avg uAh
+ *        followed by Q:uAh of the last cycle:timing channel enabled
+ *
+ * @return int AT_SUCCESS
+ */
+int at_query_timing(void)
+{
+	char line[8 + TIMING_BUCKETS * 6];
+	for (uint8_t stage = 0; stage < TIMING_NUM; stage++)
+	{
+		s_timing_stats *stats = &g_timing_stats[stage];
+		int pos = snprintf(line, sizeof(line), "%s", timing_names[stage]);
+		for (uint8_t bucket = 0; bucket < TIMING_BUCKETS; bucket++)
+		{
+			pos += snprintf(&line[pos], sizeof(line) - pos, "%c%d", bucket == 0 ? ':' : ',', stats->histogram[bucket]);
+		}
+		AT_PRINTF("%s\n", line);
+	}
+
+	int idx = 0;
+	for (uint8_t stage = 0; stage < TIMING_NUM; stage++)
+	{
+		s_timing_stats *stats = &g_timing_stats[stage];
+		uint32_t avg_active_us = stats->count == 0 ? 0 : stats->sum_active_us / stats->count;
+		float avg_uah = stats->count == 0 ? 0 : stats->sum_uah / stats->count;
+		idx += snprintf(&g_at_query_buf[idx], ATQUERY_SIZE - idx, "%s:%lu:%lu:%lu:%lu:%.2f;",
+						timing_names[stage], (unsigned long)stats->count, (unsigned long)timing_avg_ms(stage), (unsigned long)stats->max_ms, (unsigned long)avg_active_us, avg_uah);
+		if (idx >= ATQUERY_SIZE)
+		{
+			return AT_SUCCESS;
+		}
+	}
+	snprintf(&g_at_query_buf[idx], ATQUERY_SIZE - idx, "Q:%.1f:%d", g_timing_cycle_uah, g_blues_settings.timing_channel ? 1 : 0);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Enable or disable the stage timing channel in the packets
+ *
+ * @param str "1" to add the channel, "0" to remove it
+ * @return int
+ * 			AT_SUCCESS is params are set correct
+ * 			AT_ERRNO_PARA_VAL if params error
+ */
+int at_set_timing(char *str)
+{
+	if ((str[0] != '0') && (str[0] != '1'))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	bool enable = str[0] == '1';
+	if (enable != g_blues_settings.timing_channel)
+	{
+		g_blues_settings.timing_channel = enable;
+		save_blues_settings();
+	}
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Clear the stage timing
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_reset_timing(void)
+{
+	timing_reset();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Remove all packets from the store-and-forward queue
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_clear_queue(void)
+{
+	packet_queue_clear();
 	return AT_SUCCESS;
 }
 
@@ -404,9 +685,18 @@ atcmd_t g_user_at_cmd_new_list[] = {
 	{"+BSIM", "Set/get Blues SIM settings", at_query_blues_ext_sim, at_set_blues_ext_sim, NULL, "RW"},
 	{"+BMOD", "Set/get Blues NoteCard connection modes", at_query_blues_mode, at_set_blues_mode, NULL, "RW"},
 	{"+BTRIG", "Set/get Blues send trigger", at_query_blues_trigger, at_set_blues_trigger, NULL, "RW"},
+	{"+BINT", "Set/get adaptive send interval limits", at_query_blues_interval, at_set_blues_interval, NULL, "RW"},
+	{"+BTRACK", "Set/get track simplification tolerance", at_query_track_tolerance, at_set_track_tolerance, NULL, "RW"},
+	{"+BBATCH", "Set/get number of notes before a sync", at_query_blues_batch, at_set_blues_batch, NULL, "RW"},
 	{"+BR", "Remove all Blues Settings", NULL, NULL, at_reset_blues_settings, "W"},
 	{"+BLUES", "Blues Notecard Status", at_blues_status, NULL, NULL, "R"},
 	{"+BREQ", "Send a Blues Notecard Request", NULL, at_blues_req, NULL, "W"},
+	{"+BQUEUE", "Get/clear the store-and-forward queue", at_query_queue, NULL, at_clear_queue, "RW"},
+	{"+BBENCH", "Get/clear wakeup cycle statistics", at_query_cycle_stats, NULL, at_reset_cycle_stats, "RW"},
+	{"+BPATH", "Get/reset link statistics of the path selection", at_query_path, NULL, at_reset_path, "RW"},
+	{"+BJOIN", "Get/reset rejoin back-off and statistics", at_query_rejoin, NULL, at_reset_rejoin, "RW"},
+	{"+BDIAG", "Get reset diagnostics/clear reset counters", at_query_diag, NULL, at_reset_diag, "RW"},
+	{"+BSTAGE", "Get/clear stage timing, enable/disable the timing channel", at_query_timing, at_set_timing, at_reset_timing, "RW"},
 };
 
 /** Number of user defined AT commands */